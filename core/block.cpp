@@ -0,0 +1,97 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "block.hpp"
+
+namespace
+{
+
+bool is_block_end(const AxDecodedBundle& bundle) noexcept
+{
+    static constexpr uint32_t bru_issue = 7;
+    static constexpr uint32_t cu_issue = 13;
+
+    return bundle.ops[0].issue == bru_issue || (bundle.op_count == 2 && bundle.ops[1].issue == cu_issue);
+}
+
+bool is_read_only(const AxDecodedBundle& bundle) noexcept
+{
+    static constexpr uint32_t lsu_unit = 2;
+    static constexpr uint32_t cu_issue = 13;
+
+    for(uint32_t i = 0; i < bundle.op_count; ++i)
+    {
+        const auto& op = bundle.ops[i];
+        if(op.issue == cu_issue)
+        {
+            return false;
+        }
+
+        const bool store = op.operation == AX_EXE_LSU_ST || op.operation == AX_EXE_LSU_FST
+                        || op.operation == AX_EXE_LSU_STI || op.operation == AX_EXE_LSU_FSTI;
+        if((op.issue & 7) == lsu_unit && store)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool is_static_exit(const AxDecodedBundle& bundle) noexcept
+{
+    const auto& first = bundle.ops[0];
+    if(first.operation == AX_EXE_BRU_INDIRECTCALL || first.operation == AX_EXE_BRU_INDIRECTCALLR)
+    {
+        return false;
+    }
+
+    return bundle.op_count == 1 || bundle.ops[1].operation != AX_EXE_CU_RETI;
+}
+
+}
+
+void AxBlock::link(AxBlock* next) noexcept
+{
+    for(auto& link : links)
+    {
+        if(!link)
+        {
+            link = next;
+            return;
+        }
+    }
+
+    links[1] = next;
+}
+
+AxBlock& AxBlockCache::get(uint32_t pc, AxDecodeCache& decoder)
+{
+    auto& block = m_blocks[pc];
+    if(block)
+    {
+        return *block;
+    }
+
+    block = std::make_unique<AxBlock>();
+    block->pc = pc;
+    block->static_exit = true;
+    block->read_only = true;
+
+    auto current = pc;
+    while(block->bundles.size() < AxBlock::MAX_BUNDLES)
+    {
+        const auto& bundle = decoder.fetch(current & 0x7FFFFFFF);
+        block->bundles.emplace_back(bundle);
+        block->read_only = block->read_only && is_read_only(bundle);
+        if(is_block_end(bundle))
+        {
+            block->static_exit = is_static_exit(bundle);
+            break;
+        }
+
+        current += bundle.size;
+    }
+
+    return *block;
+}
@@ -0,0 +1,105 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXBLOCK_HPP_INCLUDED
+#define AXBLOCK_HPP_INCLUDED
+
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "decoder.hpp"
+
+// Native code of a block, see AxJit. Returns the number of emulated cycles.
+using AxNativeBlock = uint32_t (*)();
+
+// Native code of a region starting at a block, see AxLLVMJit.
+// registers: the AxCore::RegisterSet of the core that compiled the region.
+// Runs at least one block and stops on side exits or once max_cycles cycles have been run.
+// Returns the number of emulated cycles.
+using AxNativeRegion = uint64_t (*)(void* registers, uint64_t max_cycles);
+
+// Straight-line sequence of decoded bundles.
+// A block ends after a bundle containing a BRU or a CU operation (branches, syscalls, ...),
+// or when it reaches MAX_BUNDLES.
+struct AxBlock
+{
+    static constexpr std::size_t MAX_BUNDLES = 64;
+
+    uint32_t pc{};
+    // true if the block successors are known at translation time (no indirect branch)
+    bool static_exit{};
+    // true if the block has no store and no CU operation, see AxCore::spinning
+    bool read_only{};
+    std::vector<AxDecodedBundle> bundles{};
+    // Chained successors, at most 2 for a static exit (taken and not taken)
+    std::array<AxBlock*, 2> links{};
+    // Executions outside of a region, used to find hot blocks
+    uint32_t executions{};
+    AxNativeBlock native{};
+    AxNativeRegion region{};
+
+    AxBlock* linked(uint32_t next_pc) const noexcept
+    {
+        for(auto* link : links)
+        {
+            if(link && link->pc == next_pc)
+            {
+                return link;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void link(AxBlock* next) noexcept;
+};
+
+// Cache of translated blocks, indexed by their first PC
+class AxBlockCache
+{
+public:
+    AxBlockCache() = default;
+    ~AxBlockCache() = default;
+    AxBlockCache(const AxBlockCache&) = delete;
+    AxBlockCache& operator=(const AxBlockCache&) = delete;
+    AxBlockCache(AxBlockCache&&) noexcept = delete;
+    AxBlockCache& operator=(AxBlockCache&&) noexcept = delete;
+
+    // Get block starting at pc, translate it if needed
+    AxBlock& get(uint32_t pc, AxDecodeCache& decoder);
+
+    // Get block starting at pc, returns nullptr if it has not been translated yet
+    AxBlock* find(uint32_t pc) const
+    {
+        const auto it = m_blocks.find(pc);
+        return it != m_blocks.end() ? it->second.get() : nullptr;
+    }
+
+    // Drop all blocks if code has been modified since they were translated.
+    // Returns true if blocks were dropped, any AxBlock pointer is then dangling.
+    bool sync(const AxDecodeCache& decoder)
+    {
+        if(decoder.generation() == m_generation) [[likely]]
+        {
+            return false;
+        }
+
+        clear();
+        m_generation = decoder.generation();
+        return true;
+    }
+
+    void clear() noexcept
+    {
+        m_blocks.clear();
+    }
+
+private:
+    std::unordered_map<uint32_t, std::unique_ptr<AxBlock>> m_blocks{};
+    uint64_t m_generation{};
+};
+
+#endif
@@ -0,0 +1,214 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "cache.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <string_view>
+#include <utility>
+#include <fmt/format.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define AX_CACHE_SSE2 1
+#endif
+
+#include "core.hpp"
+#include "memory.hpp"
+#include "panic.hpp"
+
+namespace
+{
+
+double miss_rate(const AxCacheStats& stats) noexcept
+{
+    const auto total = stats.hits + stats.misses;
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(stats.misses) / static_cast<double>(total);
+}
+
+void report_cache(fmt::memory_buffer& buffer, std::string_view name, const AxCache& cache, std::span<const AxCore::Symbol> symbols, std::size_t max_symbols)
+{
+    const auto& config = cache.config();
+    const auto& total = cache.stats();
+    fmt::format_to(std::back_inserter(buffer), "{} ({} Kio, {}-way, {} B lines): {} hits, {} misses ({:.2f}%)\n",
+        name, config.size / 1024, config.ways, config.line_size, total.hits, total.misses, miss_rate(total));
+
+    std::array<AxCacheStats, AxMemory::REGION_COUNT> per_region{};
+    std::vector<AxCacheStats> per_symbol(symbols.size());
+    cache.for_each_line([&](uint64_t addr, const AxCacheStats& stats)
+    {
+        auto& region = per_region[AxMemory::region_index(addr)];
+        region.hits += stats.hits;
+        region.misses += stats.misses;
+
+        // symbols are WRAM offsets
+        if(addr < AxMemory::WRAM_BEGIN)
+        {
+            return;
+        }
+
+        const auto offset = addr - AxMemory::WRAM_BEGIN;
+        auto it = std::upper_bound(std::begin(symbols), std::end(symbols), offset, [](auto&& left, auto&& right)
+        {
+            return left < right.address;
+        });
+
+        if(it != std::begin(symbols))
+        {
+            auto& symbol = per_symbol[static_cast<std::size_t>(std::distance(std::begin(symbols), std::prev(it)))];
+            symbol.hits += stats.hits;
+            symbol.misses += stats.misses;
+        }
+    });
+
+    for(std::size_t i = 0; i < AxMemory::REGION_COUNT; ++i)
+    {
+        const auto& stats = per_region[i];
+        if(stats.hits != 0 || stats.misses != 0)
+        {
+            fmt::format_to(std::back_inserter(buffer), "    {:<6} {:>14} hits {:>14} misses ({:.2f}%)\n",
+                AxMemory::REGION_NAMES[i], stats.hits, stats.misses, miss_rate(stats));
+        }
+    }
+
+    std::vector<std::size_t> order;
+    for(std::size_t i = 0; i < per_symbol.size(); ++i)
+    {
+        if(per_symbol[i].misses != 0)
+        {
+            order.emplace_back(i);
+        }
+    }
+
+    const auto count = std::min(order.size(), max_symbols);
+    std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(count), order.end(), [&](std::size_t left, std::size_t right)
+    {
+        return per_symbol[left].misses > per_symbol[right].misses;
+    });
+
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        const auto& stats = per_symbol[order[i]];
+        fmt::format_to(std::back_inserter(buffer), "    {:<48} {:>14} hits {:>14} misses ({:.2f}%)\n",
+            std::string_view{symbols[order[i]].name}.substr(0, 48), stats.hits, stats.misses, miss_rate(stats));
+    }
+}
+
+}
+
+AxCache::AxCache(const AxCacheConfig& config)
+    : m_config{config}
+{
+    ax_check(std::has_single_bit(config.line_size) && config.line_size >= 4, "Cache line size must be a power of two.");
+    ax_check(std::has_single_bit(config.ways) && config.ways <= MAX_WAYS, "Cache ways must be a power of two up to ", MAX_WAYS, ".");
+    ax_check(config.size % (config.line_size * config.ways) == 0 && std::has_single_bit(config.size / (config.line_size * config.ways)),
+        "Cache size must be a power of two multiple of line size * ways.");
+
+    const auto sets = config.size / (config.line_size * config.ways);
+    m_line_shift = static_cast<uint32_t>(std::countr_zero(config.line_size));
+    m_set_mask = sets - 1;
+    m_tags.resize(config.size / config.line_size);
+    m_stamps.resize(m_tags.size());
+    m_lines.resize(((1ull << 32) >> m_line_shift) / LINE_PAGE_SIZE + 1);
+
+    reset();
+}
+
+void AxCache::reset()
+{
+    std::fill(m_tags.begin(), m_tags.end(), INVALID_TAG);
+    std::fill(m_stamps.begin(), m_stamps.end(), 0);
+    for(auto& page : m_lines)
+    {
+        page.reset();
+    }
+
+    m_clock = 0;
+    m_stats = AxCacheStats{};
+}
+
+uint32_t AxCache::find(const uint32_t* tags, uint32_t tag) const noexcept
+{
+    const auto ways = m_config.ways;
+
+#ifdef AX_CACHE_SSE2
+    // compare 4 tags at once
+    if(ways >= 4)
+    {
+        const auto key = _mm_set1_epi32(static_cast<int>(tag));
+        for(uint32_t i = 0; i < ways; i += 4)
+        {
+            const auto values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags + i));
+            const auto mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(values, key)));
+            if(mask != 0)
+            {
+                return i + static_cast<uint32_t>(std::countr_zero(static_cast<uint32_t>(mask)));
+            }
+        }
+
+        return ways;
+    }
+#endif
+
+    for(uint32_t i = 0; i < ways; ++i)
+    {
+        if(tags[i] == tag)
+        {
+            return i;
+        }
+    }
+
+    return ways;
+}
+
+uint32_t AxCache::select_victim(uint32_t set) noexcept
+{
+    const auto ways = m_config.ways;
+    const uint32_t* const tags = &m_tags[set * ways];
+    const uint64_t* const stamps = &m_stamps[set * ways];
+
+    // fill invalid lines first
+    const auto empty = find(tags, INVALID_TAG);
+    if(empty < ways)
+    {
+        return empty;
+    }
+
+    if(m_config.replacement == AxCacheReplacement::RANDOM)
+    {
+        // xorshift32
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 17;
+        m_random ^= m_random << 5;
+        return m_random & (ways - 1);
+    }
+
+    // oldest use (LRU) or oldest fill (FIFO)
+    return static_cast<uint32_t>(std::distance(stamps, std::min_element(stamps, stamps + ways)));
+}
+
+AxCacheModel::AxCacheModel(const AxCacheConfig& icache, const AxCacheConfig& dcache)
+    : m_icache{icache}
+    , m_dcache{dcache}
+{
+}
+
+AxCacheConfig AxCacheModel::default_icache() noexcept
+{
+    return AxCacheConfig{static_cast<uint32_t>(AxCore::ICACHE_SIZE * 1024), 64, 4, AxCacheReplacement::LRU};
+}
+
+AxCacheConfig AxCacheModel::default_dcache() noexcept
+{
+    return AxCacheConfig{static_cast<uint32_t>(AxCore::DCACHE_SIZE * 128), 64, 4, AxCacheReplacement::LRU};
+}
+
+void AxCacheModel::report(const AxCore& core, std::FILE* output, std::size_t max_symbols) const
+{
+    fmt::memory_buffer buffer;
+    report_cache(buffer, "Instruction cache", m_icache, core.symbols(), max_symbols);
+    report_cache(buffer, "Data cache", m_dcache, core.symbols(), max_symbols);
+    std::fwrite(buffer.data(), 1, buffer.size(), output);
+}
@@ -0,0 +1,197 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXCACHE_HPP_INCLUDED
+#define AXCACHE_HPP_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+class AxCore;
+
+enum class AxCacheReplacement
+{
+    LRU = 0,
+    FIFO = 1,
+    RANDOM = 2,
+};
+
+struct AxCacheConfig
+{
+    uint32_t size{};         // in bytes
+    uint32_t line_size = 64; // in bytes, power of two
+    uint32_t ways = 4;       // power of two, at most MAX_WAYS
+    AxCacheReplacement replacement{};
+};
+
+struct AxCacheStats
+{
+    uint64_t hits{};
+    uint64_t misses{};
+};
+
+// Set-associative cache model, only tags are simulated.
+// Hits and misses are also counted per line, so they can be attributed to regions and symbols afterwards.
+class AxCache
+{
+public:
+    static constexpr uint32_t MAX_WAYS = 16;
+
+    explicit AxCache(const AxCacheConfig& config);
+    ~AxCache() = default;
+    AxCache(const AxCache&) = delete;
+    AxCache& operator=(const AxCache&) = delete;
+    AxCache(AxCache&&) noexcept = delete;
+    AxCache& operator=(AxCache&&) noexcept = delete;
+
+    // Access size bytes at guest address addr, returns true if all touched lines were present
+    bool access(uint64_t addr, uint32_t size)
+    {
+        const auto first = static_cast<uint32_t>(addr) >> m_line_shift;
+        const auto last = static_cast<uint32_t>(addr + size - 1) >> m_line_shift;
+        bool hit = access_line(first);
+        if(last != first) [[unlikely]]
+        {
+            hit &= access_line(last);
+        }
+
+        return hit;
+    }
+
+    const AxCacheConfig& config() const noexcept
+    {
+        return m_config;
+    }
+
+    const AxCacheStats& stats() const noexcept
+    {
+        return m_stats;
+    }
+
+    // Call func(addr, stats) for each line accessed since the last reset, in ascending address order
+    template<typename Func>
+    void for_each_line(Func&& func) const
+    {
+        for(std::size_t page = 0; page < m_lines.size(); ++page)
+        {
+            if(!m_lines[page])
+            {
+                continue;
+            }
+
+            for(std::size_t i = 0; i < LINE_PAGE_SIZE; ++i)
+            {
+                const auto& stats = (*m_lines[page])[i];
+                if(stats.hits != 0 || stats.misses != 0)
+                {
+                    func(static_cast<uint64_t>((page << LINE_PAGE_SHIFT) | i) << m_line_shift, stats);
+                }
+            }
+        }
+    }
+
+    // Invalidate all lines and clear statistics
+    void reset();
+
+private:
+    static constexpr uint32_t INVALID_TAG = ~0u;
+    static constexpr std::size_t LINE_PAGE_SHIFT = 10;
+    static constexpr std::size_t LINE_PAGE_SIZE = 1ull << LINE_PAGE_SHIFT;
+
+    using LinePage = std::array<AxCacheStats, LINE_PAGE_SIZE>;
+
+    bool access_line(uint32_t line)
+    {
+        const auto set = line & m_set_mask;
+        uint32_t* const tags = &m_tags[set * m_config.ways];
+        const auto way = find(tags, line);
+
+        auto& page = m_lines[line >> LINE_PAGE_SHIFT];
+        if(!page) [[unlikely]]
+        {
+            page = std::make_unique<LinePage>();
+        }
+
+        auto& stats = (*page)[line & (LINE_PAGE_SIZE - 1)];
+        if(way < m_config.ways) [[likely]]
+        {
+            if(m_config.replacement == AxCacheReplacement::LRU)
+            {
+                m_stamps[set * m_config.ways + way] = ++m_clock;
+            }
+
+            ++stats.hits;
+            ++m_stats.hits;
+            return true;
+        }
+
+        const auto victim = select_victim(set);
+        tags[victim] = line;
+        m_stamps[set * m_config.ways + victim] = ++m_clock;
+        ++stats.misses;
+        ++m_stats.misses;
+        return false;
+    }
+
+    // Index of tag in tags, or ways if not found
+    uint32_t find(const uint32_t* tags, uint32_t tag) const noexcept;
+    uint32_t select_victim(uint32_t set) noexcept;
+
+    AxCacheConfig m_config{};
+    uint32_t m_line_shift{};
+    uint32_t m_set_mask{};
+    std::vector<uint32_t> m_tags{};   // ways tags per set, line addresses
+    std::vector<uint64_t> m_stamps{}; // last use (LRU) or fill (FIFO) of each line
+    uint64_t m_clock{};
+    uint32_t m_random{0x9E3779B9u};
+    AxCacheStats m_stats{};
+    std::vector<std::unique_ptr<LinePage>> m_lines{};
+};
+
+// L1 instruction and data caches of a core, see AxCore::set_cache_model
+class AxCacheModel
+{
+public:
+    AxCacheModel(const AxCacheConfig& icache, const AxCacheConfig& dcache);
+    ~AxCacheModel() = default;
+    AxCacheModel(const AxCacheModel&) = delete;
+    AxCacheModel& operator=(const AxCacheModel&) = delete;
+    AxCacheModel(AxCacheModel&&) noexcept = delete;
+    AxCacheModel& operator=(AxCacheModel&&) noexcept = delete;
+
+    // K1 configuration, see AxCore::ICACHE_SIZE and AxCore::DCACHE_SIZE
+    static AxCacheConfig default_icache() noexcept;
+    static AxCacheConfig default_dcache() noexcept;
+
+    bool fetch(uint64_t addr, uint32_t size)
+    {
+        return m_icache.access(addr, size);
+    }
+
+    bool data(uint64_t addr, uint32_t size)
+    {
+        return m_dcache.access(addr, size);
+    }
+
+    const AxCache& icache() const noexcept
+    {
+        return m_icache;
+    }
+
+    const AxCache& dcache() const noexcept
+    {
+        return m_dcache;
+    }
+
+    // Write hits and misses per memory region, and the symbols with the most misses (at most max_symbols)
+    void report(const AxCore& core, std::FILE* output, std::size_t max_symbols = 16) const;
+
+private:
+    AxCache m_icache;
+    AxCache m_dcache;
+};
+
+#endif
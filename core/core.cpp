@@ -4,20 +4,180 @@
 #include "core.hpp"
 
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <cassert>
 #include <vector>
 #include <iostream>
+#include <optional>
+#include <type_traits>
 
 #include "memory.hpp"
+#include "fault.hpp"
 #include "opcode.hpp"
 #include "panic.hpp"
 #include "utilities.hpp"
 
-AxCore::AxCore(AxMemory& memory)
+AxCore::AxCore(AxMemory& memory, uint32_t id)
     : m_memory{&memory}
-    , m_wram_begin{static_cast<const uint32_t*>(m_memory->map(*this, AxMemory::WRAM_BEGIN))}
+    , m_wram{static_cast<uint8_t*>(m_memory->map(*this, AxMemory::WRAM_BEGIN))}
+    , m_wram_begin{reinterpret_cast<const uint32_t*>(m_wram)}
+    , m_wram_mask{m_memory->wram_mask()}
+    , m_decode_cache{m_wram_begin, (m_wram_mask + 1) / 4, m_memory->code_owners(), m_memory->add_code_owner()}
+    , m_code_generation{m_memory->code_generation().load(std::memory_order_acquire)}
+    , m_id{id}
 {
+    static_assert(AxDecodeCache::PAGE_SHIFT + 2 == AxMemory::CODE_SHIFT && AxDecodeCache::SHARED_OWNER == AxMemory::SHARED_CODE_OWNER,
+        "Decode cache pages do not match AxMemory code owners.");
+
+    ax_check(id < MAX_CORES, "Core id must be less than ", MAX_CORES, ".");
+
+#ifdef AX_JIT
+    set_jit_enabled(true);
+#endif
+}
+
+void AxCore::set_jit_enabled(bool enabled)
+{
+    if(enabled && !m_jit && AxJit::supported())
+    {
+        m_jit = std::make_unique<AxJit>(*this);
+#ifdef AX_LLVM_JIT
+        m_llvm_jit = std::make_unique<AxLLVMJit>(*this);
+#endif
+    }
+    else if(!enabled && m_jit)
+    {
+        m_block_cache.clear(); // blocks keep pointers to native code
+        m_jit.reset();
+#ifdef AX_LLVM_JIT
+        m_llvm_jit.reset();
+#endif
+    }
+}
+
+void AxCore::invalidate_code(uint64_t addr, uint64_t size) noexcept
+{
+    if((addr & AxMemory::WRAM_BEGIN) && size != 0)
+    {
+        if(m_decode_cache.invalidate(addr & m_wram_mask, size))
+        {
+            publish_code_write(addr & m_wram_mask, size);
+        }
+
+        m_memory->mark_dirty(AxMemory::WRAM_BEGIN + (addr & m_wram_mask), size);
+    }
+}
+
+void AxCore::publish_code_write(uint64_t offset, uint64_t size) noexcept
+{
+    const auto generation = m_memory->publish_code_write(offset, size);
+    if(generation == m_code_generation + 1) // our own cache is already up to date
+    {
+        m_code_generation = generation;
+    }
+}
+
+void AxCore::store_shared_code(uint64_t addr, const void* value, uint32_t size) noexcept
+{
+    const auto& entry = lookup(addr);
+    const auto offset = addr & entry.mask;
+    std::memcpy(entry.host + offset, value, size);
+    m_memory->mark_dirty(entry.guest + offset, size);
+    publish_code_write(addr & m_wram_mask, size);
+}
+
+void AxCore::set_store_buffering(bool enabled)
+{
+    if(!enabled)
+    {
+        commit_stores();
+    }
+
+    m_buffering = enabled;
+    m_decode_cache.set_store_buffer(enabled ? &m_store_buffer : nullptr);
+
+#ifdef AX_LLVM_JIT
+    if(enabled && m_llvm_jit) // regions load WRAM directly
+    {
+        m_block_cache.clear();
+        m_llvm_jit->clear();
+    }
+#endif
+}
+
+void AxCore::commit_stores() noexcept
+{
+    m_store_buffer.commit([this](uint64_t guest, uint64_t size)
+    {
+        if(guest & AxMemory::WRAM_BEGIN)
+        {
+            invalidate_code(guest, size);
+        }
+        else
+        {
+            m_memory->mark_dirty(guest, size);
+        }
+    });
+}
+
+void AxCore::read_memory(uint64_t addr, void* dest, uint64_t size) noexcept
+{
+    m_store_buffer.read(static_cast<const uint8_t*>(translate(addr)), dest, size);
+}
+
+void AxCore::buffered_load(uint64_t addr, void* dest, uint32_t size) noexcept
+{
+    const auto& entry = lookup(addr);
+    const auto offset = addr & entry.mask;
+    if(entry.flags & AxPage::IO)
+    {
+        const auto value = io_read(entry.guest + offset, size);
+        std::memcpy(dest, &value, size);
+        return;
+    }
+
+    m_store_buffer.read(entry.host + offset, dest, size);
+}
+
+void AxCore::buffered_store(uint64_t addr, const void* value, uint32_t size) noexcept
+{
+    const auto& entry = lookup(addr);
+    const auto offset = addr & entry.mask;
+    if(entry.flags & AxPage::IO)
+    {
+        uint64_t bits{};
+        std::memcpy(&bits, value, size);
+        io_write(entry.guest + offset, size, bits);
+        return;
+    }
+
+    if(entry.flags & AxPage::SPM) // not shared
+    {
+        std::memcpy(entry.host + offset, value, size);
+        m_memory->mark_dirty(entry.guest + offset, size);
+        return;
+    }
+
+    // faults of guarded memory must be raised by the store, not by the commit
+    const volatile uint8_t* const bytes = entry.host + offset;
+    static_cast<void>(bytes[0]);
+    static_cast<void>(bytes[size - 1]);
+
+    if(addr & AxMemory::WRAM_BEGIN) // other cores are told when the store is committed
+    {
+        m_decode_cache.invalidate(addr & m_wram_mask, size);
+    }
+
+    m_store_buffer.store(entry.host + offset, entry.guest + offset, value, size);
+}
+
+void AxCore::sync_shared_code() noexcept
+{
+    m_code_generation = m_memory->for_each_code_write(m_code_generation, [this](uint64_t offset, uint64_t size)
+    {
+        m_decode_cache.invalidate(offset, size);
+    });
 }
 
 void AxCore::add_breakpoint(uint64_t address, bool enabled)
@@ -70,85 +230,432 @@ std::vector<AxCore::Breakpoint>::iterator AxCore::get_breakpoint(uint64_t addres
     return m_breakpoints.end();
 }
 
-void AxCore::do_store(uint64_t src, uint64_t addr, uint32_t size)
+void AxCore::refill_tlb(TlbEntry& entry, uint64_t index) noexcept
+{
+    const auto& page = m_memory->page(index << AxMemory::PAGE_SHIFT);
+    entry.page = index;
+    entry.host = (page.flags & AxPage::SPM) ? m_spm.data() : page.host;
+    entry.mask = page.mask;
+    entry.guest = page.guest;
+    entry.flags = page.flags;
+}
+
+uint32_t AxCore::execute(AxOpcode first, AxOpcode second)
+{
+    return execute(ax_decode_bundle(first, second));
+}
+
+uint32_t AxCore::execute(const AxDecodedBundle& bundle)
 {
-    if(size == 0)
+    const auto old_pc = m_regs.pc;
+
+    execute_op(bundle.ops[0]);
+
+    // execute second instruction
+    if(bundle.op_count == 2) // moveix are not executed
     {
-        const auto tmp = static_cast<uint8_t>(src);
-        m_memory->store(*this, &tmp, addr, 1);
+        execute_op(bundle.ops[1]);
     }
-    else if(size == 1)
+
+    if(old_pc != m_regs.pc)
     {
-        const auto tmp = static_cast<uint16_t>(src);
-        m_memory->store(*this, &tmp, addr, 2);
+        // if we jumped somewhere returns 0 so the next instruction is where we jumped!
+        return 0;
     }
-    else if(size == 2)
+
+    return bundle.size;
+}
+
+void AxCore::simulate_fetch(uint32_t pc, const AxDecodedBundle& bundle)
+{
+    const bool hit = !m_cache_model || m_cache_model->fetch(AxMemory::WRAM_BEGIN + pc * 4ull, bundle.size * 4);
+    if(m_timing_model)
     {
-        const auto tmp = static_cast<uint32_t>(src);
-        m_memory->store(*this, &tmp, addr, 4);
+        m_timing_model->fetch(hit);
     }
-    else if(size == 3)
+}
+
+void AxCore::simulate_retire(uint32_t pc, const AxDecodedBundle& bundle)
+{
+    if(m_timing_model)
     {
-        const auto tmp = static_cast<uint64_t>(src);
-        m_memory->store(*this, &tmp, addr, 8);
+        m_regs.cc += static_cast<uint32_t>(m_timing_model->retire(bundle, pc, m_regs.pc & 0x7FFFFFFF) - 1);
     }
-    else
+}
+
+void AxCore::simulate_load(uint64_t addr, uint32_t size)
+{
+    const bool hit = !m_cache_model || m_cache_model->data(addr, size);
+    if(m_timing_model)
     {
-        ax_panic("Wrong size in store operation ", size);
+        m_timing_model->load(addr, hit);
     }
 }
 
-uint64_t AxCore::do_load(uint64_t addr, uint32_t size)
+void AxCore::simulate_store(uint64_t addr, uint32_t size)
 {
-    if(size == 0)
+    // stores are buffered, they only change the cache content
+    if(m_cache_model)
     {
-        uint8_t dest;
-        m_memory->load(*this, &dest, addr, 1);
-        return static_cast<uint64_t>(dest);
+        m_cache_model->data(addr, size);
     }
-    else if(size == 1)
+}
+
+bool AxCore::sync_blocks()
+{
+    sync_code();
+    if(!m_block_cache.sync(m_decode_cache))
     {
-        uint16_t dest;
-        m_memory->load(*this, &dest, addr, 2);
-        return static_cast<uint64_t>(dest);
+        return false;
     }
-    else if(size == 2)
+
+    if(m_jit)
     {
-        uint32_t dest;
-        m_memory->load(*this, &dest, addr, 4);
-        return static_cast<uint64_t>(dest);
+        m_jit->clear();
     }
-    else if(size == 3)
+
+#ifdef AX_LLVM_JIT
+    if(m_llvm_jit)
     {
-        uint64_t dest;
-        m_memory->load(*this, &dest, addr, 8);
-        return dest;
+        m_llvm_jit->clear();
     }
+#endif
 
-    ax_panic("Wrong size in load operation ", size);
+    return true;
 }
 
-uint32_t AxCore::execute(AxOpcode first, AxOpcode second)
+#ifdef AX_LLVM_JIT
+namespace
 {
-    // get moveix imm24 value if present
-    const auto old_pc = m_regs.pc;
 
-    const uint64_t imm24 = first.is_bundle() && second.is_moveix() ? second.moveix_imm24() : 0ull;
-    execute_unit(first, 0, imm24);
+// Successors of a block known at translation time, fallthrough first
+std::array<std::optional<uint32_t>, 2> static_successors(const AxBlock& block)
+{
+    uint32_t last_pc = block.pc;
+    for(std::size_t i = 0; i + 1 < block.bundles.size(); ++i)
+    {
+        last_pc += block.bundles[i].size;
+    }
 
-    // execute second instruction
-    if(first.is_bundle() && !second.is_moveix()) // don't call execute unit for a nop
+    const auto& last = block.bundles.back();
+    const auto& op = last.ops[0];
+    const auto fallthrough = last_pc + last.size;
+    if(op.issue != 7) // not a branch
     {
-        execute_unit(second, 1, imm24);
+        return {fallthrough, std::nullopt};
     }
 
-    if(old_pc != m_regs.pc)
+    if(op.operation <= AX_EXE_BRU_BGEU) // conditional branches
     {
-        // if we jumped somewhere returns 0 so the next instruction is where we jumped!
-        return 0;
+        return {fallthrough, static_cast<uint32_t>(last_pc + op.imm)};
+    }
+    else if(op.operation == AX_EXE_BRU_BRA)
+    {
+        return {static_cast<uint32_t>(last_pc + op.imm), std::nullopt};
+    }
+    else if(op.operation == AX_EXE_BRU_JUMP)
+    {
+        return {static_cast<uint32_t>(op.imm), std::nullopt};
+    }
+
+    return {};
+}
+
+// Regions can not contain syscalls, they must be handled by our caller
+bool ends_with_cu(const AxBlock& block)
+{
+    const auto& last = block.bundles.back();
+    return last.op_count == 2 && last.ops[1].issue == 13;
+}
+
+}
+#endif
+
+void AxCore::tier_up(AxBlock& block)
+{
+    ++block.executions;
+    if(m_jit && block.executions == AxJit::HOT_THRESHOLD)
+    {
+        block.native = m_jit->compile(block);
+    }
+
+#ifdef AX_LLVM_JIT
+    if(m_llvm_jit && !m_buffering && block.executions == AxLLVMJit::HOT_THRESHOLD && !ends_with_cu(block))
+    {
+        // region: the block and its hot successors
+        std::vector<const AxBlock*> region{&block};
+        for(std::size_t i = 0; i < region.size() && region.size() < AxLLVMJit::MAX_REGION_BLOCKS; ++i)
+        {
+            for(auto next_pc : static_successors(*region[i]))
+            {
+                const auto* next = next_pc ? m_block_cache.find(*next_pc) : nullptr;
+                if(next && next->executions >= AxLLVMJit::HOT_THRESHOLD / 16 && !ends_with_cu(*next)
+                    && std::find(region.begin(), region.end(), next) == region.end()
+                    && region.size() < AxLLVMJit::MAX_REGION_BLOCKS)
+                {
+                    region.emplace_back(next);
+                }
+            }
+        }
+
+        block.region = m_llvm_jit->compile(region);
+    }
+#endif
+}
+
+uint32_t AxCore::jit_execute(AxCore* core, const AxDecodedOpcode* op) noexcept
+{
+    try
+    {
+        core->execute_op(*op);
+    }
+    catch(...)
+    {
+        core->m_jit_exception = std::current_exception();
+        return JIT_FAILED;
+    }
+
+    uint32_t status = core->m_decode_cache.generation() != core->m_jit_generation ? JIT_CODE_MODIFIED : 0;
+    if(core->halted()) [[unlikely]]
+    {
+        status |= JIT_HALTED;
     }
 
-    return first.is_bundle() ? 2 : 1;
+    return status;
+}
+
+uint64_t AxCore::execute_blocks(uint64_t max_cycles)
+{
+    sync_blocks();
+
+    uint64_t cycles = 0;
+    AxBlock* block = &m_block_cache.get(m_regs.pc, m_decode_cache);
+    while(true)
+    {
+        if(block->region)
+        {
+            m_jit_generation = m_decode_cache.generation();
+            cycles += block->region(&m_regs, max_cycles - cycles);
+            if(m_jit_exception) [[unlikely]]
+            {
+                std::rethrow_exception(std::exchange(m_jit_exception, nullptr));
+            }
+        }
+        else if(block->native)
+        {
+            m_jit_generation = m_decode_cache.generation();
+            cycles += block->native();
+            if(m_jit_exception) [[unlikely]]
+            {
+                std::rethrow_exception(std::exchange(m_jit_exception, nullptr));
+            }
+
+            tier_up(*block);
+        }
+        else
+        {
+            const auto generation = m_decode_cache.generation();
+            for(const auto& bundle : block->bundles)
+            {
+                const auto count = execute(bundle);
+
+                m_regs.cc += 1;
+                m_regs.ic += count;
+                m_regs.pc += count;
+                cycles += 1;
+
+                // a jump ends the block, self-modifying code must be translated again,
+                // and a halted core must not run the following bundles before it sleeps (like stepping mode)
+                if(count == 0 || m_decode_cache.generation() != generation || halted()) [[unlikely]]
+                {
+                    break;
+                }
+            }
+
+            tier_up(*block);
+        }
+
+        if(m_syscall != 0 || cycles >= max_cycles || m_attention.load(std::memory_order_relaxed) != 0)
+        {
+            return cycles;
+        }
+
+        if(sync_blocks()) // block is dangling
+        {
+            block = &m_block_cache.get(m_regs.pc, m_decode_cache);
+            continue;
+        }
+
+        auto* next = block->linked(m_regs.pc);
+        if(!next)
+        {
+            next = &m_block_cache.get(m_regs.pc, m_decode_cache);
+            if(block->static_exit)
+            {
+                block->link(next);
+            }
+        }
+
+        if(next == block && block->read_only && spinning()) [[unlikely]]
+        {
+            m_spinning = true;
+            return cycles;
+        }
+
+        block = next;
+    }
+}
+
+void AxCore::take_interrupt() noexcept
+{
+    if(!m_interrupts_enabled || m_in_interrupt)
+    {
+        m_interrupt_latched = true;
+        return;
+    }
+
+    m_regs.ir = m_regs.pc;
+    m_regs.pc = m_interrupt_vector;
+    m_in_interrupt = true;
+}
+
+bool AxCore::spinning() noexcept
+{
+    static_assert(std::has_unique_object_representations_v<RegisterSet>, "RegisterSet is compared with memcmp.");
+
+    if(++m_spin_iterations < SPIN_SAMPLE) [[likely]]
+    {
+        return false;
+    }
+
+    if(m_spin_iterations == SPIN_SAMPLE)
+    {
+        m_spin_registers = m_regs;
+        return false;
+    }
+
+    m_spin_iterations = 0;
+    m_spin_registers.cc = m_regs.cc;
+    m_spin_registers.ic = m_regs.ic;
+    return std::memcmp(&m_spin_registers, &m_regs, sizeof(RegisterSet)) == 0;
+}
+
+AxRunResult AxCore::run(uint64_t max_cycles, std::optional<uint64_t> address)
+{
+    if(!m_memory->guarded())
+    {
+        return run_unguarded(max_cycles, address);
+    }
+
+    AxRunResult result{};
+    const auto start = m_regs.cc;
+    if(!ax_catch_guest_faults([&]()
+    {
+        result = run_unguarded(max_cycles, address);
+    }, m_fault_address))
+    {
+        // the faulting bundle may be partially executed, and blocks partially translated
+        m_error = ERROR_MEMORY_FAULT;
+        m_decode_cache.clear();
+        if(m_tracer)
+        {
+            m_tracer->flush();
+        }
+
+        result = AxRunResult{AxStopReason::ERROR, m_regs.cc - start};
+    }
+
+    return result;
+}
+
+AxRunResult AxCore::run_unguarded(uint64_t max_cycles, std::optional<uint64_t> address)
+{
+    if(m_tracer)
+    {
+        const auto result = run(max_cycles, address, *m_tracer);
+        m_tracer->flush(); // keep trace in order with syscalls output
+        return result;
+    }
+
+    AxNoTrace trace{};
+    return run(max_cycles, address, trace);
+}
+
+template<typename TraceT>
+AxRunResult AxCore::run(uint64_t max_cycles, std::optional<uint64_t> address, TraceT& trace)
+{
+    // blocks can not stop in the middle, go cycle by cycle to check each PC, trace or simulate caches and timings
+    const bool stepping = TraceT::enabled || address.has_value() || !m_breakpoints.empty() || m_simulated;
+
+    uint64_t cycles = 0;
+    while(true)
+    {
+        if(m_error != 0)
+        {
+            return AxRunResult{AxStopReason::ERROR, cycles};
+        }
+
+        const auto attention = m_attention.load(std::memory_order_relaxed);
+        if(attention != 0) [[unlikely]]
+        {
+            if(attention & ATTENTION_STOP)
+            {
+                m_attention.fetch_and(~ATTENTION_STOP);
+                return AxRunResult{AxStopReason::STOPPED, cycles};
+            }
+
+            if(attention & ATTENTION_INTERRUPT)
+            {
+                // an interrupt also wakes a halted core
+                m_attention.fetch_and(~(ATTENTION_INTERRUPT | ATTENTION_HALT), std::memory_order_acquire);
+                take_interrupt();
+            }
+            else
+            {
+                return AxRunResult{AxStopReason::IDLE, cycles};
+            }
+        }
+
+        if(cycles >= max_cycles)
+        {
+            return AxRunResult{AxStopReason::CYCLES, cycles};
+        }
+
+        if(stepping)
+        {
+            if(cycles != 0) // don't stop on the PC we resume from
+            {
+                if(address && (m_regs.pc & 0x7FFFFFFF) * 4ull == *address)
+                {
+                    return AxRunResult{AxStopReason::ADDRESS, cycles};
+                }
+
+                const auto* breakpoint = hit_breakpoint();
+                if(breakpoint && breakpoint->enabled)
+                {
+                    return AxRunResult{AxStopReason::BREAKPOINT, cycles};
+                }
+            }
+
+            const auto cc = m_regs.cc;
+            cycle(trace);
+            cycles += m_regs.cc - cc;
+        }
+        else
+        {
+            cycles += execute_blocks(max_cycles - cycles);
+        }
+
+        if(m_syscall != 0)
+        {
+            return AxRunResult{AxStopReason::SYSCALL, cycles};
+        }
+
+        if(std::exchange(m_spinning, false)) [[unlikely]]
+        {
+            return AxRunResult{AxStopReason::IDLE, cycles};
+        }
+    }
 }
 
 /*
@@ -163,14 +670,9 @@ UNIT ID |    UNIT NAME    |     Issue ID
    6    |  MDU   |   VU   |   6    |   14
    7    |  BRU   |   /    |   7    |   /
 */
-void AxCore::execute_unit(AxOpcode opcode, uint32_t slot, uint64_t imm24)
+void AxCore::execute_unit(const AxDecodedOpcode& op)
 {
-    // reset regs before doing anything
-    m_regs.gpi[REG_ZERO] = 0;
-    m_regs.gpf[REG_ZERO] = 0.0;
-
-    const auto issue = (slot << 3) | opcode.unit();
-    switch(issue)
+    switch(op.issue)
     {
     case 0:
         [[fallthrough]];
@@ -179,39 +681,98 @@ void AxCore::execute_unit(AxOpcode opcode, uint32_t slot, uint64_t imm24)
     case 8:
         [[fallthrough]];
     case 9:
-        execute_alu(opcode, slot, imm24);
+        execute_alu(op, op.operation, op.size, op.has_imm, op.slot);
         break;
     case 2:
         [[fallthrough]];
     case 10:
-        execute_lsu(opcode, slot, imm24);
+        execute_lsu(op, op.operation, op.size, op.slot);
         break;
     case 3:
         [[fallthrough]];
     case 11:
-        execute_fpu(opcode, slot, imm24);
+        execute_fpu(op, op.operation, op.size, op.slot);
         break;
     case 5:
-        execute_efu(opcode, imm24);
+        execute_efu(op, op.operation, op.size);
         break;
     case 6:
-        execute_mdu(opcode, imm24);
+        execute_mdu(op, op.operation, op.size, op.has_imm);
         break;
     case 7:
-        execute_bru(opcode, imm24);
+        execute_bru(op, op.operation);
         break;
     case 13:
-        execute_cu(opcode, imm24);
+        execute_cu(op, op.operation);
         break;
     case 14:
-        execute_vu(opcode, imm24);
+        execute_vu(op);
         break;
     default:
-        ax_panic("Wrong issue ID, opcode is ", std::hex, opcode.value);
+        ax_panic("Wrong issue ID, opcode is ", std::hex, op.opcode.value);
         break;
     }
 }
 
+template<uint32_t Key>
+void AxCore::dispatch_handler(AxCore& core, const AxDecodedOpcode& op)
+{
+    static constexpr uint32_t operation = Key >> 4;
+    static constexpr uint32_t size = (Key >> 2) & 0x03u;
+    static constexpr bool has_imm = (Key & 0x02u) != 0;
+    static constexpr uint32_t slot = Key & 0x01u;
+    static constexpr uint32_t issue = (slot << 3) | (operation >> 4);
+
+    using Operation = std::integral_constant<uint32_t, operation>;
+    using Size = std::integral_constant<uint32_t, size>;
+    using HasImm = std::bool_constant<has_imm>;
+    using Slot = std::integral_constant<uint32_t, slot>;
+
+    if constexpr(ax_handler_key(operation, size, has_imm, slot) != Key)
+    {
+        // never generated by the decoder, don't instantiate anything
+        ax_panic("Invalid handler key ", Key, ", opcode is ", std::hex, op.opcode.value);
+    }
+    else if constexpr(issue == 0 || issue == 1 || issue == 8 || issue == 9)
+    {
+        core.execute_alu(op, Operation{}, Size{}, HasImm{}, Slot{});
+    }
+    else if constexpr(issue == 2 || issue == 10)
+    {
+        core.execute_lsu(op, Operation{}, Size{}, Slot{});
+    }
+    else if constexpr(issue == 3 || issue == 11)
+    {
+        core.execute_fpu(op, Operation{}, Size{}, Slot{});
+    }
+    else if constexpr(issue == 5)
+    {
+        core.execute_efu(op, Operation{}, Size{});
+    }
+    else if constexpr(issue == 6)
+    {
+        core.execute_mdu(op, Operation{}, Size{}, HasImm{});
+    }
+    else if constexpr(issue == 7)
+    {
+        core.execute_bru(op, Operation{});
+    }
+    else if constexpr(issue == 13)
+    {
+        core.execute_cu(op, Operation{});
+    }
+    else if constexpr(issue == 14)
+    {
+        core.execute_vu(op);
+    }
+    else
+    {
+        ax_panic("Wrong issue ID, opcode is ", std::hex, op.opcode.value);
+    }
+}
+
+const std::array<AxCore::Handler, AX_HANDLER_COUNT> AxCore::s_handlers = AxCore::make_handlers(std::make_index_sequence<AX_HANDLER_COUNT>{});
+
 namespace
 {
 
@@ -294,91 +855,78 @@ void do_cmp(uint32_t& fr, T left, T right)
 
 }
 
-void AxCore::execute_alu(AxOpcode op, uint32_t slot, uint64_t imm24)
+template<typename OperationT, typename SizeT, typename ImmT, typename SlotT>
+void AxCore::execute_alu(const AxDecodedOpcode& op, OperationT operation, SizeT size, ImmT has_imm, SlotT slot)
 {
     // Define some "base" operations to compose the real operation
     // write reg A
-    const auto writeback = [this, slot, op](auto value)
+    const auto writeback = [this, slot, &op](auto value)
     {
-        // always write bypass
+        // always write bypass, ACC destination is resolved to the sink
         m_regs.gpi[REG_BA1 + slot] = static_cast<uint64_t>(value);
-        if(op.reg_a() != REG_ACC)
-        {
-            m_regs.gpi[op.reg_a()] = static_cast<uint64_t>(value);
-        }
+        m_regs.gpi[op.dst] = static_cast<uint64_t>(value);
     };
 
     // write reg A by ORing content
-    const auto orback = [this, op, slot](auto value)
+    const auto orback = [this, &op, slot](auto value)
     {
-        if(op.reg_a() == REG_ACC) // orback the bypass directly
+        if(op.reg_a == REG_ACC) // orback the bypass directly
         {
-            m_regs.gpi[REG_BA1 + slot] |= m_regs.gpi[op.reg_a()];
+            m_regs.gpi[REG_BA1 + slot] |= m_regs.gpi[op.reg_a];
         }
         else // orback the destination, and update bypass
         {
-            m_regs.gpi[op.reg_a()] |= static_cast<uint64_t>(value);
-            m_regs.gpi[REG_BA1 + slot] = m_regs.gpi[op.reg_a()];
+            const auto result = m_regs.gpi[op.reg_a] | static_cast<uint64_t>(value);
+            m_regs.gpi[op.dst] = result;
+            m_regs.gpi[REG_BA1 + slot] = result;
         }
     };
 
-    const auto read_reg = [this, slot](uint32_t reg)
+    // read reg B, ACC is resolved to the slot's bypass
+    const auto left = [this, &op]()
     {
-        if(reg == REG_ACC) // get slot's bypass instead
-        {
-            return m_regs.gpi[REG_BA1 + slot];
-        }
-
-        return m_regs.gpi[reg];
+        return m_regs.gpi[op.src_b];
     };
 
-    // read reg B
-    const auto left = [this, op, read_reg]()
-    {
-        return read_reg(op.reg_b());
-    };
-
-    // if imm version, return imm with extended imm24
-    // otherwise dereference reg C and apply shift
-    const auto right = [this, op, imm24, read_reg]()
+    // if imm version, return imm (already extended with imm24)
+    // otherwise dereference reg C
+    const auto right = [this, &op, has_imm]()
     {
-        if(!op.alu_has_imm())
+        if(!has_imm)
         {
-            return read_reg(op.reg_c());
+            return m_regs.gpi[op.src_c];
         }
 
-        const uint64_t tmp = sext_bitsize(op.alu_imm9(), 9);
-        // apply imm24
-        return tmp ^ (imm24 << 8);
+        return op.imm;
     };
 
     // Trunc value to op size (8, 16, 32 or 64 bits)
-    const auto trunc = [op](auto value)
+    const auto trunc = [size](auto value)
     {
-        return value & sizemask[op.size()];
+        return value & sizemask[size];
     };
 
-    const auto sext = [op](auto value)
+    const auto sext = [size](auto value)
     {
-        return sext_bytesize(value, 1ull << op.size());
+        return sext_bytesize(value, 1ull << size);
     };
 
-    switch(op.operation())
+    switch(operation)
     {
     // ALU-A (000)
     case AX_EXE_ALU_MOVEIX: // no-op
         break;
 
     case AX_EXE_ALU_MOVEI:
-        writeback(sext_bitsize(op.alu_move_imm(), 18) ^ (imm24 << 17));
+        writeback(op.imm);
         break;
 
     case AX_EXE_ALU_EXT:
-        writeback((left() >> op.ext_ins_imm1()) & ((1ull << op.ext_ins_imm2()) - 1));
+        writeback((left() >> op.imm) & op.imm2);
         break;
 
     case AX_EXE_ALU_INS:
-        orback((left() << op.ext_ins_imm1()) & ((1ull << op.ext_ins_imm2()) - 1));
+        orback((left() << op.imm) & op.imm2);
         break;
 
     case AX_EXE_ALU_MAX:
@@ -399,7 +947,7 @@ void AxCore::execute_alu(AxOpcode op, uint32_t slot, uint64_t imm24)
         break;
 
     case AX_EXE_ALU_CMP:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             do_cmp(m_regs.fr, static_cast<int8_t>(left()), static_cast<int8_t>(right()));
@@ -500,40 +1048,39 @@ void AxCore::execute_alu(AxOpcode op, uint32_t slot, uint64_t imm24)
     }
 }
 
-void AxCore::execute_mdu(AxOpcode op, uint64_t imm24)
+template<typename OperationT, typename SizeT, typename ImmT>
+void AxCore::execute_mdu(const AxDecodedOpcode& op, OperationT operation, SizeT size, ImmT has_imm)
 {
     // read reg B
-    const auto left = [this, op]()
+    const auto left = [this, &op]()
     {
-        return m_regs.gpi[op.reg_b()];
+        return m_regs.gpi[op.reg_b];
     };
 
-    // if imm version, return imm with extended imm24
+    // if imm version, return imm (already extended with imm24)
     // otherwise dereference reg C and apply shift
-    const auto right = [this, op, imm24]()
+    const auto right = [this, &op, has_imm]()
     {
-        if(!op.alu_has_imm())
+        if(!has_imm)
         {
-            return m_regs.gpi[op.reg_c()] << op.alu_shift();
+            return m_regs.gpi[op.reg_c] << op.shift;
         }
 
-        const uint64_t tmp = sext_bitsize(op.alu_imm9(), 9);
-        // apply imm24
-        return tmp ^ (imm24 << 8);
+        return op.imm;
     };
 
     // Trunc value to op size (8, 16, 32 or 64 bits)
-    const auto trunc = [op](auto value)
+    const auto trunc = [size](auto value)
     {
-        return value & sizemask[op.size()];
+        return value & sizemask[size];
     };
 
-    const auto sext = [op](auto value)
+    const auto sext = [size](auto value)
     {
-        return sext_bytesize(value, 1ull << op.size());
+        return sext_bytesize(value, 1ull << size);
     };
 
-    switch(op.operation())
+    switch(operation)
     {
     case AX_EXE_MDU_DIV:
         m_regs.mdu[0] = trunc(tosi(sext(trunc(left()))) / tosi(trunc(sext(trunc(right())))));
@@ -550,10 +1097,10 @@ void AxCore::execute_mdu(AxOpcode op, uint64_t imm24)
         m_regs.mdu[2] = trunc(trunc(left()) * sext(trunc(right())));
         break;
     case AX_EXE_MDU_GETMD:
-        m_regs.gpi[op.reg_a()] = m_regs.mdu[op.mdu_pq()];
+        m_regs.gpi[op.dst] = m_regs.mdu[op.imm];
         break;
     case AX_EXE_MDU_SETMD:
-        m_regs.mdu[op.mdu_pq()] = m_regs.gpi[op.reg_a()];
+        m_regs.mdu[op.imm] = m_regs.gpi[op.reg_a];
         break;
 
     default:
@@ -561,122 +1108,135 @@ void AxCore::execute_mdu(AxOpcode op, uint64_t imm24)
     }
 }
 
-void AxCore::execute_lsu(AxOpcode op, uint32_t slot, uint64_t imm24)
+template<typename OperationT, typename SizeT, typename SlotT>
+void AxCore::execute_lsu(const AxDecodedOpcode& op, OperationT operation, SizeT size, SlotT slot)
 {
     // write in A
-    const auto writeback = [this, op, slot](auto value)
+    const auto writeback = [this, &op, slot](auto value)
     {
-        m_regs.gpi[op.reg_a()] = static_cast<uint64_t>(value);
+        m_regs.gpi[op.dst] = static_cast<uint64_t>(value);
         m_regs.gpi[REG_BL1 + slot] = static_cast<uint64_t>(value);
     };
 
-    const auto writeback_float = [this, op, slot](auto value)
+    const auto writeback_float = [this, &op, slot](auto value)
     {
-        m_regs.gpf[op.reg_a()] = value;
+        m_regs.gpf[op.dst] = value;
         m_regs.gpf[REG_BL1 + slot] = value;
     };
 
-    const auto read_reg = [this, slot](uint32_t reg)
+    //  get addr, ACC is resolved to the slot's bypass
+    const auto addrreg = [this, &op]()
     {
-        if(reg == REG_ACC) // get slot's bypass instead
-        {
-            return m_regs.gpi[REG_BL1 + slot];
-        }
+        return m_regs.gpi[op.src_b] + (m_regs.gpi[op.src_c] << op.shift);
+    };
 
-        return m_regs.gpi[reg];
+    // imm version, imm is already extended with imm24
+    const auto addrimm = [this, &op]()
+    {
+        return toui(tosi(m_regs.gpi[op.src_b]) + tosi(op.imm));
     };
 
-    //  get addr
-    const auto addrreg = [this, op, read_reg]()
+    const auto fsize_to_isize = [size]() -> uint32_t
     {
-        return read_reg(op.reg_b()) + (read_reg(op.reg_c()) << op.lsu_shift());
+        // 1 -> float -> i32 -> 2
+        // 2 -> double -> i64 -> 3
+        return size + 1;
     };
 
-    // if imm version, return imm with extended imm24
-    // otherwise dereference reg C and apply shift
-    const auto addrimm = [this, op, imm24, read_reg]()
+    const auto sext = [size](auto value)
     {
-        const uint64_t tmp = sext_bitsize(op.lsu_imm10(), 10);
-        const auto off = tmp ^ (imm24 << 9);
-        return toui(tosi(read_reg(op.reg_b())) + tosi(off));
+        return sext_bytesize(value, 1ull << size);
     };
 
-    const auto fsize_to_isize = [op]() -> uint32_t
+    // call func with the unsigned type of (1 << isize) bytes, constant folded by the threaded dispatch
+    const auto with_type = [](uint32_t isize, auto&& func)
     {
-        // 1 -> float -> i32 -> 2
-        // 2 -> double -> i64 -> 3
-        return op.size() + 1;
+        switch(isize)
+        {
+        case 0:
+            return func(uint8_t{});
+        case 1:
+            return func(uint16_t{});
+        case 2:
+            return func(uint32_t{});
+        case 3:
+            return func(uint64_t{});
+        default:
+            ax_panic("Wrong size in memory operation ", isize);
+        }
     };
 
-    // Trunc value to op size (8, 16, 32 or 64 bits)
-    const auto trunc = [op](auto value)
+    const auto load_value = [this, with_type](uint64_t addr, uint32_t isize)
     {
-        return value & sizemask[op.size()];
+        return with_type(isize, [this, addr](auto type)
+        {
+            return static_cast<uint64_t>(load<decltype(type)>(addr));
+        });
     };
 
-    const auto sext = [op](auto value)
+    const auto store_value = [this, with_type](uint64_t value, uint64_t addr, uint32_t isize)
     {
-        return sext_bytesize(value, 1ull << op.size());
+        with_type(isize, [this, value, addr](auto type)
+        {
+            store(addr, static_cast<decltype(type)>(value));
+        });
     };
 
-    switch(op.operation())
+    switch(operation)
     {
     // reg version
     case AX_EXE_LSU_LD:
-        writeback(do_load(addrreg(), op.size()));
+        writeback(load_value(addrreg(), size));
         break;
     case AX_EXE_LSU_LDS:
-        writeback(sext(do_load(addrreg(), op.size())));
+        writeback(sext(load_value(addrreg(), size)));
         break;
     case AX_EXE_LSU_FLD:
-        writeback_float(do_load(addrreg(), fsize_to_isize()));
+        writeback_float(load_value(addrreg(), fsize_to_isize()));
         break;
     case AX_EXE_LSU_ST:
-        do_store(m_regs.gpi[op.reg_a()], addrreg(), op.size());
+        store_value(m_regs.gpi[op.reg_a], addrreg(), size);
         break;
     case AX_EXE_LSU_FST:
-        do_store(m_regs.gpf[op.reg_a()], addrreg(), fsize_to_isize());
+        store_value(m_regs.gpf[op.reg_a], addrreg(), fsize_to_isize());
         break;
     case AX_EXE_LSU_LDI:
-        writeback(do_load(addrimm(), op.size()));
+        writeback(load_value(addrimm(), size));
         break;
     case AX_EXE_LSU_LDIS:
-        writeback(sext(do_load(addrimm(), op.size())));
+        writeback(sext(load_value(addrimm(), size)));
         break;
     case AX_EXE_LSU_FLDI:
-        writeback_float(do_load(addrimm(), fsize_to_isize()));
+        writeback_float(load_value(addrimm(), fsize_to_isize()));
         break;
     case AX_EXE_LSU_STI:
-        do_store(m_regs.gpi[op.reg_a()], addrimm(), op.size());
+        store_value(m_regs.gpi[op.reg_a], addrimm(), size);
         break;
     case AX_EXE_LSU_FSTI:
-        do_store(m_regs.gpf[op.reg_a()], addrimm(), fsize_to_isize());
+        store_value(m_regs.gpf[op.reg_a], addrimm(), fsize_to_isize());
         break;
     default:
         ax_panic("Unknown LSU operation");
     }
 }
 
-void AxCore::execute_bru(AxOpcode op, uint64_t imm24)
+template<typename OperationT>
+void AxCore::execute_bru(const AxDecodedOpcode& op, OperationT operation)
 {
-    const auto relative23 = [op, imm24]() -> int64_t
+    // relative23, relative24 or absolute24 depending on operation, resolved by the decoder
+    const auto relative = [&op]() -> int64_t
     {
-        return tosi(sext_bitsize(op.bru_imm23(), 23) ^ (imm24 << 22));
+        return tosi(op.imm);
     };
 
-    const auto relative24 = [op, imm24]() -> int64_t
+    const auto absolute = [&op]()
     {
-        return tosi(sext_bitsize(op.bru_imm24(), 24) ^ (imm24 << 23));
+        return op.imm;
     };
 
-    const auto absolute24 = [op, imm24]()
+    const auto lr_value = [this, &op]()
     {
-        return op.bru_imm24() | (imm24 << 24);
-    };
-
-    const auto lr_value = [this, op]()
-    {
-        return static_cast<uint64_t>(m_regs.pc + 1 + static_cast<uint32_t>(op.is_bundle())) * 4ull;
+        return static_cast<uint64_t>(m_regs.pc + 1 + static_cast<uint32_t>(op.bundle)) * 4ull;
     };
 
     const auto add_pc = [this](int64_t value)
@@ -709,77 +1269,77 @@ void AxCore::execute_bru(AxOpcode op, uint64_t imm24)
         return (m_regs.fr >> 4) & 1u;
     };
 
-    switch(op.operation())
+    switch(operation)
     {
     case AX_EXE_BRU_BEQ:
         if(z_mask() && !u_mask())
         {
-            add_pc(relative23());
+            add_pc(relative());
         }
         break;
     case AX_EXE_BRU_BNE:
         if(!z_mask() && !u_mask())
         {
-            add_pc(relative23());
+            add_pc(relative());
         }
         break;
     case AX_EXE_BRU_BLT:
         if((n_mask() != o_mask()) && !u_mask())
         {
-            add_pc(relative23());
+            add_pc(relative());
         }
         break;
     case AX_EXE_BRU_BGE:
         if((z_mask() || n_mask() == o_mask()) && !u_mask())
         {
-            add_pc(relative23());
+            add_pc(relative());
         }
         break;
     case AX_EXE_BRU_BLTU:
         if(c_mask() || u_mask())
         {
-            add_pc(relative23());
+            add_pc(relative());
         }
         break;
     case AX_EXE_BRU_BGEU:
         if(z_mask() || !c_mask() || u_mask())
         {
-            add_pc(relative23());
+            add_pc(relative());
         }
         break;
     case AX_EXE_BRU_BEQU:
         if(z_mask() || u_mask())
         {
-            add_pc(relative23());
+            add_pc(relative());
         }
         break;
     case AX_EXE_BRU_BNEU:
         if(!z_mask() || u_mask())
         {
-            add_pc(relative23());
+            add_pc(relative());
         }
         break;
     case AX_EXE_BRU_BRA:
-        add_pc(relative24());
+        add_pc(relative());
         break;
     case AX_EXE_BRU_CALLR:
         m_regs.gpi[31] = lr_value();
-        add_pc(relative24());
+        add_pc(relative());
         break;
     case AX_EXE_BRU_JUMP:
-        m_regs.pc = static_cast<uint32_t>(absolute24());
+        m_regs.pc = static_cast<uint32_t>(absolute());
         break;
     case AX_EXE_BRU_CALL:
         m_regs.gpi[31] = lr_value();
-        m_regs.pc = static_cast<uint32_t>(absolute24());
+        m_regs.pc = static_cast<uint32_t>(absolute());
         break;
     case AX_EXE_BRU_INDIRECTCALLR:
-        m_regs.gpi[op.reg_a()] = lr_value();
-        add_pc(tosi(m_regs.gpi[op.reg_b()]) / 4ll);
+        m_regs.gpi[op.dst] = lr_value();
+        add_pc(tosi(m_regs.gpi[op.src_b]) / 4ll);
         break;
     case AX_EXE_BRU_INDIRECTCALL:
-        m_regs.gpi[op.reg_a()] = lr_value();
-        m_regs.pc = static_cast<uint32_t>(m_regs.gpi[op.reg_b()] / 4ull);
+        m_regs.gpi[op.dst] = lr_value();
+        m_regs.pc = static_cast<uint32_t>(m_regs.gpi[op.src_b] / 4ull);
         break;
     default:
         ax_panic("Unknown BRU operation");
@@ -835,12 +1395,13 @@ static constexpr int64_t as_sint{};
 
 }
 
-void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
+template<typename OperationT, typename SizeT, typename SlotT>
+void AxCore::execute_fpu(const AxDecodedOpcode& op, OperationT operation, SizeT size, SlotT slot)
 {
     // Define some "base" operations to compose the real operation
 
     // write reg A
-    const auto writeback = [this, slot, op](auto value)
+    const auto writeback = [this, slot, &op](auto value)
     {
         // Non finite value decay to NaR (qNaN)
         if(!is_real(value))
@@ -848,41 +1409,27 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             value = std::numeric_limits<decltype(value)>::quiet_NaN();
         }
 
-        // always write bypass
+        // always write bypass, ACC destination is resolved to the sink
         m_regs.gpf[REG_BF1 + slot] = from_floating_point(value);
-        if(op.reg_a() != REG_ACC)
-        {
-            m_regs.gpf[op.reg_a()] = from_floating_point(value);
-        }
+        m_regs.gpf[op.dst] = from_floating_point(value);
     };
 
-    const auto read_reg = [this, slot](uint32_t reg, auto token)
+    // read reg B, ACC is resolved to the slot's bypass
+    const auto left = [this, &op](auto token)
     {
-        if(reg == REG_ACC) // get slot's bypass instead
-        {
-            return to_floating_point<decltype(token)>(m_regs.gpf[REG_BF1 + slot]);
-        }
-
-        return to_floating_point<decltype(token)>(m_regs.gpf[reg]);
+        return to_floating_point<decltype(token)>(m_regs.gpf[op.src_b]);
     };
 
-    // read reg B
-    const auto left = [this, op, read_reg](auto token)
+    // read reg C
+    const auto right = [this, &op](auto token)
     {
-        return read_reg(op.reg_b(), token);
+        return to_floating_point<decltype(token)>(m_regs.gpf[op.src_c]);
     };
 
-    // if imm version, return imm with extended imm24
-    // otherwise dereference reg C and apply shift
-    const auto right = [this, op, read_reg](auto token)
-    {
-        return read_reg(op.reg_c(), token);
-    };
-
-    switch(op.operation())
+    switch(operation)
     {
     case AX_EXE_FPU_FADD:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(left(as_float) + right(as_float));
@@ -892,11 +1439,11 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             static_assert(AX_EXE_FPU_FADD == AX_EXE_FPU_HTOF, "Must be overlapped!");
             writeback(half_to_float(left(as_half)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FSUB:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(left(as_float) - right(as_float));
@@ -906,11 +1453,11 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             static_assert(AX_EXE_FPU_FSUB == AX_EXE_FPU_FTOH, "Must be overlapped!");
             writeback(float_to_half(left(as_float)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FMUL:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(left(as_float) * right(as_float));
@@ -922,11 +1469,11 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             static_assert(AX_EXE_FPU_FMUL == AX_EXE_FPU_ITOF, "Must be overlapped!");
             writeback(static_cast<float>(left(as_sint)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FNMUL:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(-left(as_float) * right(as_float));
@@ -936,11 +1483,11 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             static_assert(AX_EXE_FPU_FNMUL == AX_EXE_FPU_FTOI, "Must be overlapped!");
             writeback(static_cast<int64_t>(left(as_float)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FMIN:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(std::min(left(as_float), right(as_float)));
@@ -950,11 +1497,11 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             static_assert(AX_EXE_FPU_FMIN == AX_EXE_FPU_FTOD, "Must be overlapped!");
             writeback(static_cast<double>(left(as_float)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FMAX:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(std::max(left(as_float), right(as_float)));
@@ -964,11 +1511,11 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             static_assert(AX_EXE_FPU_FMAX == AX_EXE_FPU_DTOF, "Must be overlapped!");
             writeback(static_cast<float>(left(as_double)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FNEG:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(-left(as_float));
@@ -978,11 +1525,11 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             static_assert(AX_EXE_FPU_FNEG == AX_EXE_FPU_ITOD, "Must be overlapped!");
             writeback(static_cast<double>(left(as_sint)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FABS:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(std::abs(left(as_float)));
@@ -992,7 +1539,7 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             static_assert(AX_EXE_FPU_FABS == AX_EXE_FPU_DTOI, "Must be overlapped!");
             writeback(static_cast<int64_t>(left(as_double)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FCMOVE:
@@ -1002,43 +1549,43 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
         }
         break;
     case AX_EXE_FPU_FE:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(static_cast<uint64_t>(left(as_float) == right(as_float)));
         case 1:
             writeback(static_cast<uint64_t>(left(as_double) == right(as_double)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FEN:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(static_cast<uint64_t>(left(as_float) != right(as_float)));
         case 1:
             writeback(static_cast<uint64_t>(left(as_double) != right(as_double)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FSLT:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(static_cast<uint64_t>(left(as_float) < right(as_float)));
         case 1:
             writeback(static_cast<uint64_t>(left(as_double) < right(as_double)));
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_FPU_FMOVE:
         writeback(left(as_sint));
         break;
     case AX_EXE_FPU_FCMP:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             do_fcmp(m_regs.fr, left(as_float), right(as_float));
@@ -1047,7 +1594,7 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
             do_fcmp(m_regs.fr, left(as_double), right(as_double));
             break;
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     default:
@@ -1055,10 +1602,11 @@ void AxCore::execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24)
     }
 }
 
-void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
+template<typename OperationT, typename SizeT>
+void AxCore::execute_efu(const AxDecodedOpcode& op, OperationT operation, SizeT size)
 {
     // write efu q
-    const auto writeback = [this, op](auto value)
+    const auto writeback = [this](auto value)
     {
         m_regs.efu_q = from_floating_point(value);
     };
@@ -1074,22 +1622,21 @@ void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
     };
 
     // read reg B
-    const auto left = [this, op, read_reg](auto token)
+    const auto left = [&op, read_reg](auto token)
     {
-        return read_reg(op.reg_b(), token);
+        return read_reg(op.reg_b, token);
     };
 
-    // if imm version, return imm with extended imm24
-    // otherwise dereference reg C and apply shift
-    const auto right = [this, op, read_reg](auto token)
+    // read reg C
+    const auto right = [&op, read_reg](auto token)
     {
-        return read_reg(op.reg_c(), token);
+        return read_reg(op.reg_c, token);
     };
 
-    switch(op.operation())
+    switch(operation)
     {
     case AX_EXE_EFU_FDIV:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(left(as_float) / right(as_float));
@@ -1098,11 +1645,11 @@ void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
             writeback(left(as_double) / right(as_double));
             break;
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_EFU_FATAN2:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(std::atan2(left(as_float), right(as_float)));
@@ -1111,11 +1658,11 @@ void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
             writeback(std::atan2(left(as_double), right(as_double)));
             break;
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_EFU_FSQRT:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(std::sqrt(left(as_float)));
@@ -1124,11 +1671,11 @@ void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
             writeback(std::sqrt(left(as_double)));
             break;
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_EFU_FSIN:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(std::sin(left(as_float)));
@@ -1137,11 +1684,11 @@ void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
             writeback(std::sin(left(as_double)));
             break;
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_EFU_FATAN:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(std::atan(left(as_float)));
@@ -1150,11 +1697,11 @@ void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
             writeback(std::atan(left(as_double)));
             break;
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_EFU_FEXP:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(std::exp(left(as_float)));
@@ -1163,11 +1710,11 @@ void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
             writeback(std::exp(left(as_double)));
             break;
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_EFU_INVSQRT:
-        switch(op.size())
+        switch(size)
         {
         case 0:
             writeback(1.0f / std::sqrt(left(as_float)));
@@ -1176,28 +1723,25 @@ void AxCore::execute_efu(AxOpcode op, uint64_t imm24)
             writeback(1.0 / std::sqrt(left(as_double)));
             break;
         default:
-            ax_panic("Cannot perform FPU operation with size: ", op.size());
+            ax_panic("Cannot perform FPU operation with size: ", size);
         }
         break;
     case AX_EXE_EFU_SETEF:
-        m_regs.efu_q = m_regs.gpf[op.reg_a()];
+        m_regs.efu_q = m_regs.gpf[op.reg_a];
         break;
     case AX_EXE_EFU_GETEF:
-        m_regs.gpf[op.reg_a()] = m_regs.efu_q;
+        m_regs.gpf[op.dst] = m_regs.efu_q;
         break;
     default:
         ax_panic("Unknown EFU operation");
     }
 }
 
-void AxCore::execute_cu(AxOpcode op, uint64_t imm24)
+template<typename OperationT>
+void AxCore::execute_cu(const AxDecodedOpcode& op [[maybe_unused]], OperationT operation)
 {
-    const auto ir_value = [this, op]()
-    {
-        return static_cast<uint64_t>(m_regs.pc + 1 + static_cast<uint32_t>(op.is_bundle()));
-    };
 
-    switch(op.operation())
+    switch(operation)
     {
     case AX_EXE_CU_GETIR:
         ax_panic("AX_EXE_CU_GETIR not implemented");
@@ -1214,13 +1758,19 @@ void AxCore::execute_cu(AxOpcode op, uint64_t imm24)
         break;
     case AX_EXE_CU_RETI:
         m_regs.pc = m_regs.ir;
+        m_in_interrupt = false;
+        if(m_interrupt_latched)
+        {
+            m_interrupt_latched = false;
+            raise_interrupt();
+        }
         break;
     default:
         ax_panic("Unknown CU operation");
     }
 }
 
-void AxCore::execute_vu(AxOpcode op, uint64_t imm24)
+void AxCore::execute_vu(const AxDecodedOpcode& op [[maybe_unused]])
 {
     ax_panic("VU not supported yet");
 }
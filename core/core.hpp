@@ -5,24 +5,64 @@
 #define AXCORE_HPP_INCLUDED
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <array>
 #include <algorithm>
 #include <functional>
 #include <span>
-
-#ifndef NDEBUG
-    #include <iostream>
-    #include <iomanip>
-#endif
+#include <utility>
+#include <memory>
+#include <exception>
+#include <atomic>
+#include <limits>
+#include <optional>
 
 #include "opcode.hpp"
+#include "memory.hpp"
+#include "decoder.hpp"
+#include "store_buffer.hpp"
+#include "block.hpp"
+#include "jit.hpp"
+#include "trace.hpp"
+#include "cache.hpp"
+#include "timing.hpp"
+
+#ifdef AX_LLVM_JIT
+    #include "llvm_jit.hpp"
+#endif
 #include "panic.hpp"
 
-class AxMemory;
+enum class AxDispatch
+{
+    SWITCH = 0,   // execute_unit switch cascade
+    THREADED = 1, // one specialized handler per (operation, size, imm, slot), resolved at decode time
+};
+
+// Why AxCore::run_for or AxCore::run_until returned
+enum class AxStopReason
+{
+    CYCLES = 0,     // requested number of cycles has been run
+    SYSCALL = 1,    // a syscall must be handled by the caller, see AxCore::syscall
+    BREAKPOINT = 2, // PC is on an enabled breakpoint
+    ADDRESS = 3,    // PC reached run_until address
+    ERROR = 4,      // see AxCore::error
+    STOPPED = 5,    // AxCore::request_stop has been called
+    IDLE = 6,       // the core is halted (see AxCore::halt) or spins in a loop that only reads unchanged memory
+};
+
+struct AxRunResult
+{
+    AxStopReason reason{};
+    uint64_t cycles{}; // number of emulated cycles
+};
 
 class AxCore
 {
+    friend class AxJit;
+    friend class AxLLVMJit;
+    friend class AxSnapshot;
+
 public:
     using Register = uint32_t;
     static constexpr Register REG_ACC = 56;
@@ -33,6 +73,8 @@ public:
     static constexpr Register REG_BL1 = 61;
     static constexpr Register REG_BL2 = 62;
     static constexpr Register REG_ZERO = 63;
+    // Not architectural, receives writes to ZERO so it always reads as 0 (see AxDecodedOpcode::dst)
+    static constexpr Register REG_SINK = 64;
 
     static constexpr uint64_t ICACHE_SIZE = 0x10000 / 1024; //(64 KiB , 4-way)
     static constexpr uint64_t DCACHE_SIZE = 0x8000 / 128;   //(32 KiB , 4-way)
@@ -63,17 +105,18 @@ public:
         uint32_t cc{}; // cycle counter
         uint32_t ic{}; // instruction counter
 
-        // General purpose integer regs
-        std::array<uint64_t, IREG_COUNT> gpi{};
-        // General purpose fp regs, use accessor functions for typed access (float ect)
-        std::array<uint64_t, VREG_COUNT> gpf{};
+        // General purpose integer regs, followed by REG_SINK
+        std::array<uint64_t, IREG_COUNT + 1> gpi{};
+        // General purpose fp regs, followed by REG_SINK. Use accessor functions for typed access (float ect)
+        std::array<uint64_t, VREG_COUNT + 1> gpf{};
         // MDU registers (Q, QR, PL, PH)
         std::array<uint64_t, 4> mdu{};
         // EFU register
         uint64_t efu_q{};
     };
 
-    AxCore(AxMemory& memory);
+    // id: index of the core in the system, cores sharing a memory must have different ids
+    explicit AxCore(AxMemory& memory, uint32_t id = 0);
     ~AxCore() = default;
     AxCore(const AxCore&) = delete;
     AxCore& operator=(const AxCore&) = delete;
@@ -81,89 +124,190 @@ public:
     AxCore& operator=(AxCore&&) noexcept = delete;
 
     // Execute opcode1 and, if possible, opcode2. Returns the number of opcodes run (1 or 2)
-    // Used internally in cycle(), may be used in tests.
+    // May be used in tests, opcodes are decoded on each call.
     uint32_t execute(AxOpcode first, AxOpcode second);
 
+    // Execute an already decoded bundle. Returns the number of opcodes run (1 or 2), or 0 if we jumped.
+    // Used internally in cycle().
+    uint32_t execute(const AxDecodedBundle& bundle);
+
     // Emulate a whole cycle. Read next instructions from current PC and update it.
+    // The bundle is traced if a tracer is attached (see set_tracer).
+    // CC is incremented by one, or by the cycles the bundle took if a timing model is attached (see set_timing_model).
     void cycle()
     {
-        const auto real_pc = m_regs.pc & 0x7FFFFFFF;
-        const auto opcode1 = m_wram_begin[real_pc];
-        const auto opcode2 = m_wram_begin[real_pc + 1u];
-
-#ifndef NDEBUG
-        // TODO: This code has to be moved somewhere else
-        static int noop_counter = 0;
-        if(AxOpcode{opcode1}.operation() == 0)
+        if(m_tracer)
         {
-            if(++noop_counter > 16) // more than 16 noops in row is obviously a broken jump
-            {
-                ax_panic("Suspitious code.");
-            }
+            cycle(*m_tracer);
         }
         else
         {
-            noop_counter = 0;
+            AxNoTrace trace{};
+            cycle(trace);
         }
+    }
 
-        const auto pc_addr = real_pc * 4ull;
-        bool skip = false;
+    // Same as cycle(), but the bundle is recorded by the given tracing policy (see trace.hpp)
+    template<typename TraceT>
+    void cycle(TraceT& trace)
+    {
+        sync_code();
 
-        auto closest = std::lower_bound(std::begin(m_symbols), std::end(m_symbols), pc_addr, [](auto&& left, auto&& right)
+        const auto real_pc = m_regs.pc & 0x7FFFFFFF;
+        const auto& bundle = m_decode_cache.fetch(real_pc);
+
+        if constexpr(TraceT::enabled)
         {
-            return left.address < right;
-        });
+            trace.record(real_pc * 4ull, bundle);
+        }
 
-        if(closest != std::end(m_symbols) && closest != std::begin(m_symbols))
+        if(m_simulated) [[unlikely]]
         {
-            if(closest->address != pc_addr)
-            {
-                closest = std::prev(closest);
-            }
+            simulate_fetch(real_pc, bundle);
+        }
 
-            if(closest->name.find("memset") == std::string::npos)
-            {
-                if(closest->name.find("_ZN19__llvm_libc_20_1_2_") != std::string::npos)
-                {
-                    std::cout << closest->name.substr(25, 64);
-                }
-                else
-                {
-                    std::cout << closest->name.substr(0, 64);
-                }
-
-                std::cout << "+" << (pc_addr - closest->address) << " | ";
-            }
-            else
-            {
-                skip = true;
-            }
+        const auto count = execute(bundle);
+
+        m_regs.cc += 1;
+        m_regs.ic += count;
+        m_regs.pc += count;
+
+        if(m_simulated) [[unlikely]]
+        {
+            simulate_retire(real_pc, bundle);
         }
-        else // print raw PC
+    }
+
+    // Emulate whole translated blocks, following chained successors, until at least max_cycles cycles
+    // have been run or a syscall has to be handled. Returns the number of emulated cycles.
+    // Breakpoints and tracing are ignored, use cycle() for step-by-step execution.
+    uint64_t execute_blocks(uint64_t max_cycles);
+
+    // Emulate up to max_cycles cycles, or until a syscall, a breakpoint, an error or a stop request.
+    // Whole blocks are run when possible so a few more cycles than requested may be emulated.
+    // Execution resumes normally if the core is on a breakpoint when this is called.
+    // If a tracer is attached, execution goes cycle by cycle and the trace is flushed before returning.
+    AxRunResult run_for(uint64_t max_cycles)
+    {
+        return run(max_cycles, std::nullopt);
+    }
+
+    // Same as run_for, but also stops when PC reaches address (in bytes)
+    AxRunResult run_until(uint64_t address, uint64_t max_cycles = std::numeric_limits<uint64_t>::max())
+    {
+        return run(max_cycles, address);
+    }
+
+    // Attach a tracer to record each executed bundle, or nullptr to disable tracing.
+    // The tracer is not owned by the core and must outlive it or be detached.
+    void set_tracer(AxTracer* tracer) noexcept
+    {
+        m_tracer = tracer;
+    }
+
+    AxTracer* tracer() const noexcept
+    {
+        return m_tracer;
+    }
+
+    // Attach a cache model to simulate fetches and LSU accesses, or nullptr to disable it.
+    // Like tracing, execution goes cycle by cycle while a model is attached: execute_blocks and JIT code are not simulated.
+    // The model is not owned by the core and must outlive it or be detached.
+    void set_cache_model(AxCacheModel* model) noexcept
+    {
+        m_cache_model = model;
+        m_simulated = m_cache_model || m_timing_model;
+    }
+
+    AxCacheModel* cache_model() const noexcept
+    {
+        return m_cache_model;
+    }
+
+    // Attach a timing model, or nullptr to disable it. CC then counts the cycles given by the model, stalls included,
+    // and cache misses are accounted for if a cache model is also attached. Like tracing, execution goes cycle by cycle.
+    // The model is not owned by the core and must outlive it or be detached.
+    void set_timing_model(AxTimingModel* model) noexcept
+    {
+        m_timing_model = model;
+        m_simulated = m_cache_model || m_timing_model;
+    }
+
+    AxTimingModel* timing_model() const noexcept
+    {
+        return m_timing_model;
+    }
+
+    // Make run_for or run_until return as soon as possible, may be called from any thread.
+    // The request is consumed by the run that returns AxStopReason::STOPPED.
+    void request_stop() noexcept
+    {
+        m_attention.fetch_or(ATTENTION_STOP, std::memory_order_relaxed);
+        m_attention.notify_all();
+    }
+
+    // Interrupt the core, may be called from any thread (see AxInterruptController).
+    // It is taken between blocks, or between cycles when stepping: IR is set to PC, then PC to the interrupt vector.
+    // Interrupts raised while they are disabled or while the core is in a handler (until RETI) are taken later,
+    // several raised interrupts may be taken once.
+    void raise_interrupt() noexcept
+    {
+        m_attention.fetch_or(ATTENTION_INTERRUPT, std::memory_order_release);
+        m_attention.notify_all();
+    }
+
+    // Halt the core until its next raised interrupt, from the thread running the core (see AxInterruptController).
+    // Runs then return AxStopReason::IDLE, the raised interrupt resumes execution after the halting instruction.
+    // This does nothing if an interrupt has been raised and could not be taken yet.
+    void halt() noexcept
+    {
+        if(!m_interrupt_latched)
         {
-            std::cout << std::hex << std::showbase << std::setw(12) << pc_addr << " | ";
+            m_attention.fetch_or(ATTENTION_HALT, std::memory_order_relaxed);
         }
+    }
 
-        if(!skip)
+    bool halted() const noexcept
+    {
+        return m_attention.load(std::memory_order_relaxed) & ATTENTION_HALT;
+    }
+
+    // Block the calling thread while the core is halted, until an interrupt is raised or a stop is requested.
+    // The thread sleeps on the attention word (a futex on Linux), it is woken by raise_interrupt and request_stop.
+    void wait_for_interrupt() const noexcept
+    {
+        auto attention = m_attention.load(std::memory_order_acquire);
+        while(attention == ATTENTION_HALT)
         {
-            if(AxOpcode{opcode1}.is_bundle())
-            {
-                auto [first, second] = AxOpcode::to_string(opcode1, opcode2);
-                std::cout << first << " ; " << second << std::endl;
-            }
-            else
-            {
-                auto first = AxOpcode::to_string(opcode1, {}).first;
-                std::cout << first << std::endl;
-            }
+            m_attention.wait(attention, std::memory_order_acquire);
+            attention = m_attention.load(std::memory_order_acquire);
         }
-#endif
+    }
 
-        const auto count = execute(opcode1, opcode2);
+    // Handler address, in bytes like PC * 4
+    void set_interrupt_vector(uint64_t address) noexcept
+    {
+        m_interrupt_vector = static_cast<uint32_t>(address / 4);
+    }
 
-        m_regs.cc += 1;
-        m_regs.ic += count;
-        m_regs.pc += count;
+    uint64_t interrupt_vector() const noexcept
+    {
+        return m_interrupt_vector * 4ull;
+    }
+
+    void set_interrupts_enabled(bool enabled) noexcept
+    {
+        m_interrupts_enabled = enabled;
+        if(enabled && m_interrupt_latched)
+        {
+            m_interrupt_latched = false;
+            raise_interrupt();
+        }
+    }
+
+    bool interrupts_enabled() const noexcept
+    {
+        return m_interrupts_enabled;
     }
 
     // Emulate a syscalls if last executed bundle included a syscall instruction.
@@ -194,6 +338,12 @@ public:
         return *m_memory;
     }
 
+    // Drop cached pages, must be called if the memory map changes
+    void flush_tlb() noexcept
+    {
+        m_tlb.fill(TlbEntry{});
+    }
+
     RegisterSet& registers() noexcept
     {
         return m_regs;
@@ -214,11 +364,71 @@ public:
         return m_spm.data();
     }
 
+    uint32_t id() const noexcept
+    {
+        return m_id;
+    }
+
+    // Values of error()
+    static constexpr int ERROR_MEMORY_FAULT = 1;
+
     int error() const noexcept
     {
         return m_error;
     }
 
+    // Guest address of the last ERROR_MEMORY_FAULT, see AxMemory guard pages.
+    // PC is left on the faulting bundle, or on the first bundle of the block for JIT compiled code.
+    uint64_t fault_address() const noexcept
+    {
+        return m_fault_address;
+    }
+
+    // Stop the core with ERROR_MEMORY_FAULT at address, for accesses done on its behalf (syscall buffers, ...)
+    void raise_memory_fault(uint64_t address) noexcept
+    {
+        m_error = ERROR_MEMORY_FAULT;
+        m_fault_address = address;
+    }
+
+    AxDispatch dispatch() const noexcept
+    {
+        return m_dispatch;
+    }
+
+    // May be changed at any time, both engines produce the same results
+    void set_dispatch(AxDispatch dispatch) noexcept
+    {
+        m_dispatch = dispatch;
+    }
+
+    bool jit_enabled() const noexcept
+    {
+        return m_jit != nullptr;
+    }
+
+    // Enable compilation of hot blocks to native code, see AxJit and AxLLVMJit. Only used by execute_blocks.
+    // Does nothing if the host is not supported.
+    void set_jit_enabled(bool enabled);
+
+    // Must be called when WRAM is written by something else than this core (loaders, syscalls, ...)
+    // so previously decoded instructions of this range are fetched again. Also marks the range dirty.
+    // Other cores of the memory drop their decoded instructions of the range before their next block.
+    void invalidate_code(uint64_t addr, uint64_t size) noexcept;
+
+    // Keep stores to shared memory (every page but the scratchpad and devices) in the core until commit_stores,
+    // so other cores only see them at a point chosen by the caller. Loads and fetches of the core see its own stores.
+    // Device accesses are not buffered. LLVM regions are not compiled while buffering, they load WRAM directly.
+    // Disabling it commits pending stores.
+    void set_store_buffering(bool enabled);
+
+    // Write buffered stores to memory, from any thread while the core is not running.
+    // Code other cores decoded from the written bytes is invalidated.
+    void commit_stores() noexcept;
+
+    // Copy size bytes at guest address addr to dest, buffered stores included. The bytes must be backed by one region.
+    void read_memory(uint64_t addr, void* dest, uint64_t size) noexcept;
+
     struct Symbol
     {
         uint64_t address{};
@@ -272,15 +482,205 @@ public:
     }
 
 private:
+    static constexpr std::size_t TLB_SIZE = 64;
+
+    struct TlbEntry
+    {
+        uint64_t page = ~0ull; // index in AxMemory page table
+        uint8_t* host{};
+        uint64_t mask{};
+        uint64_t guest{}; // see AxPage::guest
+        uint8_t flags{};  // see AxPage::flags
+    };
+
     std::vector<Breakpoint>::iterator get_breakpoint(uint64_t address);
 
-    void do_store(uint64_t src, uint64_t addr, uint32_t size);
-    uint64_t do_load(uint64_t addr, uint32_t size);
+    AxRunResult run(uint64_t max_cycles, std::optional<uint64_t> address);
+    AxRunResult run_unguarded(uint64_t max_cycles, std::optional<uint64_t> address);
+    template<typename TraceT>
+    AxRunResult run(uint64_t max_cycles, std::optional<uint64_t> address, TraceT& trace);
+
+    // Page of guest address addr, pages are cached in a direct-mapped TLB
+    const TlbEntry& lookup(uint64_t addr) noexcept
+    {
+        const auto index = (addr >> AxMemory::PAGE_SHIFT) & (AxMemory::PAGE_COUNT - 1);
+        auto& entry = m_tlb[index & (TLB_SIZE - 1)];
+        if(entry.page != index) [[unlikely]]
+        {
+            refill_tlb(entry, index);
+        }
+
+        return entry;
+    }
+
+    // Host address of guest address addr
+    void* translate(uint64_t addr) noexcept
+    {
+        const auto& entry = lookup(addr);
+        return entry.host + (addr & entry.mask);
+    }
+
+    void refill_tlb(TlbEntry& entry, uint64_t index) noexcept;
+
+    // Typed memory accesses, naturally aligned WRAM accesses don't go through the TLB
+    template<typename T>
+    T load(uint64_t addr) noexcept
+    {
+        if(m_simulated) [[unlikely]]
+        {
+            simulate_load(addr, sizeof(T));
+        }
+
+        T output;
+        if(m_buffering) [[unlikely]]
+        {
+            buffered_load(addr, &output, sizeof(T));
+        }
+        else if((addr & (AxMemory::WRAM_BEGIN | (sizeof(T) - 1))) == AxMemory::WRAM_BEGIN) [[likely]]
+        {
+            std::memcpy(&output, m_wram + (addr & m_wram_mask), sizeof(T));
+        }
+        else
+        {
+            const auto& entry = lookup(addr);
+            const auto offset = addr & entry.mask;
+            if(entry.flags & AxPage::IO) [[unlikely]]
+            {
+                const auto value = io_read(entry.guest + offset, sizeof(T));
+                std::memcpy(&output, &value, sizeof(T));
+                return output;
+            }
+
+            std::memcpy(&output, entry.host + offset, sizeof(T));
+        }
+
+        return output;
+    }
+
+    template<typename T>
+    void store(uint64_t addr, T value) noexcept
+    {
+        if(m_simulated) [[unlikely]]
+        {
+            simulate_store(addr, sizeof(T));
+        }
+
+        if(m_buffering) [[unlikely]]
+        {
+            buffered_store(addr, &value, sizeof(T));
+            return;
+        }
+
+        if(addr & AxMemory::WRAM_BEGIN)
+        {
+            // stores may overwrite already decoded code
+            const auto offset = addr & m_wram_mask;
+            if(m_decode_cache.invalidate(offset, sizeof(T))) [[unlikely]]
+            {
+                store_shared_code(addr, &value, sizeof(T));
+                return;
+            }
+
+            if((addr & (sizeof(T) - 1)) == 0) [[likely]]
+            {
+                std::memcpy(m_wram + offset, &value, sizeof(T));
+                m_memory->mark_dirty(AxMemory::WRAM_BEGIN + offset, sizeof(T));
+                return;
+            }
+        }
+
+        const auto& entry = lookup(addr);
+        const auto offset = addr & entry.mask;
+        if(entry.flags & AxPage::IO) [[unlikely]]
+        {
+            uint64_t bits{};
+            std::memcpy(&bits, &value, sizeof(T));
+            io_write(entry.guest + offset, sizeof(T), bits);
+            return;
+        }
+
+        std::memcpy(entry.host + offset, &value, sizeof(T));
+        m_memory->mark_dirty(entry.guest + offset, sizeof(T));
+    }
+
+    // Accesses while store buffering is enabled, see set_store_buffering
+    void buffered_load(uint64_t addr, void* dest, uint32_t size) noexcept;
+    void buffered_store(uint64_t addr, const void* value, uint32_t size) noexcept;
 
-    void io_read(uint64_t offset, void* reg);
-    void io_write(uint64_t offset, void* reg);
+    // Feed the cache and timing models, only called if one of them is attached
+    void simulate_fetch(uint32_t pc, const AxDecodedBundle& bundle);
+    void simulate_retire(uint32_t pc, const AxDecodedBundle& bundle);
+    void simulate_load(uint64_t addr, uint32_t size);
+    void simulate_store(uint64_t addr, uint32_t size);
 
-    void execute_unit(AxOpcode opcode, uint32_t slot, uint64_t imm24);
+    // Take a raised interrupt, or latch it until it can be taken
+    void take_interrupt() noexcept;
+
+    // Called by execute_blocks after each iteration of a read-only block looping on itself.
+    // Every SPIN_SAMPLE iterations, registers are saved before an iteration and compared after it:
+    // if nothing but CC and IC changed, the loop only reads memory that did not change and will repeat until it does.
+    bool spinning() noexcept;
+
+    // Accesses to device pages (see AxMemory::map_device), addr is the first mirror address
+    uint64_t io_read(uint64_t addr, uint32_t size);
+    void io_write(uint64_t addr, uint32_t size, uint64_t value);
+
+    void execute_op(const AxDecodedOpcode& op)
+    {
+        if(m_dispatch == AxDispatch::THREADED)
+        {
+            s_handlers[op.handler](*this, op);
+        }
+        else
+        {
+            execute_unit(op);
+        }
+    }
+
+    void execute_unit(const AxDecodedOpcode& op);
+
+    // Drop translated blocks (and their native code) if code has been modified, by this core or another one.
+    // Returns true if blocks were dropped.
+    bool sync_blocks();
+
+    // Drop decoded code other cores wrote since the last call, see AxMemory::publish_code_write
+    void sync_code() noexcept
+    {
+        if(m_memory->code_generation().load(std::memory_order_acquire) != m_code_generation) [[unlikely]]
+        {
+            sync_shared_code();
+        }
+    }
+
+    void sync_shared_code() noexcept;
+    void publish_code_write(uint64_t offset, uint64_t size) noexcept;
+
+    // Store to WRAM that other cores may have decoded, they are told once the bytes are written
+    void store_shared_code(uint64_t addr, const void* value, uint32_t size) noexcept;
+
+    // Compile a block to native code once it is hot enough
+    void tier_up(AxBlock& block);
+
+    // Called by native code for operations that are not inlined, see AxJit.
+    // Exceptions can not go through native code, they are stored in m_jit_exception and rethrown by execute_blocks.
+    // Native code stops after a bundle whose operations returned a non-zero status.
+    static constexpr uint32_t JIT_CODE_MODIFIED = 0x01;
+    static constexpr uint32_t JIT_FAILED = 0x02;
+    static constexpr uint32_t JIT_HALTED = 0x04; // see halt
+    static uint32_t jit_execute(AxCore* core, const AxDecodedOpcode* op) noexcept;
+
+    using Handler = void (*)(AxCore&, const AxDecodedOpcode&);
+
+    template<uint32_t Key>
+    static void dispatch_handler(AxCore& core, const AxDecodedOpcode& op);
+
+    template<std::size_t... Keys>
+    static constexpr std::array<Handler, sizeof...(Keys)> make_handlers(std::index_sequence<Keys...>) noexcept
+    {
+        return {&dispatch_handler<Keys>...};
+    }
+
+    static const std::array<Handler, AX_HANDLER_COUNT> s_handlers;
 
     /*
     UNIT ID |    UNIT NAME
@@ -293,25 +693,74 @@ private:
        5    |  EFU   |   CU
        6    |  MDU   |   VU
        7    |  BRU   |   /
+
+    Each unit is a template so the same code is used by both engines:
+    - SWITCH: parameters are runtime values read from the decoded opcode
+    - THREADED: parameters are std::integral_constant, dead paths are removed at compile time
     */
-    void execute_alu(AxOpcode op, uint32_t slot, uint64_t imm24);
-    void execute_mdu(AxOpcode op, uint64_t imm24);
-    void execute_lsu(AxOpcode op, uint32_t slot, uint64_t imm24);
-    void execute_bru(AxOpcode op, uint64_t imm24);
-    void execute_fpu(AxOpcode op, uint32_t slot, uint64_t imm24);
-    void execute_efu(AxOpcode op, uint64_t imm24);
-    void execute_cu(AxOpcode op, uint64_t imm24);
-    void execute_vu(AxOpcode op, uint64_t imm24);
+    template<typename OperationT, typename SizeT, typename ImmT, typename SlotT>
+    void execute_alu(const AxDecodedOpcode& op, OperationT operation, SizeT size, ImmT has_imm, SlotT slot);
+    template<typename OperationT, typename SizeT, typename ImmT>
+    void execute_mdu(const AxDecodedOpcode& op, OperationT operation, SizeT size, ImmT has_imm);
+    template<typename OperationT, typename SizeT, typename SlotT>
+    void execute_lsu(const AxDecodedOpcode& op, OperationT operation, SizeT size, SlotT slot);
+    template<typename OperationT>
+    void execute_bru(const AxDecodedOpcode& op, OperationT operation);
+    template<typename OperationT, typename SizeT, typename SlotT>
+    void execute_fpu(const AxDecodedOpcode& op, OperationT operation, SizeT size, SlotT slot);
+    template<typename OperationT, typename SizeT>
+    void execute_efu(const AxDecodedOpcode& op, OperationT operation, SizeT size);
+    template<typename OperationT>
+    void execute_cu(const AxDecodedOpcode& op, OperationT operation);
+    void execute_vu(const AxDecodedOpcode& op);
 
     std::array<uint8_t, SPM_SIZE> m_spm{};
     RegisterSet m_regs{};
     AxMemory* m_memory{};
+    std::array<TlbEntry, TLB_SIZE> m_tlb{};
+    uint8_t* m_wram{};
     const uint32_t* m_wram_begin{};
-
+    uint64_t m_wram_mask{};
+    AxDecodeCache m_decode_cache;
+    AxStoreBuffer m_store_buffer{};
+    bool m_buffering{};
+    AxBlockCache m_block_cache{};
+    std::unique_ptr<AxJit> m_jit{};
+#ifdef AX_LLVM_JIT
+    std::unique_ptr<AxLLVMJit> m_llvm_jit{};
+#endif
+    uint64_t m_jit_generation{};
+    uint64_t m_code_generation{}; // last AxMemory::code_generation seen by the decode cache
+    std::exception_ptr m_jit_exception{};
+
+#ifdef AX_THREADED_DISPATCH
+    AxDispatch m_dispatch = AxDispatch::THREADED;
+#else
+    AxDispatch m_dispatch = AxDispatch::SWITCH;
+#endif
+    uint32_t m_id = 0;
     int m_error = 0;
+    uint64_t m_fault_address = 0;
     uint32_t m_cycle = 0;
     uint32_t m_instruction = 0;
     uint32_t m_syscall = 0;
+    // requests from other threads, checked between blocks
+    static constexpr uint32_t ATTENTION_STOP = 1;
+    static constexpr uint32_t ATTENTION_INTERRUPT = 2;
+    static constexpr uint32_t ATTENTION_HALT = 4; // only set by the thread of the core
+    std::atomic<uint32_t> m_attention{};
+    static constexpr uint32_t SPIN_SAMPLE = 64;
+    uint32_t m_spin_iterations{};
+    bool m_spinning{};
+    RegisterSet m_spin_registers{};
+    uint32_t m_interrupt_vector{};
+    bool m_interrupts_enabled{};
+    bool m_in_interrupt{};
+    bool m_interrupt_latched{}; // raised while it could not be taken
+    AxTracer* m_tracer{};
+    AxCacheModel* m_cache_model{};
+    AxTimingModel* m_timing_model{};
+    bool m_simulated{}; // a cache or timing model is attached
 
     std::vector<Breakpoint> m_breakpoints{};
     std::vector<Symbol> m_symbols{};
@@ -0,0 +1,263 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "decoder.hpp"
+
+#include <algorithm>
+
+#include "core.hpp"
+#include "panic.hpp"
+#include "store_buffer.hpp"
+#include "utilities.hpp"
+
+namespace
+{
+
+bool is_lsu_imm(uint32_t operation) noexcept
+{
+    return (operation & 0x08u) != 0; // LDI, LDIS, FLDI, STI, FSTI
+}
+
+// Apply bypass rules once, so units never check for ACC or ZERO
+void resolve_registers(AxDecodedOpcode& output, uint32_t unit) noexcept
+{
+    const auto bypass = [&output](uint8_t reg, AxCore::Register first)
+    {
+        return static_cast<uint8_t>(reg == AxCore::REG_ACC ? first + output.slot : reg);
+    };
+
+    output.src_b = output.reg_b;
+    output.src_c = output.reg_c;
+    output.dst = static_cast<uint8_t>(output.reg_a == AxCore::REG_ZERO ? AxCore::REG_SINK : output.reg_a);
+
+    switch(unit)
+    {
+    case 0:
+        [[fallthrough]];
+    case 1: // ALU reads BA, never writes ACC
+        output.src_b = bypass(output.reg_b, AxCore::REG_BA1);
+        output.src_c = bypass(output.reg_c, AxCore::REG_BA1);
+        if(output.reg_a == AxCore::REG_ACC)
+        {
+            output.dst = AxCore::REG_SINK;
+        }
+        break;
+    case 2: // LSU reads BL, but still writes ACC
+        output.src_b = bypass(output.reg_b, AxCore::REG_BL1);
+        output.src_c = bypass(output.reg_c, AxCore::REG_BL1);
+        break;
+    case 3: // FPU reads BF, never writes ACC
+        output.src_b = bypass(output.reg_b, AxCore::REG_BF1);
+        output.src_c = bypass(output.reg_c, AxCore::REG_BF1);
+        if(output.reg_a == AxCore::REG_ACC)
+        {
+            output.dst = AxCore::REG_SINK;
+        }
+        break;
+    case 7: // indirect calls write the link register before reading B
+        if(output.reg_a == AxCore::REG_ZERO && output.reg_b == AxCore::REG_ZERO)
+        {
+            output.src_b = AxCore::REG_SINK;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+AxDecodedOpcode decode_opcode(AxOpcode op, uint32_t slot, uint64_t imm24) noexcept
+{
+    AxDecodedOpcode output{};
+    output.opcode = op;
+    output.issue = static_cast<uint8_t>((slot << 3) | op.unit());
+    output.operation = static_cast<uint8_t>(op.operation());
+    output.size = static_cast<uint8_t>(op.size());
+    output.slot = static_cast<uint8_t>(slot);
+    output.reg_a = static_cast<uint8_t>(op.reg_a());
+    output.reg_b = static_cast<uint8_t>(op.reg_b());
+    output.reg_c = static_cast<uint8_t>(op.reg_c());
+    output.has_imm = op.alu_has_imm();
+    output.bundle = op.is_bundle();
+    output.handler = static_cast<uint16_t>(ax_handler_key(output.operation, output.size, output.has_imm, slot));
+    resolve_registers(output, op.unit());
+
+    const auto alu_imm = [op, imm24]()
+    {
+        return sext_bitsize(op.alu_imm9(), 9) ^ (imm24 << 8);
+    };
+
+    switch(op.unit())
+    {
+    case 0:
+        [[fallthrough]];
+    case 1:
+        if(output.operation == AX_EXE_ALU_MOVEI)
+        {
+            output.imm = sext_bitsize(op.alu_move_imm(), 18) ^ (imm24 << 17);
+        }
+        else if(output.operation == AX_EXE_ALU_EXT || output.operation == AX_EXE_ALU_INS)
+        {
+            output.imm = op.ext_ins_imm1();
+            output.imm2 = (1ull << op.ext_ins_imm2()) - 1;
+        }
+        else if(output.has_imm)
+        {
+            output.imm = alu_imm();
+        }
+        break;
+    case 2:
+        output.shift = static_cast<uint8_t>(op.lsu_shift());
+        if(is_lsu_imm(output.operation))
+        {
+            output.imm = sext_bitsize(op.lsu_imm10(), 10) ^ (imm24 << 9);
+        }
+        break;
+    case 6:
+        if(slot == 0) // MDU
+        {
+            if(output.operation == AX_EXE_MDU_GETMD || output.operation == AX_EXE_MDU_SETMD)
+            {
+                output.imm = op.mdu_pq();
+            }
+            else if(output.has_imm)
+            {
+                output.imm = alu_imm();
+            }
+            else
+            {
+                output.shift = static_cast<uint8_t>(op.alu_shift());
+            }
+        }
+        break;
+    case 7:
+        if(output.operation <= AX_EXE_BRU_BGEU) // conditional branches
+        {
+            output.imm = sext_bitsize(op.bru_imm23(), 23) ^ (imm24 << 22);
+        }
+        else if(output.operation == AX_EXE_BRU_BRA || output.operation == AX_EXE_BRU_CALLR)
+        {
+            output.imm = sext_bitsize(op.bru_imm24(), 24) ^ (imm24 << 23);
+        }
+        else if(output.operation == AX_EXE_BRU_JUMP || output.operation == AX_EXE_BRU_CALL)
+        {
+            output.imm = op.bru_imm24() | (imm24 << 24);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return output;
+}
+
+}
+
+AxDecodedBundle ax_decode_bundle(AxOpcode first, AxOpcode second) noexcept
+{
+    // get moveix imm24 value if present
+    const bool bundle = first.is_bundle();
+    const uint64_t imm24 = bundle && second.is_moveix() ? second.moveix_imm24() : 0ull;
+
+    AxDecodedBundle output{};
+    output.ops[0] = decode_opcode(first, 0, imm24);
+    output.ops[1] = decode_opcode(second, 1, imm24);
+    output.op_count = bundle && !second.is_moveix() ? 2 : 1; // don't execute a nop
+    output.size = bundle ? 2 : 1;
+
+    return output;
+}
+
+AxDecodeCache::AxDecodeCache(const uint32_t* code, uint64_t word_count, uint64_t* owners, uint64_t owner)
+    : m_code{code}
+    , m_word_mask{word_count - 1}
+    , m_last_next{word_count & m_word_mask}
+    , m_owners{owners}
+    , m_owner{owner}
+    , m_others{owner == SHARED_OWNER ? ~0ull : ~owner}
+{
+    ax_check(word_count != 0, "Decode cache can not be empty.");
+
+    m_pages.resize((word_count + PAGE_WORDS - 1) >> PAGE_SHIFT);
+}
+
+void AxDecodeCache::clear() noexcept
+{
+    for(auto& page : m_pages)
+    {
+        page.reset();
+    }
+
+    ++m_generation;
+}
+
+const AxDecodedBundle& AxDecodeCache::decode(uint64_t pc)
+{
+    auto& page = m_pages[pc >> PAGE_SHIFT];
+    if(!page)
+    {
+        page = std::make_unique<Page>();
+        std::atomic_ref<uint64_t>{m_owners[pc >> PAGE_SHIFT]}.fetch_or(m_owner, std::memory_order_relaxed);
+    }
+
+    auto& entry = (*page)[pc & (PAGE_WORDS - 1)];
+    entry.bundle = ax_decode_bundle(word(pc), word((pc + 1) & m_word_mask));
+    entry.valid = true;
+
+    return entry.bundle;
+}
+
+uint32_t AxDecodeCache::word(uint64_t index) const noexcept
+{
+    if(m_store_buffer)
+    {
+        uint32_t output{};
+        m_store_buffer->read(reinterpret_cast<const uint8_t*>(m_code + index), &output, sizeof(output));
+        return output;
+    }
+
+    return m_code[index];
+}
+
+bool AxDecodeCache::do_invalidate(uint64_t first, uint64_t last) noexcept
+{
+    uint64_t users = 0; // owners of the pages of the range
+    for(auto page = first >> PAGE_SHIFT; page <= (last >> PAGE_SHIFT); ++page)
+    {
+        users |= owners(page << PAGE_SHIFT);
+    }
+
+    const auto invalidate_word = [this](uint64_t word)
+    {
+        auto& page = m_pages[word >> PAGE_SHIFT];
+        if(!page)
+        {
+            return false;
+        }
+
+        auto& entry = (*page)[word & (PAGE_WORDS - 1)];
+        if(entry.valid)
+        {
+            entry.valid = false;
+            ++m_generation;
+        }
+
+        return true;
+    };
+
+    // the last word is bundled with m_last_next
+    if(first <= m_last_next && m_last_next <= last)
+    {
+        users |= owners(m_word_mask);
+        invalidate_word(m_word_mask);
+    }
+
+    for(auto word = first; word <= last; ++word)
+    {
+        if(!invalidate_word(word)) // skip to next page
+        {
+            word |= PAGE_WORDS - 1;
+        }
+    }
+
+    return (users & m_others) != 0;
+}
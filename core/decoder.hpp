@@ -0,0 +1,182 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXDECODER_HPP_INCLUDED
+#define AXDECODER_HPP_INCLUDED
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "opcode.hpp"
+
+class AxStoreBuffer;
+
+// Index of the specialized handler of an opcode, see AxCore::dispatch_handler
+// Layout: operation (7 bits) | size (2 bits) | imm (1 bit) | slot (1 bit)
+// Fields that do not change the semantic of a unit are zeroed so equivalent opcodes share the same handler.
+constexpr uint32_t ax_handler_key(uint32_t operation, uint32_t size, bool has_imm, uint32_t slot) noexcept
+{
+    const auto issue = (slot << 3) | (operation >> 4);
+    const bool uses_imm = issue == 0 || issue == 1 || issue == 8 || issue == 9 || issue == 6; // ALU, MDU
+    const bool uses_size = uses_imm || issue == 2 || issue == 10 || issue == 3 || issue == 11 || issue == 5; // LSU, FPU, EFU
+
+    return (operation << 4) | ((uses_size ? size : 0u) << 2) | ((uses_imm && has_imm) ? 2u : 0u) | slot;
+}
+
+static constexpr uint32_t AX_HANDLER_COUNT = 1u << 11;
+
+// Opcode with all its fields extracted.
+// Immediates are already sign-extended and combined with the bundle's moveix imm24,
+// so execution never has to look at the raw opcode bits again.
+struct AxDecodedOpcode
+{
+    AxOpcode opcode{}; // raw value, kept for diagnostics and tracing
+    uint8_t issue{};   // (slot << 3) | unit, see AxCore::execute_unit
+    uint8_t operation{};
+    uint8_t size{};
+    uint8_t slot{};
+    uint8_t reg_a{};
+    uint8_t reg_b{};
+    uint8_t reg_c{};
+    // Register indices after the unit's bypass rules (see AxCore::REG_SINK):
+    // ACC is read from the slot's bypass, writes to ZERO (and ACC for ALU/FPU) go to the sink.
+    uint8_t src_b{};
+    uint8_t src_c{};
+    uint8_t dst{};
+    uint8_t shift{};
+    bool has_imm{};
+    bool bundle{};
+    uint16_t handler{}; // see ax_handler_key
+    // Unit specific immediate:
+    // - ALU/MDU: imm9 ^ (imm24 << 8)
+    // - MOVEI: imm18 ^ (imm24 << 17)
+    // - EXT/INS: bit offset (imm2 holds the field mask)
+    // - GETMD/SETMD: MDU register index
+    // - LSU: imm10 ^ (imm24 << 9)
+    // - BRU: relative (in words) or absolute target
+    uint64_t imm{};
+    uint64_t imm2{};
+};
+
+struct AxDecodedBundle
+{
+    std::array<AxDecodedOpcode, 2> ops{};
+    uint32_t op_count{}; // number of units to execute (moveix are not executed)
+    uint32_t size{};     // number of words used by this bundle (1 or 2)
+};
+
+// Decode first and, if bundled, second opcode.
+// Never panics, invalid opcodes are reported when executed.
+AxDecodedBundle ax_decode_bundle(AxOpcode first, AxOpcode second) noexcept;
+
+// Lazily filled cache of decoded bundles, one entry per code word.
+// Storage is allocated per page the first time a word of that page is fetched.
+// Caches of cores sharing the code memory mark the pages they use in a shared array of owners,
+// so a write to a page only has to be published to other cores if one of them decoded it.
+class AxDecodeCache
+{
+public:
+    static constexpr uint64_t PAGE_SHIFT = 10; // 1024 words (4 Kio) per page
+    static constexpr uint64_t PAGE_WORDS = 1ull << PAGE_SHIFT;
+    static constexpr uint64_t SHARED_OWNER = 1ull << 63; // owner bit that may be used by several caches
+
+    // code: pointer to the first word of the fetchable memory
+    // word_count: fetched words are (pc & (word_count - 1)) like offsets of AxMemory::map, so they stay in bounds
+    // even if it is not a power of two
+    // owners: one word per page, shared by all caches of the code memory (see AxMemory::code_owners)
+    // owner: bit of this cache in owners
+    AxDecodeCache(const uint32_t* code, uint64_t word_count, uint64_t* owners, uint64_t owner);
+    ~AxDecodeCache() = default;
+    AxDecodeCache(const AxDecodeCache&) = delete;
+    AxDecodeCache& operator=(const AxDecodeCache&) = delete;
+    AxDecodeCache(AxDecodeCache&&) noexcept = delete;
+    AxDecodeCache& operator=(AxDecodeCache&&) noexcept = delete;
+
+    // Return decoded bundle starting at word "pc"
+    const AxDecodedBundle& fetch(uint64_t pc)
+    {
+        pc &= m_word_mask;
+
+        auto& page = m_pages[pc >> PAGE_SHIFT];
+        if(page) [[likely]]
+        {
+            auto& entry = (*page)[pc & (PAGE_WORDS - 1)];
+            if(entry.valid) [[likely]]
+            {
+                return entry.bundle;
+            }
+        }
+
+        return decode(pc);
+    }
+
+    // Invalidate all entries that may have been decoded from bytes [offset; offset + size)
+    // offset is relative to the beginning of the code memory.
+    // Returns true if other caches may have decoded the range too, they must then be told to invalidate it.
+    bool invalidate(uint64_t offset, uint64_t size) noexcept
+    {
+        const auto first = offset >> 2;
+        const auto begin = first != 0 ? first - 1 : 0; // previous word may be bundled with the first one
+        const auto last = std::min((offset + size - 1) >> 2, m_word_mask);
+        const bool small = last - begin < PAGE_WORDS; // spans at most 2 pages
+        const bool wraps = first <= m_last_next && m_last_next <= last; // see m_last_next
+        if(small && !wraps && (owners(begin) | owners(last)) == 0) [[likely]]
+        {
+            return false;
+        }
+
+        return do_invalidate(begin, last);
+    }
+
+    // Drop all decoded entries
+    void clear() noexcept;
+
+    // Words are read through buffer while it is set, so stores that have not been committed yet are decoded.
+    // See AxCore::set_store_buffering
+    void set_store_buffer(const AxStoreBuffer* buffer) noexcept
+    {
+        m_store_buffer = buffer;
+    }
+
+    // Incremented each time a decoded entry is invalidated.
+    // Users keeping copies of decoded bundles (e.g. AxBlockCache) must drop them when it changes.
+    uint64_t generation() const noexcept
+    {
+        return m_generation;
+    }
+
+private:
+    struct Entry
+    {
+        AxDecodedBundle bundle{};
+        bool valid{};
+    };
+
+    using Page = std::array<Entry, PAGE_WORDS>;
+
+    // Owners of the page of word
+    uint64_t owners(uint64_t word) const noexcept
+    {
+        return std::atomic_ref<uint64_t>{m_owners[word >> PAGE_SHIFT]}.load(std::memory_order_relaxed);
+    }
+
+    const AxDecodedBundle& decode(uint64_t pc);
+    uint32_t word(uint64_t index) const noexcept;
+    bool do_invalidate(uint64_t first, uint64_t last) noexcept;
+
+    const uint32_t* m_code{};
+    uint64_t m_word_mask{};
+    uint64_t m_last_next{}; // word fetched after the last one, 0 if word_count is a power of two
+    uint64_t* m_owners{};
+    uint64_t m_owner{};
+    uint64_t m_others{}; // bits of the other caches
+    uint64_t m_generation{};
+    std::vector<std::unique_ptr<Page>> m_pages{};
+    const AxStoreBuffer* m_store_buffer{};
+};
+
+#endif
@@ -0,0 +1,182 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "device.hpp"
+
+#include "cache.hpp"
+#include "core.hpp"
+#include "interrupt.hpp"
+#include "timing.hpp"
+
+AxTimer::AxTimer(std::size_t core_count)
+    : m_start{std::chrono::steady_clock::now()}
+    , m_core_count{core_count}
+    , m_compare{std::make_unique<uint64_t[]>(core_count)}
+{
+}
+
+uint64_t AxTimer::read(AxCore& core, uint64_t offset, uint32_t size)
+{
+    uint64_t reg{};
+    switch(offset & ~7ull)
+    {
+    case REG_CYCLES:
+        reg = core.registers().cc;
+        break;
+    case REG_NANOSECONDS:
+        reg = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+        break;
+    case REG_COMPARE:
+        reg = core.id() < m_core_count ? m_compare[core.id()] : 0;
+        break;
+    default:
+        break;
+    }
+
+    return register_bytes(reg, offset, size);
+}
+
+void AxTimer::write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value)
+{
+    if((offset & ~7ull) == REG_COMPARE && core.id() < m_core_count)
+    {
+        auto& compare = m_compare[core.id()];
+        compare = merge_bytes(compare, offset, size, value);
+    }
+}
+
+uint64_t AxTimer::cycles_until_interrupt(const AxCore& core) const noexcept
+{
+    const auto compare = core.id() < m_core_count ? m_compare[core.id()] : 0;
+    if(compare == 0)
+    {
+        return ~0ull;
+    }
+
+    // wrapping difference, CC is 32-bit
+    const auto remaining = static_cast<int32_t>(static_cast<uint32_t>(compare) - core.registers().cc);
+    return remaining > 0 ? static_cast<uint64_t>(remaining) : 1;
+}
+
+void AxTimer::update(AxCore& core) noexcept
+{
+    if(core.id() >= m_core_count)
+    {
+        return;
+    }
+
+    auto& compare = m_compare[core.id()];
+    const auto cc = core.registers().cc;
+    if(compare != 0 && static_cast<int32_t>(cc - static_cast<uint32_t>(compare)) >= 0)
+    {
+        compare = 0;
+        if(m_interrupts)
+        {
+            m_interrupts->post(core.id(), AxInterrupt{AxInterruptController::SOURCE_TIMER, cc});
+        }
+    }
+}
+
+AxUart::AxUart(std::FILE* output, std::FILE* input)
+    : m_output{output}
+{
+    set_input(input);
+}
+
+void AxUart::set_input(std::FILE* input)
+{
+    if(input)
+    {
+        set_input([input]()
+        {
+            return std::fgetc(input);
+        });
+    }
+    else
+    {
+        set_input(std::function<int()>{});
+    }
+}
+
+uint64_t AxUart::read(AxCore&, uint64_t offset, uint32_t size)
+{
+    uint64_t reg{};
+    switch(offset & ~7ull)
+    {
+    case REG_DATA:
+    {
+        const auto c = m_input ? m_input() : EOF;
+        if(c == EOF)
+        {
+            m_eof = true;
+        }
+
+        reg = c == EOF ? ~0ull : static_cast<uint64_t>(c);
+        break;
+    }
+    case REG_STATUS:
+        reg = STATUS_TX_READY | ((!m_input || m_eof) ? STATUS_RX_EOF : 0);
+        break;
+    default:
+        break;
+    }
+
+    return register_bytes(reg, offset, size);
+}
+
+void AxUart::write(AxCore&, uint64_t offset, uint32_t, uint64_t value)
+{
+    if(offset == REG_DATA)
+    {
+        std::fputc(static_cast<int>(value & 0xFF), m_output);
+    }
+}
+
+uint64_t AxPerfCounters::read(AxCore& core, uint64_t offset, uint32_t size)
+{
+    const auto* const cache = core.cache_model();
+    const auto* const timing = core.timing_model();
+
+    uint64_t reg{};
+    switch(offset & ~7ull)
+    {
+    case REG_CYCLES:
+        reg = core.registers().cc;
+        break;
+    case REG_INSTRUCTIONS:
+        reg = core.registers().ic;
+        break;
+    case REG_ICACHE_MISSES:
+        reg = cache ? cache->icache().stats().misses : 0;
+        break;
+    case REG_DCACHE_MISSES:
+        reg = cache ? cache->dcache().stats().misses : 0;
+        break;
+    case REG_BUNDLES:
+        reg = timing ? timing->stats().bundles : 0;
+        break;
+    case REG_DEPENDENCY_STALLS:
+        reg = timing ? timing->stats().dependency : 0;
+        break;
+    case REG_MEMORY_STALLS:
+        reg = timing ? timing->stats().memory : 0;
+        break;
+    case REG_STRUCTURAL_STALLS:
+        reg = timing ? timing->stats().structural : 0;
+        break;
+    case REG_FETCH_STALLS:
+        reg = timing ? timing->stats().fetch : 0;
+        break;
+    case REG_BRANCH_STALLS:
+        reg = timing ? timing->stats().branch : 0;
+        break;
+    default:
+        break;
+    }
+
+    return register_bytes(reg, offset, size);
+}
+
+void AxPerfCounters::write(AxCore&, uint64_t, uint32_t, uint64_t)
+{
+}
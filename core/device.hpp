@@ -0,0 +1,154 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXDEVICE_HPP_INCLUDED
+#define AXDEVICE_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+
+class AxCore;
+class AxInterruptController;
+
+// Memory-mapped device, see AxMemory::map_device.
+// Loads and stores of cores to the pages of a device are forwarded to it instead of the IO buffer,
+// offset is relative to the address the device is mapped at and size is 1, 2, 4 or 8 bytes.
+// Cores may run on different threads, so callbacks may be called concurrently.
+class AxDevice
+{
+public:
+    AxDevice() = default;
+    virtual ~AxDevice() = default;
+    AxDevice(const AxDevice&) = delete;
+    AxDevice& operator=(const AxDevice&) = delete;
+    AxDevice(AxDevice&&) noexcept = delete;
+    AxDevice& operator=(AxDevice&&) noexcept = delete;
+
+    // Value of the bytes loaded by core, in the low bytes of the result
+    virtual uint64_t read(AxCore& core, uint64_t offset, uint32_t size) = 0;
+    virtual void write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value) = 0;
+
+protected:
+    // Devices have 64-bit registers, narrower accesses see the bytes of the register at offset
+    static uint64_t register_bytes(uint64_t reg, uint64_t offset, uint32_t size) noexcept
+    {
+        reg >>= (offset & 7) * 8;
+        return size >= 8 ? reg : reg & ((1ull << (size * 8)) - 1);
+    }
+
+    static uint64_t merge_bytes(uint64_t reg, uint64_t offset, uint32_t size, uint64_t value) noexcept
+    {
+        const auto shift = (offset & 7) * 8;
+        const auto mask = (size >= 8 ? ~0ull : (1ull << (size * 8)) - 1) << shift;
+        return (reg & ~mask) | ((value << shift) & mask);
+    }
+};
+
+// Clocks: the cycle counter of the accessing core and the host time.
+// Each core has a COMPARE register, once CC reaches it the timer posts AxInterruptController::SOURCE_TIMER
+// to the core and clears it. The VM checks it between runs of the core, see update.
+class AxTimer final : public AxDevice
+{
+public:
+    static constexpr uint64_t IO_OFFSET = 0x00000;
+
+    static constexpr uint64_t REG_CYCLES = 0x00;      // CC
+    static constexpr uint64_t REG_NANOSECONDS = 0x08; // since the timer was created
+    static constexpr uint64_t REG_COMPARE = 0x10;     // CC of the next interrupt, 0 for none
+
+    // COMPARE of cores with an id of core_count or more reads as 0 and ignores writes
+    explicit AxTimer(std::size_t core_count = 1);
+
+    uint64_t read(AxCore& core, uint64_t offset, uint32_t size) override;
+    void write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value) override;
+
+    // Controller receiving timer interrupts, not owned
+    void set_interrupt_controller(AxInterruptController* controller) noexcept
+    {
+        m_interrupts = controller;
+    }
+
+    // Cycles core can run before its next interrupt, at least 1, or ~0 if there is none
+    uint64_t cycles_until_interrupt(const AxCore& core) const noexcept;
+
+    // Post the interrupt of core if it is due, from the thread running the core
+    void update(AxCore& core) noexcept;
+
+private:
+    std::chrono::steady_clock::time_point m_start{};
+    std::size_t m_core_count{};
+    std::unique_ptr<uint64_t[]> m_compare{};
+    AxInterruptController* m_interrupts{};
+};
+
+// Serial port on host streams. Bytes stored to DATA are written to output,
+// loads of DATA read the next byte of input (blocking), or ~0 once it is exhausted.
+class AxUart final : public AxDevice
+{
+public:
+    static constexpr uint64_t IO_OFFSET = 0x20000;
+
+    static constexpr uint64_t REG_DATA = 0x00;
+    static constexpr uint64_t REG_STATUS = 0x08;
+
+    static constexpr uint64_t STATUS_TX_READY = 0x01; // always set, output never blocks
+    static constexpr uint64_t STATUS_RX_EOF = 0x02;
+
+    // Streams are not owned, input may be nullptr
+    explicit AxUart(std::FILE* output = stdout, std::FILE* input = nullptr);
+
+    uint64_t read(AxCore& core, uint64_t offset, uint32_t size) override;
+    void write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value) override;
+
+    void set_output(std::FILE* output) noexcept
+    {
+        m_output = output;
+    }
+
+    void set_input(std::FILE* input);
+
+    // Bytes of REG_DATA are given by input, like std::fgetc, so a host file can have a single reader (see AxStdio::get).
+    // It may be called concurrently by cores.
+    void set_input(std::function<int()> input) noexcept
+    {
+        m_input = std::move(input);
+        m_eof = false;
+    }
+
+private:
+    std::FILE* m_output{};
+    std::function<int()> m_input{};
+    std::atomic<bool> m_eof{};
+};
+
+// Read-only counters of the accessing core. Counters of models that are not attached to the core
+// (see AxCore::set_cache_model and AxCore::set_timing_model) read as 0.
+class AxPerfCounters final : public AxDevice
+{
+public:
+    static constexpr uint64_t IO_OFFSET = 0x30000;
+
+    static constexpr uint64_t REG_CYCLES = 0x00;       // CC
+    static constexpr uint64_t REG_INSTRUCTIONS = 0x08; // IC
+    static constexpr uint64_t REG_ICACHE_MISSES = 0x10;
+    static constexpr uint64_t REG_DCACHE_MISSES = 0x18;
+    static constexpr uint64_t REG_BUNDLES = 0x20;
+    // stalls, see AxTimingStats
+    static constexpr uint64_t REG_DEPENDENCY_STALLS = 0x28;
+    static constexpr uint64_t REG_MEMORY_STALLS = 0x30;
+    static constexpr uint64_t REG_STRUCTURAL_STALLS = 0x38;
+    static constexpr uint64_t REG_FETCH_STALLS = 0x40;
+    static constexpr uint64_t REG_BRANCH_STALLS = 0x48;
+
+    AxPerfCounters() = default;
+
+    uint64_t read(AxCore& core, uint64_t offset, uint32_t size) override;
+    void write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value) override;
+};
+
+#endif
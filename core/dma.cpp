@@ -0,0 +1,268 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "dma.hpp"
+
+#include <cstring>
+
+#include "core.hpp"
+#include "interrupt.hpp"
+#include "memory.hpp"
+
+namespace
+{
+
+// Host address of guest range [addr, addr + size), or nullptr if it is not inside a single region or if IO is involved
+uint8_t* resolve(AxCore& core, uint64_t addr, uint64_t size, bool write)
+{
+    const auto& memory = core.memory();
+    const auto& page = memory.page(addr);
+    const auto region = AxMemory::region_index(addr);
+    const auto begin = region == 0 ? 0 : 1ull << (26 + region); // see AxMemory::region_index
+    const auto offset = page.guest - begin + (addr & page.mask); // in the region, not in the page
+    if(region == AxMemory::region_index(AxMemory::IO_BEGIN) || (write && !(page.flags & AxPage::WRITE))
+        || offset > memory.region_size(addr) || size > memory.region_size(addr) - offset)
+    {
+        return nullptr;
+    }
+
+    return static_cast<uint8_t*>(core.memory().map(core, addr));
+}
+
+}
+
+AxDma::AxDma(std::size_t core_count, const AxDmaConfig& config)
+    : m_config{config}
+    , m_banks(core_count)
+{
+    ax_check(config.bytes_per_cycle != 0, "DMA bandwidth can not be 0.");
+
+    if(config.async)
+    {
+        m_thread = std::thread{&AxDma::work, this};
+    }
+}
+
+AxDma::~AxDma()
+{
+    if(m_thread.joinable())
+    {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stopping = true;
+        }
+
+        m_condition.notify_all();
+        m_thread.join();
+    }
+}
+
+uint64_t AxDma::read(AxCore& core, uint64_t offset, uint32_t size)
+{
+    const auto index = offset / CHANNEL_STRIDE;
+    if(core.id() >= m_banks.size() || index >= CHANNEL_COUNT)
+    {
+        return 0;
+    }
+
+    auto& channel = m_banks[core.id()].channels[index];
+    uint64_t reg{};
+    switch((offset % CHANNEL_STRIDE) & ~7ull)
+    {
+    case REG_SRC:
+        reg = channel.src;
+        break;
+    case REG_DST:
+        reg = channel.dst;
+        break;
+    case REG_SIZE:
+        reg = channel.size;
+        break;
+    case REG_STATUS:
+        update(core, channel);
+        reg = channel.status;
+        break;
+    default: // CONTROL is self clearing
+        break;
+    }
+
+    return register_bytes(reg, offset, size);
+}
+
+void AxDma::write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value)
+{
+    const auto index = offset / CHANNEL_STRIDE;
+    if(core.id() >= m_banks.size() || index >= CHANNEL_COUNT)
+    {
+        return;
+    }
+
+    auto& bank = m_banks[core.id()];
+    auto& channel = bank.channels[index];
+    switch((offset % CHANNEL_STRIDE) & ~7ull)
+    {
+    case REG_SRC:
+        channel.src = merge_bytes(channel.src, offset, size, value);
+        break;
+    case REG_DST:
+        channel.dst = merge_bytes(channel.dst, offset, size, value);
+        break;
+    case REG_SIZE:
+        channel.size = merge_bytes(channel.size, offset, size, value);
+        break;
+    case REG_CONTROL:
+    {
+        const auto control = merge_bytes(0, offset, size, value);
+        if(control & CONTROL_START)
+        {
+            start(core, bank, index, control & CONTROL_INTERRUPT);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+AxDmaStats AxDma::stats() const noexcept
+{
+    AxDmaStats output{};
+    for(const auto& bank : m_banks)
+    {
+        output.transfers += bank.stats.transfers;
+        output.bytes += bank.stats.bytes;
+        output.errors += bank.stats.errors;
+    }
+
+    return output;
+}
+
+void AxDma::start(AxCore& core, Bank& bank, uint64_t index, bool interrupt)
+{
+    auto& channel = bank.channels[index];
+    const auto cc = core.registers().cc;
+
+    // transfers of a channel are serialized
+    auto begin_cycle = cc;
+    if(channel.status == STATUS_BUSY)
+    {
+        wait();
+        update(core, channel);
+        if(channel.status == STATUS_BUSY)
+        {
+            begin_cycle = channel.done_cycle;
+        }
+    }
+
+    const auto src = channel.src & 0xFFFFFFFFull;
+    const auto dst = channel.dst & 0xFFFFFFFFull;
+    const auto size = channel.size;
+    const auto* const host_src = resolve(core, src, size, false);
+    auto* const host_dst = resolve(core, dst, size, true);
+    if(!host_src || !host_dst)
+    {
+        channel.status = STATUS_ERROR;
+        ++bank.stats.errors;
+        return;
+    }
+
+    channel.status = STATUS_BUSY;
+    channel.copy_dst = dst;
+    channel.copy_size = size;
+    channel.done_cycle = begin_cycle;
+    if(core.timing_model())
+    {
+        channel.done_cycle += static_cast<uint32_t>(m_config.setup_cycles + (size + m_config.bytes_per_cycle - 1) / m_config.bytes_per_cycle);
+    }
+
+    ++bank.stats.transfers;
+    bank.stats.bytes += size;
+
+    // pages are marked now, code is invalidated once the copy is done
+    const auto& page = core.memory().page(dst);
+    core.memory().mark_dirty(page.guest + (dst & page.mask), size);
+
+    if(m_config.async)
+    {
+        channel.copied.store(false, std::memory_order_relaxed);
+        {
+            std::lock_guard lock{m_mutex};
+            m_jobs.push_back(Job{&channel, core.id(), static_cast<uint32_t>(index), interrupt, host_dst, host_src, size});
+            ++m_pending;
+        }
+
+        m_condition.notify_all();
+    }
+    else
+    {
+        std::memmove(host_dst, host_src, size);
+        channel.copied.store(true, std::memory_order_relaxed);
+        core.invalidate_code(dst, size);
+        if(interrupt && m_interrupts)
+        {
+            m_interrupts->post(core.id(), AxInterrupt{AxInterruptController::SOURCE_DMA, index});
+        }
+    }
+}
+
+void AxDma::update(AxCore& core, Channel& channel)
+{
+    if(channel.status != STATUS_BUSY || !channel.copied.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    // wrapping difference, CC is 32-bit
+    if(static_cast<int32_t>(core.registers().cc - channel.done_cycle) < 0)
+    {
+        return;
+    }
+
+    channel.status = STATUS_DONE;
+    if(m_config.async)
+    {
+        core.invalidate_code(channel.copy_dst, channel.copy_size);
+    }
+}
+
+void AxDma::wait()
+{
+    std::unique_lock lock{m_mutex};
+    m_condition.wait(lock, [this]()
+    {
+        return m_pending == 0;
+    });
+}
+
+void AxDma::work()
+{
+    std::unique_lock lock{m_mutex};
+    while(true)
+    {
+        m_condition.wait(lock, [this]()
+        {
+            return m_stopping || !m_jobs.empty();
+        });
+
+        if(m_jobs.empty()) // stopping
+        {
+            return;
+        }
+
+        const auto job = m_jobs.front();
+        m_jobs.pop_front();
+
+        lock.unlock();
+        std::memmove(job.dst, job.src, job.size);
+        job.channel->copied.store(true, std::memory_order_release);
+        if(job.interrupt && m_interrupts)
+        {
+            m_interrupts->post(job.core, AxInterrupt{AxInterruptController::SOURCE_DMA, job.index});
+        }
+
+        lock.lock();
+
+        --m_pending;
+        m_condition.notify_all();
+    }
+}
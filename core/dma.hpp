@@ -0,0 +1,137 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXDMA_HPP_INCLUDED
+#define AXDMA_HPP_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "device.hpp"
+
+class AxInterruptController;
+
+struct AxDmaConfig
+{
+    // transfer time, only modeled if the core has a timing model (see AxCore::set_timing_model)
+    uint32_t setup_cycles = 32;
+    uint32_t bytes_per_cycle = 16;
+    // copy on a helper thread instead of the core's thread
+    bool async = false;
+};
+
+struct AxDmaStats
+{
+    uint64_t transfers{};
+    uint64_t bytes{};
+    uint64_t errors{};
+};
+
+// DMA engine, a device mapped in the IO region (see AxMemory::map_device).
+// Bulk copies between any regions but IO are done with a host memcpy, so guest code can move tiles
+// to and from scratchpads without running LSU loops.
+//
+// Each core sees its own CHANNEL_COUNT channels at IO_OFFSET, each channel has 64-bit registers:
+// SRC, DST and SIZE describe the transfer, writing CONTROL_START to CONTROL starts it, STATUS is polled for completion.
+// Transfers of a channel are serialized. They must not cross the end of a region. Code copied to WRAM is fetched again once STATUS has been read as DONE.
+class AxDma final : public AxDevice
+{
+public:
+    static constexpr uint64_t IO_OFFSET = 0x10000;
+    static constexpr uint64_t CHANNEL_COUNT = 4;
+    static constexpr uint64_t CHANNEL_STRIDE = 0x40;
+
+    static constexpr uint64_t REG_SRC = 0x00;
+    static constexpr uint64_t REG_DST = 0x08;
+    static constexpr uint64_t REG_SIZE = 0x10;
+    static constexpr uint64_t REG_CONTROL = 0x18;
+    static constexpr uint64_t REG_STATUS = 0x20;
+
+    static constexpr uint64_t CONTROL_START = 1;
+    static constexpr uint64_t CONTROL_INTERRUPT = 2; // post AxInterruptController::SOURCE_DMA to the core once the copy is done
+
+    static constexpr uint64_t STATUS_IDLE = 0;
+    static constexpr uint64_t STATUS_BUSY = 1;
+    static constexpr uint64_t STATUS_DONE = 2;
+    static constexpr uint64_t STATUS_ERROR = 3; // invalid range
+
+    // Channels of cores with an id of core_count or more read as 0 and ignore writes
+    explicit AxDma(std::size_t core_count, const AxDmaConfig& config = AxDmaConfig{});
+    ~AxDma() override;
+
+    uint64_t read(AxCore& core, uint64_t offset, uint32_t size) override;
+    void write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value) override;
+
+    // Controller receiving completion interrupts, not owned
+    void set_interrupt_controller(AxInterruptController* controller) noexcept
+    {
+        m_interrupts = controller;
+    }
+
+    // Block until all copies are done, their STATUS is updated on the next read
+    void wait();
+
+    const AxDmaConfig& config() const noexcept
+    {
+        return m_config;
+    }
+
+    // Sum of all cores, must not be called while cores are running
+    AxDmaStats stats() const noexcept;
+
+private:
+    struct Channel
+    {
+        uint64_t src{};
+        uint64_t dst{};
+        uint64_t size{};
+        uint64_t status{STATUS_IDLE};
+        // transfer in flight, registers may be written again before it completes
+        uint64_t copy_dst{};
+        uint64_t copy_size{};
+        uint32_t done_cycle{}; // CC at which the transfer completes
+        std::atomic<bool> copied{};
+    };
+
+    struct Job
+    {
+        Channel* channel{};
+        uint32_t core{};
+        uint32_t index{}; // channel
+        bool interrupt{};
+        uint8_t* dst{};
+        const uint8_t* src{};
+        uint64_t size{};
+    };
+
+    // Channels of a core, only accessed by the thread running it
+    struct Bank
+    {
+        std::array<Channel, CHANNEL_COUNT> channels{};
+        AxDmaStats stats{};
+    };
+
+    void start(AxCore& core, Bank& bank, uint64_t index, bool interrupt);
+    void update(AxCore& core, Channel& channel);
+    void work();
+
+    AxDmaConfig m_config{};
+    std::vector<Bank> m_banks{};
+    AxInterruptController* m_interrupts{};
+
+    // async mode
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    std::deque<Job> m_jobs{};
+    uint64_t m_pending{};
+    bool m_stopping{};
+    std::thread m_thread{};
+};
+
+#endif
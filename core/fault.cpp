@@ -0,0 +1,185 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "fault.hpp"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#ifndef _WIN32
+    #include <csetjmp>
+    #include <csignal>
+#endif
+
+namespace
+{
+
+// Read by the signal handler, so blocks of atomics linked with release stores instead of a container.
+// Blocks are added when all ranges are used and never freed, the handler may read them at any time.
+struct GuardedRange
+{
+    std::atomic<uintptr_t> begin{};
+    std::atomic<uintptr_t> end{};
+    std::atomic<uint64_t> guest{};
+};
+
+struct GuardedBlock
+{
+    static constexpr std::size_t RANGE_COUNT = 64;
+
+    std::array<GuardedRange, RANGE_COUNT> ranges{};
+    std::atomic<GuardedBlock*> next{};
+};
+
+GuardedBlock s_ranges{};
+std::mutex s_ranges_mutex;
+
+template<typename Func>
+void for_each_range(Func&& func) noexcept
+{
+    for(auto* block = &s_ranges; block; block = block->next.load(std::memory_order_acquire))
+    {
+        for(auto& range : block->ranges)
+        {
+            if(func(range))
+            {
+                return;
+            }
+        }
+    }
+}
+
+#ifndef _WIN32
+struct sigaction s_previous_segv{};
+struct sigaction s_previous_bus{};
+
+thread_local sigjmp_buf* t_jump{};
+thread_local uint64_t t_address{};
+
+void handle_fault(int signal, siginfo_t* info, void* context)
+{
+    if(t_jump)
+    {
+        const auto host = reinterpret_cast<uintptr_t>(info->si_addr);
+        for_each_range([host](GuardedRange& range)
+        {
+            const auto begin = range.begin.load(std::memory_order_acquire);
+            if(begin != 0 && host >= begin && host < range.end.load(std::memory_order_relaxed))
+            {
+                t_address = range.guest.load(std::memory_order_relaxed) + (host - begin);
+                siglongjmp(*t_jump, 1);
+            }
+
+            return false;
+        });
+    }
+
+    // not ours, chain to the previous handler and stay installed in case it recovers (sanitizers, other runtimes)
+    const auto& previous = signal == SIGSEGV ? s_previous_segv : s_previous_bus;
+    if(previous.sa_flags & SA_SIGINFO)
+    {
+        previous.sa_sigaction(signal, info, context);
+    }
+    else if(previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+    {
+        previous.sa_handler(signal);
+    }
+    else // a fault can not be ignored, terminate like the default action
+    {
+        struct sigaction action{};
+        action.sa_handler = SIG_DFL;
+        sigemptyset(&action.sa_mask);
+        sigaction(signal, &action, nullptr);
+        raise(signal);
+    }
+}
+
+void install_handler()
+{
+    static std::once_flag once;
+    std::call_once(once, []()
+    {
+        struct sigaction action{};
+        action.sa_sigaction = handle_fault;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER; // no signal mask to restore after siglongjmp
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &s_previous_segv);
+        sigaction(SIGBUS, &action, &s_previous_bus);
+    });
+}
+#endif
+
+}
+
+void ax_add_guarded_range(const void* host, std::size_t size, uint64_t guest)
+{
+    std::lock_guard lock{s_ranges_mutex};
+    for(auto* block = &s_ranges;; block = block->next.load(std::memory_order_relaxed))
+    {
+        for(auto& range : block->ranges)
+        {
+            if(range.begin.load(std::memory_order_relaxed) == 0)
+            {
+                range.guest.store(guest, std::memory_order_relaxed);
+                range.end.store(reinterpret_cast<uintptr_t>(host) + size, std::memory_order_relaxed);
+                range.begin.store(reinterpret_cast<uintptr_t>(host), std::memory_order_release);
+                return;
+            }
+        }
+
+        if(!block->next.load(std::memory_order_relaxed))
+        {
+            block->next.store(new GuardedBlock{}, std::memory_order_release);
+        }
+    }
+}
+
+void ax_remove_guarded_range(const void* host) noexcept
+{
+    std::lock_guard lock{s_ranges_mutex};
+    for_each_range([host](GuardedRange& range)
+    {
+        if(range.begin.load(std::memory_order_relaxed) == reinterpret_cast<uintptr_t>(host))
+        {
+            range.begin.store(0, std::memory_order_release);
+            return true;
+        }
+
+        return false;
+    });
+}
+
+bool ax_catch_guest_faults(void (*func)(void*), void* data, uint64_t& address)
+{
+#ifdef _WIN32
+    static_cast<void>(address);
+    func(data);
+    return true;
+#else
+    install_handler();
+
+    sigjmp_buf jump;
+    sigjmp_buf* const previous = t_jump;
+    if(sigsetjmp(jump, 0) != 0)
+    {
+        t_jump = previous;
+        address = t_address;
+        return false;
+    }
+
+    t_jump = &jump;
+    try
+    {
+        func(data);
+    }
+    catch(...)
+    {
+        t_jump = previous;
+        throw;
+    }
+
+    t_jump = previous;
+    return true;
+#endif
+}
@@ -0,0 +1,32 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXFAULT_HPP_INCLUDED
+#define AXFAULT_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+// Host faults (SIGSEGV, SIGBUS) on guard pages turned into guest faults, POSIX hosts only.
+// Guarded memory registers the host ranges backing guest memory, including their inaccessible part.
+// A fault inside one of them while ax_catch_guest_faults is running jumps back to it,
+// any other fault is handled as if no handler was installed.
+
+// Host range [host, host + size) backs guest addresses [guest, guest + size)
+void ax_add_guarded_range(const void* host, std::size_t size, uint64_t guest);
+void ax_remove_guarded_range(const void* host) noexcept;
+
+// Call func(data) and return true, or false if a guest fault interrupted it, then address is the faulting guest address.
+// On fault the stack is unwound with siglongjmp: destructors of func's frames are not run.
+bool ax_catch_guest_faults(void (*func)(void*), void* data, uint64_t& address);
+
+template<typename Func>
+bool ax_catch_guest_faults(Func&& func, uint64_t& address)
+{
+    return ax_catch_guest_faults([](void* data)
+    {
+        (*static_cast<Func*>(data))();
+    }, &func, address);
+}
+
+#endif
@@ -0,0 +1,103 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "interrupt.hpp"
+
+#include "core.hpp"
+
+AxInterruptController::AxInterruptController(std::span<AxCore* const> cores)
+    : m_cores{cores.begin(), cores.end()}
+    , m_mailboxes{std::make_unique<Mailbox[]>(cores.size())}
+{
+}
+
+uint64_t AxInterruptController::read(AxCore& core, uint64_t offset, uint32_t size)
+{
+    if(core.id() >= m_cores.size())
+    {
+        return 0;
+    }
+
+    auto& mailbox = m_mailboxes[core.id()];
+    uint64_t reg{};
+    switch(offset & ~7ull)
+    {
+    case REG_VECTOR:
+        reg = core.interrupt_vector();
+        break;
+    case REG_CONTROL:
+        reg = core.interrupts_enabled() ? CONTROL_ENABLE : 0;
+        break;
+    case REG_PENDING:
+        reg = mailbox.queue.size();
+        break;
+    case REG_SOURCE:
+    {
+        AxInterrupt interrupt{};
+        reg = mailbox.queue.pop(interrupt) ? interrupt.source : SOURCE_NONE;
+        mailbox.value = interrupt.value;
+        break;
+    }
+    case REG_VALUE:
+        reg = mailbox.value;
+        break;
+    case REG_TARGET:
+        reg = mailbox.target;
+        break;
+    case REG_DROPPED:
+        reg = mailbox.dropped.load(std::memory_order_relaxed);
+        break;
+    default:
+        break;
+    }
+
+    return register_bytes(reg, offset, size);
+}
+
+void AxInterruptController::write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value)
+{
+    if(core.id() >= m_cores.size())
+    {
+        return;
+    }
+
+    auto& mailbox = m_mailboxes[core.id()];
+    switch(offset & ~7ull)
+    {
+    case REG_VECTOR:
+        core.set_interrupt_vector(merge_bytes(core.interrupt_vector(), offset, size, value));
+        break;
+    case REG_CONTROL:
+        core.set_interrupts_enabled(merge_bytes(0, offset, size, value) & CONTROL_ENABLE);
+        break;
+    case REG_TARGET:
+        mailbox.target = merge_bytes(mailbox.target, offset, size, value);
+        break;
+    case REG_SEND:
+        post(static_cast<uint32_t>(mailbox.target), AxInterrupt{core.id(), value});
+        break;
+    case REG_WAIT:
+        core.halt();
+        break;
+    default:
+        break;
+    }
+}
+
+bool AxInterruptController::post(uint32_t target, const AxInterrupt& interrupt) noexcept
+{
+    if(target >= m_cores.size())
+    {
+        return false;
+    }
+
+    auto& mailbox = m_mailboxes[target];
+    if(!mailbox.queue.push(interrupt))
+    {
+        mailbox.dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    m_cores[target]->raise_interrupt();
+    return true;
+}
@@ -0,0 +1,78 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXINTERRUPT_HPP_INCLUDED
+#define AXINTERRUPT_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "device.hpp"
+#include "queue.hpp"
+
+struct AxInterrupt
+{
+    uint64_t source{}; // core id, or one of the AxInterruptController::SOURCE_* values
+    uint64_t value{};
+};
+
+// Interrupt controller, a device mapped in the IO region (see AxMemory::map_device).
+// Each core has a mailbox, cores send messages to each other and devices post theirs (DMA completion, timer).
+// Posting a message raises an interrupt on the target core (see AxCore::raise_interrupt), the handler pops messages
+// until the mailbox is empty, then returns with RETI. Mailboxes are lock-free and may be posted to from any thread.
+//
+// Registers are banked, each core sees its own:
+// VECTOR is the address of the handler and CONTROL enables interrupts of the core,
+// reading SOURCE pops the next message (~0 if the mailbox is empty), then VALUE reads its value.
+// Storing a value to SEND posts it to the mailbox of core TARGET.
+// Storing to WAIT halts the core until its next interrupt (see AxCore::halt), instead of polling PENDING.
+class AxInterruptController final : public AxDevice
+{
+public:
+    static constexpr uint64_t IO_OFFSET = 0x40000;
+    static constexpr std::size_t MAILBOX_SIZE = 256;
+
+    static constexpr uint64_t REG_VECTOR = 0x00;
+    static constexpr uint64_t REG_CONTROL = 0x08;
+    static constexpr uint64_t REG_PENDING = 0x10; // messages in the mailbox
+    static constexpr uint64_t REG_SOURCE = 0x18;
+    static constexpr uint64_t REG_VALUE = 0x20;
+    static constexpr uint64_t REG_TARGET = 0x28;
+    static constexpr uint64_t REG_SEND = 0x30;
+    static constexpr uint64_t REG_DROPPED = 0x38; // messages lost because the mailbox was full
+    static constexpr uint64_t REG_WAIT = 0x40;
+
+    static constexpr uint64_t CONTROL_ENABLE = 1;
+
+    static constexpr uint64_t SOURCE_NONE = ~0ull;
+    static constexpr uint64_t SOURCE_DMA = 0x1000; // value is the channel
+    static constexpr uint64_t SOURCE_TIMER = 0x2000; // value is the cycle counter
+
+    // Cores are not owned and must outlive the controller
+    explicit AxInterruptController(std::span<AxCore* const> cores);
+
+    uint64_t read(AxCore& core, uint64_t offset, uint32_t size) override;
+    void write(AxCore& core, uint64_t offset, uint32_t size, uint64_t value) override;
+
+    // Post a message to the mailbox of core target, may be called from any thread.
+    // Returns false if the mailbox is full or target is not a core of the controller.
+    bool post(uint32_t target, const AxInterrupt& interrupt) noexcept;
+
+private:
+    struct Mailbox
+    {
+        AxMpscQueue<AxInterrupt, MAILBOX_SIZE> queue{};
+        std::atomic<uint64_t> dropped{};
+        // only accessed by the thread of the core
+        uint64_t target{};
+        uint64_t value{};
+    };
+
+    std::vector<AxCore*> m_cores;
+    std::unique_ptr<Mailbox[]> m_mailboxes;
+};
+
+#endif
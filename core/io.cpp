@@ -3,12 +3,16 @@
 
 #include "core.hpp"
 
-#include <vector>
+#include "device.hpp"
 
-void AxCore::io_read(uint64_t offset, void* reg)
+uint64_t AxCore::io_read(uint64_t addr, uint32_t size)
 {
+    const auto& page = m_memory->page(addr);
+    return page.device->read(*this, addr - page.device_base, size);
 }
 
-void AxCore::io_write(uint64_t offset, void* reg)
+void AxCore::io_write(uint64_t addr, uint32_t size, uint64_t value)
 {
+    const auto& page = m_memory->page(addr);
+    page.device->write(*this, addr - page.device_base, size, value);
 }
@@ -0,0 +1,405 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "jit.hpp"
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define AX_JIT_X64 1
+#endif
+
+#ifdef AX_JIT_X64
+    #ifdef _WIN32
+        #define WIN32_LEAN_AND_MEAN
+        #define NOMINMAX
+        #include <windows.h>
+    #else
+        #include <sys/mman.h>
+        #include <unistd.h>
+    #endif
+#endif
+
+#include "core.hpp"
+#include "panic.hpp"
+
+#ifdef AX_JIT_X64
+
+namespace
+{
+
+// x86-64 registers used by generated code
+enum : uint8_t
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3, // RegisterSet*
+    RSI = 6,
+    RDI = 7,
+    R12 = 12, // AxCore*
+    R13 = 13, // status of called operations (AxCore::JIT_*)
+    R15 = 15, // PC before the last bundle
+};
+
+// Minimal x86-64 emitter, only encodes what the translator needs.
+// All guest registers are addressed relative to RBX.
+class Emitter
+{
+public:
+    std::size_t size() const noexcept
+    {
+        return m_code.size();
+    }
+
+    const uint8_t* data() const noexcept
+    {
+        return m_code.data();
+    }
+
+    void bytes(std::initializer_list<uint8_t> values)
+    {
+        m_code.insert(m_code.end(), values);
+    }
+
+    void imm32(uint32_t value)
+    {
+        for(int i = 0; i < 4; ++i)
+        {
+            m_code.emplace_back(static_cast<uint8_t>(value >> (i * 8)));
+        }
+    }
+
+    void imm64(uint64_t value)
+    {
+        imm32(static_cast<uint32_t>(value));
+        imm32(static_cast<uint32_t>(value >> 32));
+    }
+
+    // mov reg, imm64
+    void mov_imm(uint8_t reg, uint64_t value)
+    {
+        bytes({static_cast<uint8_t>(0x48 | (reg >> 3)), static_cast<uint8_t>(0xB8 | (reg & 7))});
+        imm64(value);
+    }
+
+    // mov reg, [rbx + offset]
+    void load(uint8_t reg, uint32_t offset)
+    {
+        bytes({0x48, 0x8B, static_cast<uint8_t>(0x83 | (reg << 3))});
+        imm32(offset);
+    }
+
+    // mov [rbx + offset], reg
+    void store(uint8_t reg, uint32_t offset)
+    {
+        bytes({0x48, 0x89, static_cast<uint8_t>(0x83 | (reg << 3))});
+        imm32(offset);
+    }
+
+    // add dword [rbx + offset], value
+    void add32(uint32_t offset, uint32_t value)
+    {
+        if(value != 0)
+        {
+            bytes({0x81, 0x83});
+            imm32(offset);
+            imm32(value);
+        }
+    }
+
+    // Jump to a label that is bound later, returns the position to patch
+    std::size_t jump(uint8_t condition)
+    {
+        if(condition == 0) // jmp rel32
+        {
+            bytes({0xE9});
+        }
+        else // jcc rel32
+        {
+            bytes({0x0F, condition});
+        }
+
+        imm32(0);
+        return m_code.size();
+    }
+
+    void bind(std::size_t jump)
+    {
+        const auto distance = static_cast<uint32_t>(m_code.size() - jump);
+        std::memcpy(m_code.data() + jump - 4, &distance, 4);
+    }
+
+private:
+    std::vector<uint8_t> m_code{};
+};
+
+constexpr uint8_t JNE = 0x85;
+
+constexpr uint32_t gpi_offset(uint32_t reg) noexcept
+{
+    return static_cast<uint32_t>(offsetof(AxCore::RegisterSet, gpi) + reg * sizeof(uint64_t));
+}
+
+constexpr uint32_t PC_OFFSET = offsetof(AxCore::RegisterSet, pc);
+constexpr uint32_t CC_OFFSET = offsetof(AxCore::RegisterSet, cc);
+constexpr uint32_t IC_OFFSET = offsetof(AxCore::RegisterSet, ic);
+
+bool is_inlined(const AxDecodedOpcode& op) noexcept
+{
+    if((op.issue & 0x06u) != 0) // not an ALU
+    {
+        return false;
+    }
+
+    switch(op.operation)
+    {
+    case AX_EXE_ALU_MOVEIX:
+    case AX_EXE_ALU_MOVEI:
+    case AX_EXE_ALU_EXT:
+    case AX_EXE_ALU_ADD:
+    case AX_EXE_ALU_SUB:
+    case AX_EXE_ALU_XOR:
+    case AX_EXE_ALU_OR:
+    case AX_EXE_ALU_AND:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Same semantic as AxCore::execute_alu for the operations accepted by is_inlined
+void emit_alu(Emitter& emitter, const AxDecodedOpcode& op)
+{
+    const uint32_t bypass = AxCore::REG_BA1 + op.slot;
+
+    switch(op.operation)
+    {
+    case AX_EXE_ALU_MOVEIX:
+        return;
+    case AX_EXE_ALU_MOVEI:
+        emitter.mov_imm(RAX, op.imm);
+        break;
+    case AX_EXE_ALU_EXT:
+        emitter.load(RAX, gpi_offset(op.src_b));
+        emitter.bytes({0x48, 0xC1, 0xE8, static_cast<uint8_t>(op.imm)}); // shr rax, imm
+        emitter.mov_imm(RCX, op.imm2);
+        emitter.bytes({0x48, 0x21, 0xC8}); // and rax, rcx
+        break;
+    default:
+    {
+        emitter.load(RAX, gpi_offset(op.src_b));
+        if(op.has_imm)
+        {
+            emitter.mov_imm(RCX, op.imm);
+        }
+        else
+        {
+            emitter.load(RCX, gpi_offset(op.src_c));
+        }
+
+        // op rax, rcx. Truncating operands is useless for these operations, only the result is truncated
+        static constexpr std::array<uint8_t, 5> opcodes{0x01, 0x29, 0x31, 0x09, 0x21}; // ADD, SUB, XOR, OR, AND
+        const auto index = op.operation == AX_EXE_ALU_AND ? 4u : op.operation - AX_EXE_ALU_ADD;
+        emitter.bytes({0x48, opcodes[index], 0xC8});
+
+        if(op.size == 0)
+        {
+            emitter.bytes({0x0F, 0xB6, 0xC0}); // movzx eax, al
+        }
+        else if(op.size == 1)
+        {
+            emitter.bytes({0x0F, 0xB7, 0xC0}); // movzx eax, ax
+        }
+        else if(op.size == 2)
+        {
+            emitter.bytes({0x89, 0xC0}); // mov eax, eax
+        }
+        break;
+    }
+    }
+
+    // always write bypass
+    emitter.store(RAX, gpi_offset(bypass));
+    emitter.store(RAX, gpi_offset(op.dst));
+}
+
+}
+
+#endif
+
+AxJit::AxJit(AxCore& core)
+    : m_core{&core}
+{
+#ifdef AX_JIT_X64
+    #ifdef _WIN32
+    m_code = static_cast<uint8_t*>(VirtualAlloc(nullptr, CODE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    ax_check(m_code != nullptr, "Failed to allocate JIT code buffer.");
+    #else
+    void* code = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ax_check(code != MAP_FAILED, "Failed to allocate JIT code buffer.");
+    m_code = static_cast<uint8_t*>(code);
+    #endif
+#else
+    ax_panic("JIT is not supported on this host.");
+#endif
+}
+
+AxJit::~AxJit()
+{
+#ifdef AX_JIT_X64
+    #ifdef _WIN32
+    VirtualFree(m_code, 0, MEM_RELEASE);
+    #else
+    munmap(m_code, CODE_SIZE);
+    #endif
+#endif
+}
+
+bool AxJit::supported() noexcept
+{
+#ifdef AX_JIT_X64
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AxJit::clear() noexcept
+{
+    m_used = 0;
+}
+
+AxNativeBlock AxJit::compile(const AxBlock& block)
+{
+#ifdef AX_JIT_X64
+    Emitter emitter;
+    std::vector<std::size_t> exits;
+
+    // prologue: save callee-saved registers, keep stack aligned with shadow space (for Win64)
+    emitter.bytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push rbx, r12, r13, r14, r15
+    emitter.bytes({0x48, 0x83, 0xEC, 0x20});                               // sub rsp, 32
+    emitter.mov_imm(RBX, reinterpret_cast<uint64_t>(&m_core->m_regs));
+    emitter.mov_imm(R12, reinterpret_cast<uint64_t>(m_core));
+    emitter.bytes({0x45, 0x31, 0xED}); // xor r13d, r13d
+
+    // cycle, instruction and pc counters are only written when needed
+    uint32_t pending_cycles = 0;
+    uint32_t pending_words = 0;
+    const auto flush = [&]()
+    {
+        emitter.add32(CC_OFFSET, pending_cycles);
+        emitter.add32(IC_OFFSET, pending_words);
+        emitter.add32(PC_OFFSET, pending_words);
+        pending_cycles = 0;
+        pending_words = 0;
+    };
+
+    const auto count = block.bundles.size();
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        const auto& bundle = block.bundles[i];
+        const bool last = i + 1 == count;
+        if(last) // only the last bundle may jump, remember PC to detect it like AxCore::execute
+        {
+            flush();
+            emitter.bytes({0x44, 0x8B, 0xBB}); // mov r15d, [rbx + pc]
+            emitter.imm32(PC_OFFSET);
+        }
+
+        bool called = false;
+        for(uint32_t j = 0; j < bundle.op_count; ++j)
+        {
+            const auto& op = bundle.ops[j];
+            if(is_inlined(op))
+            {
+                emit_alu(emitter, op);
+                continue;
+            }
+
+            // fallback to the interpreter, it needs up-to-date counters
+            flush();
+#ifdef _WIN32
+            emitter.bytes({0x4C, 0x89, 0xE1}); // mov rcx, r12
+            emitter.mov_imm(RDX, reinterpret_cast<uint64_t>(&op));
+#else
+            emitter.bytes({0x4C, 0x89, 0xE7}); // mov rdi, r12
+            emitter.mov_imm(RSI, reinterpret_cast<uint64_t>(&op));
+#endif
+            emitter.mov_imm(RAX, reinterpret_cast<uint64_t>(&AxCore::jit_execute));
+            emitter.bytes({0xFF, 0xD0});       // call rax
+            emitter.bytes({0xA8, static_cast<uint8_t>(AxCore::JIT_FAILED)}); // test al, JIT_FAILED
+            exits.emplace_back(emitter.jump(JNE));
+            emitter.bytes({0x41, 0x09, 0xC5}); // or r13d, eax
+            called = true;
+        }
+
+        if(!last)
+        {
+            pending_cycles += 1;
+            pending_words += bundle.size;
+            if(called) // self-modifying code or halt: stop after this bundle, like AxCore::execute_blocks
+            {
+                flush();
+                emitter.bytes({0xB8});
+                emitter.imm32(static_cast<uint32_t>(i + 1)); // mov eax, cycles
+                emitter.bytes({0x45, 0x85, 0xED});           // test r13d, r13d
+                exits.emplace_back(emitter.jump(JNE));
+            }
+        }
+        else
+        {
+            emitter.bytes({0x44, 0x3B, 0xBB}); // cmp r15d, [rbx + pc]
+            emitter.imm32(PC_OFFSET);
+            const auto jumped = emitter.jump(JNE);
+            emitter.add32(PC_OFFSET, bundle.size);
+            emitter.add32(IC_OFFSET, bundle.size);
+            emitter.bind(jumped);
+            emitter.add32(CC_OFFSET, 1);
+            emitter.bytes({0xB8});
+            emitter.imm32(static_cast<uint32_t>(count)); // mov eax, cycles
+        }
+    }
+
+    // epilogue
+    for(auto exit : exits)
+    {
+        emitter.bind(exit);
+    }
+
+    emitter.bytes({0x48, 0x83, 0xC4, 0x20});                               // add rsp, 32
+    emitter.bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B}); // pop r15, r14, r13, r12, rbx
+    emitter.bytes({0xC3});                                                 // ret
+
+    // copy to the executable buffer, 16 bytes aligned
+    const auto begin = (m_used + 15) & ~std::size_t{15};
+    if(begin + emitter.size() > CODE_SIZE)
+    {
+        return nullptr;
+    }
+
+    auto* const code = m_code + begin;
+    #ifdef _WIN32
+    DWORD old{};
+    VirtualProtect(code, emitter.size(), PAGE_READWRITE, &old);
+    std::memcpy(code, emitter.data(), emitter.size());
+    VirtualProtect(code, emitter.size(), PAGE_EXECUTE_READ, &old);
+    FlushInstructionCache(GetCurrentProcess(), code, emitter.size());
+    #else
+    static const auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    auto* const first_page = m_code + (begin & ~(page_size - 1));
+    const auto length = static_cast<std::size_t>(code + emitter.size() - first_page);
+    mprotect(first_page, length, PROT_READ | PROT_WRITE);
+    std::memcpy(code, emitter.data(), emitter.size());
+    ax_check(mprotect(first_page, length, PROT_READ | PROT_EXEC) == 0, "Failed to make JIT code executable.");
+    #endif
+
+    m_used = begin + emitter.size();
+    return reinterpret_cast<AxNativeBlock>(code);
+#else
+    static_cast<void>(block);
+    return nullptr;
+#endif
+}
@@ -0,0 +1,48 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXJIT_HPP_INCLUDED
+#define AXJIT_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+
+#include "block.hpp"
+
+class AxCore;
+
+// Translate hot blocks to native x86-64 code.
+// Simple ALU operations are inlined, everything else calls back into the core (see AxCore::jit_execute).
+// Guest state always lives in AxCore::RegisterSet, so the debugger and syscalls see the same registers.
+// Generated code is specific to the core that owns this object.
+class AxJit
+{
+public:
+    // Number of interpreted executions of a block before it is compiled
+    static constexpr uint32_t HOT_THRESHOLD = 32;
+    static constexpr std::size_t CODE_SIZE = 16 * 1024 * 1024;
+
+    explicit AxJit(AxCore& core);
+    ~AxJit();
+    AxJit(const AxJit&) = delete;
+    AxJit& operator=(const AxJit&) = delete;
+    AxJit(AxJit&&) noexcept = delete;
+    AxJit& operator=(AxJit&&) noexcept = delete;
+
+    // Returns true if this host can run generated code
+    static bool supported() noexcept;
+
+    // Compile a block, returns nullptr if it can not be compiled (e.g. code buffer is full).
+    // Generated code keeps pointers to the block's bundles, so it must not outlive it.
+    AxNativeBlock compile(const AxBlock& block);
+
+    // Release all generated code, must be called when blocks are dropped
+    void clear() noexcept;
+
+private:
+    AxCore* m_core{};
+    uint8_t* m_code{};
+    std::size_t m_used{};
+};
+
+#endif
@@ -0,0 +1,634 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "llvm_jit.hpp"
+
+#include <string>
+#include <vector>
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "core.hpp"
+#include "memory.hpp"
+#include "panic.hpp"
+#include "utilities.hpp"
+
+namespace
+{
+
+// Addresses and constants baked in generated code
+struct Target
+{
+    uint64_t core{};
+    uint64_t attention{}; // AxCore::m_attention
+    uint64_t code_generation{}; // AxMemory::code_generation
+    uint64_t execute{}; // AxCore::jit_execute
+    uint64_t wram{};
+    uint64_t wram_mask{};
+    uint32_t failed{};
+};
+
+constexpr uint32_t gpi_offset(uint32_t reg) noexcept
+{
+    return static_cast<uint32_t>(offsetof(AxCore::RegisterSet, gpi) + reg * sizeof(uint64_t));
+}
+
+constexpr uint32_t PC_OFFSET = offsetof(AxCore::RegisterSet, pc);
+constexpr uint32_t CC_OFFSET = offsetof(AxCore::RegisterSet, cc);
+constexpr uint32_t IC_OFFSET = offsetof(AxCore::RegisterSet, ic);
+constexpr uint32_t FR_OFFSET = offsetof(AxCore::RegisterSet, fr);
+
+bool is_alu(const AxDecodedOpcode& op) noexcept
+{
+    return (op.issue & 0x06u) == 0;
+}
+
+bool is_lsu(const AxDecodedOpcode& op) noexcept
+{
+    return (op.issue & 0x07u) == 2;
+}
+
+bool is_bru(const AxDecodedOpcode& op) noexcept
+{
+    return op.issue == 7;
+}
+
+// Build the function of a region.
+// Guest state is only accessed through loads and stores to the RegisterSet,
+// calls to the core are seen as clobbering everything so LLVM keeps the memory up-to-date around them.
+// Between calls, LLVM is free to keep registers in host registers (GVN, LICM promotion, ...).
+class RegionBuilder
+{
+public:
+    RegionBuilder(llvm::Module& module, const Target& target, std::span<const AxBlock* const> blocks)
+        : m_context{module.getContext()}
+        , m_module{module}
+        , m_builder{m_context}
+        , m_target{target}
+        , m_blocks{blocks}
+    {
+    }
+
+    void build(const std::string& name)
+    {
+        // registers are given as an argument, so LLVM knows that fields at different offsets don't alias
+        auto* const i64 = m_builder.getInt64Ty();
+        auto* const type = llvm::FunctionType::get(i64, {m_builder.getInt8PtrTy(), i64}, false);
+        m_function = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, m_module);
+        m_registers = m_function->getArg(0);
+        m_max_cycles = m_function->getArg(1);
+
+        auto* const entry = llvm::BasicBlock::Create(m_context, "entry", m_function);
+        m_exit = llvm::BasicBlock::Create(m_context, "exit", m_function);
+        for(auto* block : m_blocks)
+        {
+            m_entries.emplace_back(llvm::BasicBlock::Create(m_context, "block_" + std::to_string(block->pc), m_function));
+        }
+
+        m_builder.SetInsertPoint(entry);
+        m_cycles = m_builder.CreateAlloca(i64);
+        m_status = m_builder.CreateAlloca(m_builder.getInt32Ty());
+        m_builder.CreateStore(m_builder.getInt64(0), m_cycles);
+        m_builder.CreateStore(m_builder.getInt32(0), m_status);
+        m_code_generation = load_code_generation();
+        m_builder.CreateBr(m_entries.front());
+
+        m_builder.SetInsertPoint(m_exit);
+        m_builder.CreateRet(m_builder.CreateLoad(i64, m_cycles));
+
+        for(std::size_t i = 0; i < m_blocks.size(); ++i)
+        {
+            m_builder.SetInsertPoint(m_entries[i]);
+            build_block(*m_blocks[i]);
+        }
+    }
+
+private:
+    llvm::Value* field(uint32_t offset, llvm::Type* type)
+    {
+        auto* const pointer = m_builder.CreateConstInBoundsGEP1_64(m_builder.getInt8Ty(), m_registers, offset);
+        return m_builder.CreatePointerCast(pointer, type->getPointerTo());
+    }
+
+    // Writes of other cores to code, see AxCore::sync_code
+    llvm::Value* load_code_generation()
+    {
+        auto* const i64 = m_builder.getInt64Ty();
+        auto* const pointer = m_builder.CreateIntToPtr(m_builder.getInt64(m_target.code_generation), i64->getPointerTo());
+        auto* const generation = m_builder.CreateLoad(i64, pointer);
+        generation->setAtomic(llvm::AtomicOrdering::Acquire);
+        generation->setAlignment(llvm::Align{8});
+        return generation;
+    }
+
+    llvm::Value* load32(uint32_t offset)
+    {
+        auto* const i32 = m_builder.getInt32Ty();
+        return m_builder.CreateLoad(i32, field(offset, i32));
+    }
+
+    void store32(uint32_t offset, llvm::Value* value)
+    {
+        m_builder.CreateStore(value, field(offset, m_builder.getInt32Ty()));
+    }
+
+    void add32(uint32_t offset, llvm::Value* value)
+    {
+        store32(offset, m_builder.CreateAdd(load32(offset), value));
+    }
+
+    llvm::Value* load_gpi(uint32_t reg)
+    {
+        auto* const i64 = m_builder.getInt64Ty();
+        return m_builder.CreateLoad(i64, field(gpi_offset(reg), i64));
+    }
+
+    void store_gpi(uint32_t reg, llvm::Value* value)
+    {
+        m_builder.CreateStore(value, field(gpi_offset(reg), m_builder.getInt64Ty()));
+    }
+
+    llvm::Value* trunc(llvm::Value* value, uint32_t size)
+    {
+        if(size == 3)
+        {
+            return value;
+        }
+
+        return m_builder.CreateAnd(value, sizemask[size]);
+    }
+
+    llvm::Value* sext(llvm::Value* value, uint32_t size)
+    {
+        const auto bits = 8u << size;
+        auto* const narrow = m_builder.CreateTrunc(value, m_builder.getIntNTy(bits));
+        return m_builder.CreateSExt(narrow, m_builder.getInt64Ty());
+    }
+
+    void build_block(const AxBlock& block)
+    {
+        const auto count = block.bundles.size();
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            build_bundle(block.bundles[i], i + 1 == count);
+        }
+
+        // side exit if code has been modified (by this core or another one), if the core needs attention
+        // (stop, interrupt, halt), or if we ran enough cycles, like AxCore::execute_blocks
+        auto* const i32 = m_builder.getInt32Ty();
+        auto* const cycles = m_builder.CreateLoad(m_builder.getInt64Ty(), m_cycles);
+        auto* const written = m_builder.CreateICmpNE(load_code_generation(), m_code_generation);
+        auto* const modified = m_builder.CreateOr(m_builder.CreateICmpNE(m_builder.CreateLoad(i32, m_status), m_builder.getInt32(0)), written);
+        auto* const attention_pointer = m_builder.CreateIntToPtr(m_builder.getInt64(m_target.attention), i32->getPointerTo());
+        auto* const attention = m_builder.CreateLoad(i32, attention_pointer);
+        attention->setAtomic(llvm::AtomicOrdering::Monotonic);
+        attention->setAlignment(llvm::Align{4});
+        auto* const interrupted = m_builder.CreateICmpNE(attention, m_builder.getInt32(0));
+        auto* const done = m_builder.CreateOr(m_builder.CreateOr(modified, interrupted), m_builder.CreateICmpUGE(cycles, m_max_cycles));
+        auto* const next = llvm::BasicBlock::Create(m_context, "next", m_function);
+        m_builder.CreateCondBr(done, m_exit, next);
+
+        // follow the next block if it is in the region, exit otherwise.
+        // Read-only loops exit too, so AxCore::execute_blocks can detect that they spin.
+        m_builder.SetInsertPoint(next);
+        auto* const selector = m_builder.CreateSwitch(load32(PC_OFFSET), m_exit, static_cast<unsigned>(m_blocks.size()));
+        for(std::size_t i = 0; i < m_blocks.size(); ++i)
+        {
+            if(m_blocks[i] != &block || !block.read_only)
+            {
+                selector->addCase(m_builder.getInt32(m_blocks[i]->pc), m_entries[i]);
+            }
+        }
+    }
+
+    // Same as one iteration of AxCore::execute_blocks interpreter loop
+    void build_bundle(const AxDecodedBundle& bundle, bool last)
+    {
+        auto* const i32 = m_builder.getInt32Ty();
+
+        // only the last bundle may jump
+        llvm::Value* old_pc = last ? load32(PC_OFFSET) : nullptr;
+
+        bool called = false;
+        for(uint32_t i = 0; i < bundle.op_count; ++i)
+        {
+            called |= build_op(bundle.ops[i]);
+        }
+
+        if(last)
+        {
+            auto* const new_pc = load32(PC_OFFSET);
+            auto* const jumped = m_builder.CreateICmpNE(old_pc, new_pc);
+            auto* const increment = m_builder.CreateSelect(jumped, m_builder.getInt32(0), m_builder.getInt32(bundle.size));
+            store32(PC_OFFSET, m_builder.CreateAdd(new_pc, increment));
+            add32(IC_OFFSET, increment);
+        }
+        else
+        {
+            add32(PC_OFFSET, m_builder.getInt32(bundle.size));
+            add32(IC_OFFSET, m_builder.getInt32(bundle.size));
+        }
+
+        add32(CC_OFFSET, m_builder.getInt32(1));
+        auto* const i64 = m_builder.getInt64Ty();
+        m_builder.CreateStore(m_builder.CreateAdd(m_builder.CreateLoad(i64, m_cycles), m_builder.getInt64(1)), m_cycles);
+
+        if(!last && called) // self-modifying code or halt: stop after this bundle
+        {
+            auto* const next = llvm::BasicBlock::Create(m_context, "bundle", m_function);
+            auto* const modified = m_builder.CreateICmpNE(m_builder.CreateLoad(i32, m_status), m_builder.getInt32(0));
+            m_builder.CreateCondBr(modified, m_exit, next);
+            m_builder.SetInsertPoint(next);
+        }
+    }
+
+    // Returns true if the operation may call the core
+    bool build_op(const AxDecodedOpcode& op)
+    {
+        if(is_alu(op) && build_alu(op))
+        {
+            return false;
+        }
+
+        if(is_bru(op) && build_bru(op))
+        {
+            return false;
+        }
+
+        if(is_lsu(op) && build_load(op))
+        {
+            return true;
+        }
+
+        build_call(op);
+        return true;
+    }
+
+    void build_call(const AxDecodedOpcode& op)
+    {
+        auto* const i32 = m_builder.getInt32Ty();
+        auto* const pointer = m_builder.getInt8PtrTy();
+        auto* const type = llvm::FunctionType::get(i32, {pointer, pointer}, false);
+        auto* const callee = m_builder.CreateIntToPtr(m_builder.getInt64(m_target.execute), type->getPointerTo());
+        auto* const core = m_builder.CreateIntToPtr(m_builder.getInt64(m_target.core), pointer);
+        auto* const opcode = m_builder.CreateIntToPtr(m_builder.getInt64(reinterpret_cast<uint64_t>(&op)), pointer);
+        auto* const status = m_builder.CreateCall(type, callee, {core, opcode});
+
+        // exceptions are rethrown by the core, leave immediately
+        auto* const next = llvm::BasicBlock::Create(m_context, "called", m_function);
+        auto* const failed = m_builder.CreateICmpNE(m_builder.CreateAnd(status, m_target.failed), m_builder.getInt32(0));
+        m_builder.CreateCondBr(failed, m_exit, next);
+        m_builder.SetInsertPoint(next);
+        m_builder.CreateStore(m_builder.CreateOr(m_builder.CreateLoad(i32, m_status), status), m_status);
+    }
+
+    // Same semantic as AxCore::execute_alu, returns false if the operation is not lifted
+    bool build_alu(const AxDecodedOpcode& op)
+    {
+        const uint32_t bypass = AxCore::REG_BA1 + op.slot;
+
+        const auto writeback = [this, &op, bypass](llvm::Value* value)
+        {
+            store_gpi(bypass, value);
+            store_gpi(op.dst, value);
+        };
+
+        const auto right = [this, &op]()
+        {
+            return op.has_imm ? m_builder.getInt64(op.imm) : load_gpi(op.src_c);
+        };
+
+        const auto to_u64 = [this](llvm::Value* value)
+        {
+            return m_builder.CreateZExt(value, m_builder.getInt64Ty());
+        };
+
+        switch(op.operation)
+        {
+        case AX_EXE_ALU_MOVEIX:
+            return true;
+        case AX_EXE_ALU_MOVEI:
+            writeback(m_builder.getInt64(op.imm));
+            return true;
+        case AX_EXE_ALU_EXT:
+            writeback(m_builder.CreateAnd(m_builder.CreateLShr(load_gpi(op.src_b), op.imm), op.imm2));
+            return true;
+        case AX_EXE_ALU_ADDS:
+            writeback(sext(m_builder.CreateAdd(load_gpi(op.src_b), right()), op.size));
+            return true;
+        case AX_EXE_ALU_SUBS:
+            writeback(sext(m_builder.CreateSub(load_gpi(op.src_b), right()), op.size));
+            return true;
+        case AX_EXE_ALU_CMP:
+            build_cmp(load_gpi(op.src_b), right(), op.size);
+            return true;
+        case AX_EXE_ALU_ADD:
+            writeback(trunc(m_builder.CreateAdd(load_gpi(op.src_b), right()), op.size));
+            return true;
+        case AX_EXE_ALU_SUB:
+            writeback(trunc(m_builder.CreateSub(load_gpi(op.src_b), right()), op.size));
+            return true;
+        case AX_EXE_ALU_XOR:
+            writeback(trunc(m_builder.CreateXor(load_gpi(op.src_b), right()), op.size));
+            return true;
+        case AX_EXE_ALU_OR:
+            writeback(trunc(m_builder.CreateOr(load_gpi(op.src_b), right()), op.size));
+            return true;
+        case AX_EXE_ALU_AND:
+            writeback(trunc(m_builder.CreateAnd(load_gpi(op.src_b), right()), op.size));
+            return true;
+        case AX_EXE_ALU_SE:
+            writeback(to_u64(m_builder.CreateICmpEQ(trunc(load_gpi(op.src_b), op.size), trunc(right(), op.size))));
+            return true;
+        case AX_EXE_ALU_SEN:
+            writeback(to_u64(m_builder.CreateICmpNE(trunc(load_gpi(op.src_b), op.size), trunc(right(), op.size))));
+            return true;
+        case AX_EXE_ALU_SAND:
+            writeback(to_u64(m_builder.CreateICmpNE(trunc(m_builder.CreateAnd(load_gpi(op.src_b), right()), op.size), m_builder.getInt64(0))));
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Same as do_cmp
+    void build_cmp(llvm::Value* left, llvm::Value* right, uint32_t size)
+    {
+        auto* const type = m_builder.getIntNTy(8u << size);
+        left = m_builder.CreateTrunc(left, type);
+        right = m_builder.CreateTrunc(right, type);
+
+        auto* const sub = m_builder.CreateBinaryIntrinsic(llvm::Intrinsic::ssub_with_overflow, left, right);
+        auto* const result = m_builder.CreateExtractValue(sub, 0);
+        auto* const overflow = m_builder.CreateExtractValue(sub, 1);
+
+        const auto flag = [this](llvm::Value* value, uint32_t mask)
+        {
+            return m_builder.CreateSelect(value, m_builder.getInt32(mask), m_builder.getInt32(0));
+        };
+
+        llvm::Value* flags = flag(overflow, AxCore::O_MASK);
+        flags = m_builder.CreateOr(flags, flag(m_builder.CreateICmpEQ(result, llvm::ConstantInt::get(type, 0)), AxCore::Z_MASK));
+        flags = m_builder.CreateOr(flags, flag(m_builder.CreateICmpUGT(result, left), AxCore::C_MASK));
+        flags = m_builder.CreateOr(flags, flag(m_builder.CreateICmpSLT(result, llvm::ConstantInt::get(type, 0)), AxCore::N_MASK));
+
+        static constexpr uint32_t mask = AxCore::Z_MASK | AxCore::C_MASK | AxCore::N_MASK | AxCore::O_MASK | AxCore::U_MASK;
+        store32(FR_OFFSET, m_builder.CreateOr(m_builder.CreateAnd(load32(FR_OFFSET), ~mask), flags));
+    }
+
+    // Same semantic as AxCore::execute_bru, returns false if the operation is not lifted
+    bool build_bru(const AxDecodedOpcode& op)
+    {
+        auto* const pc = load32(PC_OFFSET);
+        auto* const target = m_builder.CreateAdd(pc, m_builder.getInt32(static_cast<uint32_t>(op.imm)));
+
+        const auto flag = [this](uint32_t bit)
+        {
+            return m_builder.CreateTrunc(m_builder.CreateLShr(load32(FR_OFFSET), bit), m_builder.getInt1Ty());
+        };
+
+        llvm::Value* taken{};
+        switch(op.operation)
+        {
+        case AX_EXE_BRU_BEQ:
+            taken = m_builder.CreateAnd(flag(0), m_builder.CreateNot(flag(4)));
+            break;
+        case AX_EXE_BRU_BNE:
+            taken = m_builder.CreateAnd(m_builder.CreateNot(flag(0)), m_builder.CreateNot(flag(4)));
+            break;
+        case AX_EXE_BRU_BLT:
+            taken = m_builder.CreateAnd(m_builder.CreateICmpNE(flag(2), flag(3)), m_builder.CreateNot(flag(4)));
+            break;
+        case AX_EXE_BRU_BGE:
+            taken = m_builder.CreateAnd(m_builder.CreateOr(flag(0), m_builder.CreateICmpEQ(flag(2), flag(3))), m_builder.CreateNot(flag(4)));
+            break;
+        case AX_EXE_BRU_BLTU:
+            taken = m_builder.CreateOr(flag(1), flag(4));
+            break;
+        case AX_EXE_BRU_BGEU:
+            taken = m_builder.CreateOr(m_builder.CreateOr(flag(0), m_builder.CreateNot(flag(1))), flag(4));
+            break;
+        case AX_EXE_BRU_BEQU:
+            taken = m_builder.CreateOr(flag(0), flag(4));
+            break;
+        case AX_EXE_BRU_BNEU:
+            taken = m_builder.CreateOr(m_builder.CreateNot(flag(0)), flag(4));
+            break;
+        case AX_EXE_BRU_BRA:
+            store32(PC_OFFSET, target);
+            return true;
+        case AX_EXE_BRU_JUMP:
+            store32(PC_OFFSET, m_builder.getInt32(static_cast<uint32_t>(op.imm)));
+            return true;
+        default:
+            return false;
+        }
+
+        store32(PC_OFFSET, m_builder.CreateSelect(taken, target, pc));
+        return true;
+    }
+
+    // Loads from WRAM are done inline, everything else calls the core
+    bool build_load(const AxDecodedOpcode& op)
+    {
+        const bool signed_load = op.operation == AX_EXE_LSU_LDS || op.operation == AX_EXE_LSU_LDIS;
+        const bool imm_load = op.operation == AX_EXE_LSU_LDI || op.operation == AX_EXE_LSU_LDIS;
+        if(!signed_load && !imm_load && op.operation != AX_EXE_LSU_LD)
+        {
+            return false;
+        }
+
+        const uint32_t bypass = AxCore::REG_BL1 + op.slot;
+
+        llvm::Value* addr{};
+        if(imm_load)
+        {
+            addr = m_builder.CreateAdd(load_gpi(op.src_b), m_builder.getInt64(op.imm));
+        }
+        else
+        {
+            addr = m_builder.CreateAdd(load_gpi(op.src_b), m_builder.CreateShl(load_gpi(op.src_c), op.shift));
+        }
+
+        auto* const wram = llvm::BasicBlock::Create(m_context, "wram", m_function);
+        auto* const other = llvm::BasicBlock::Create(m_context, "other", m_function);
+        auto* const next = llvm::BasicBlock::Create(m_context, "loaded", m_function);
+        auto* const in_wram = m_builder.CreateICmpNE(m_builder.CreateAnd(addr, AxMemory::WRAM_BEGIN), m_builder.getInt64(0));
+        m_builder.CreateCondBr(in_wram, wram, other);
+
+        m_builder.SetInsertPoint(wram);
+        auto* const type = m_builder.getIntNTy(8u << op.size);
+        auto* const offset = m_builder.CreateAnd(addr, m_target.wram_mask);
+        auto* const base = m_builder.CreateIntToPtr(m_builder.getInt64(m_target.wram), m_builder.getInt8PtrTy());
+        auto* const pointer = m_builder.CreateGEP(m_builder.getInt8Ty(), base, offset);
+        auto* const raw = m_builder.CreateAlignedLoad(type, m_builder.CreatePointerCast(pointer, type->getPointerTo()), llvm::MaybeAlign{1});
+        auto* const value = signed_load ? m_builder.CreateSExt(raw, m_builder.getInt64Ty()) : m_builder.CreateZExt(raw, m_builder.getInt64Ty());
+        store_gpi(op.dst, value);
+        store_gpi(bypass, value);
+        m_builder.CreateBr(next);
+
+        m_builder.SetInsertPoint(other);
+        build_call(op);
+        m_builder.CreateBr(next);
+
+        m_builder.SetInsertPoint(next);
+        return true;
+    }
+
+    llvm::LLVMContext& m_context;
+    llvm::Module& m_module;
+    llvm::IRBuilder<> m_builder;
+    const Target& m_target;
+    std::span<const AxBlock* const> m_blocks;
+
+    llvm::Function* m_function{};
+    llvm::Value* m_max_cycles{};
+    llvm::Value* m_registers{};
+    llvm::Value* m_cycles{};
+    llvm::Value* m_status{};
+    llvm::Value* m_code_generation{}; // at entry of the region
+    llvm::BasicBlock* m_exit{};
+    std::vector<llvm::BasicBlock*> m_entries{};
+};
+
+void optimize(llvm::Module& module, llvm::TargetMachine* machine)
+{
+    llvm::LoopAnalysisManager loops;
+    llvm::FunctionAnalysisManager functions;
+    llvm::CGSCCAnalysisManager cgscc;
+    llvm::ModuleAnalysisManager modules;
+
+    llvm::PassBuilder builder{machine};
+    builder.registerModuleAnalyses(modules);
+    builder.registerCGSCCAnalyses(cgscc);
+    builder.registerFunctionAnalyses(functions);
+    builder.registerLoopAnalyses(loops);
+    builder.crossRegisterProxies(loops, functions, cgscc, modules);
+
+    auto passes = builder.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2);
+    passes.run(module, modules);
+}
+
+}
+
+struct AxLLVMJit::Impl
+{
+    std::unique_ptr<llvm::orc::LLJIT> jit{};
+    std::unique_ptr<llvm::TargetMachine> machine{};
+    llvm::orc::ResourceTrackerSP tracker{};
+    uint64_t count{};
+};
+
+AxLLVMJit::AxLLVMJit(AxCore& core)
+    : m_core{&core}
+    , m_impl{std::make_unique<Impl>()}
+{
+    static const bool initialized = []()
+    {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        return true;
+    }();
+    static_cast<void>(initialized);
+
+    auto jit = llvm::orc::LLJITBuilder{}.create();
+    if(!jit)
+    {
+        ax_panic("Failed to create LLVM JIT: ", llvm::toString(jit.takeError()));
+    }
+
+    auto builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if(builder)
+    {
+        auto machine = builder->createTargetMachine();
+        if(machine)
+        {
+            m_impl->machine = std::move(*machine);
+        }
+        else
+        {
+            llvm::consumeError(machine.takeError());
+        }
+    }
+    else
+    {
+        llvm::consumeError(builder.takeError());
+    }
+
+    m_impl->jit = std::move(*jit);
+    m_impl->tracker = m_impl->jit->getMainJITDylib().createResourceTracker();
+}
+
+AxLLVMJit::~AxLLVMJit() = default;
+
+AxNativeRegion AxLLVMJit::compile(std::span<const AxBlock* const> blocks)
+{
+    if(blocks.empty())
+    {
+        return nullptr;
+    }
+
+    Target target{};
+    target.core = reinterpret_cast<uint64_t>(m_core);
+    target.attention = reinterpret_cast<uint64_t>(&m_core->m_attention);
+    target.code_generation = reinterpret_cast<uint64_t>(&m_core->m_memory->code_generation());
+    target.execute = reinterpret_cast<uint64_t>(&AxCore::jit_execute);
+    target.wram = reinterpret_cast<uint64_t>(m_core->m_wram_begin);
+    target.wram_mask = m_core->m_wram_mask;
+    target.failed = AxCore::JIT_FAILED;
+
+    const auto name = "region_" + std::to_string(m_impl->count++);
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = std::make_unique<llvm::Module>(name, *context);
+    module->setDataLayout(m_impl->jit->getDataLayout());
+    module->setTargetTriple(m_impl->jit->getTargetTriple().str());
+
+    RegionBuilder builder{*module, target, blocks};
+    builder.build(name);
+    if(llvm::verifyModule(*module, &llvm::errs()))
+    {
+        return nullptr;
+    }
+
+    optimize(*module, m_impl->machine.get());
+
+    if(auto error = m_impl->jit->addIRModule(m_impl->tracker, llvm::orc::ThreadSafeModule{std::move(module), std::move(context)}))
+    {
+        llvm::consumeError(std::move(error));
+        return nullptr;
+    }
+
+    auto symbol = m_impl->jit->lookup(name);
+    if(!symbol)
+    {
+        llvm::consumeError(symbol.takeError());
+        return nullptr;
+    }
+
+#if LLVM_VERSION_MAJOR >= 15
+    return symbol->toPtr<AxNativeRegion>();
+#else
+    return reinterpret_cast<AxNativeRegion>(symbol->getAddress());
+#endif
+}
+
+void AxLLVMJit::clear()
+{
+    if(auto error = m_impl->tracker->remove())
+    {
+        llvm::consumeError(std::move(error));
+    }
+
+    m_impl->tracker = m_impl->jit->getMainJITDylib().createResourceTracker();
+}
@@ -0,0 +1,49 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXLLVMJIT_HPP_INCLUDED
+#define AXLLVMJIT_HPP_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "block.hpp"
+
+class AxCore;
+
+// Second JIT tier, only available if the VM is built with AltairXVM_LLVM_JIT.
+// Very hot regions (a block and its hot static successors) are lifted to LLVM IR and compiled with ORC at -O2,
+// so guest registers can be kept in host registers across blocks and loops can be optimized.
+// Operations that are not lifted call back into the core (see AxCore::jit_execute),
+// any branch leaving the region is a side exit back to the interpreter.
+// Generated code is specific to the core that owns this object.
+class AxLLVMJit
+{
+    struct Impl;
+
+public:
+    // Number of executions of a block before a region is compiled from it
+    static constexpr uint32_t HOT_THRESHOLD = 4096;
+    static constexpr std::size_t MAX_REGION_BLOCKS = 16;
+
+    explicit AxLLVMJit(AxCore& core);
+    ~AxLLVMJit();
+    AxLLVMJit(const AxLLVMJit&) = delete;
+    AxLLVMJit& operator=(const AxLLVMJit&) = delete;
+    AxLLVMJit(AxLLVMJit&&) noexcept = delete;
+    AxLLVMJit& operator=(AxLLVMJit&&) noexcept = delete;
+
+    // Compile a region, first block is the entry. Returns nullptr on failure.
+    // Generated code keeps pointers to the blocks' bundles, so it must not outlive them.
+    AxNativeRegion compile(std::span<const AxBlock* const> blocks);
+
+    // Release all generated code, must be called when blocks are dropped
+    void clear();
+
+private:
+    AxCore* m_core{};
+    std::unique_ptr<Impl> m_impl;
+};
+
+#endif
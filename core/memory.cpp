@@ -3,56 +3,211 @@
 
 #include "memory.hpp"
 
+#include <algorithm>
+#include <initializer_list>
+#include <utility>
+
 #include "core.hpp"
+#include "fault.hpp"
+#include "panic.hpp"
+
+static_assert(AxMemory::region_index(AxMemory::IO_BEGIN) == 1 && AxMemory::region_index(AxMemory::ROM_BEGIN) == 2
+    && AxMemory::region_index(AxMemory::SPMT_BEGIN) == 3 && AxMemory::region_index(AxMemory::SPM2_BEGIN) == 4
+    && AxMemory::region_index(AxMemory::WRAM_BEGIN) == 5 && AxMemory::region_index(AxMemory::WRAM_BEGIN - 1) == 4,
+    "Memory map does not match region_index.");
+
+namespace
+{
 
-AxMemory::AxMemory(size_t nwram, size_t nspmt, size_t nspm2)
+// Size of the guest address range of a region
+constexpr uint64_t window(uint64_t begin, uint64_t end) noexcept
 {
-    m_io.resize(IO_SIZE / 8ull);
-    m_rom.resize(ROM_SIZE / 8ull);
-    m_wram.resize(0x100000ull * nwram / 8ull); // 1Mio pages
-    m_spmt.resize(0x400ull * nspmt / 8ull);    // 1Kio pages
-    m_spm2.resize(0x400ull * nspm2 / 8ull);    // 1Kio pages
+    return end - begin;
+}
+
+// Guarded regions own their whole guest address range, plus a page for unaligned accesses at its end
+std::size_t reserved_size(bool guarded, std::size_t size, uint64_t window) noexcept
+{
+    return guarded ? std::max<std::size_t>(size, window) + AxMemory::PAGE_SIZE : 0;
+}
 
-    m_spmt_mask = (m_spmt.size() * 8ull) - 1;
-    m_spm2_mask = (m_spm2.size() * 8ull) - 1;
-    m_wram_mask = (m_wram.size() * 8ull) - 1;
+}
+
+AxMemory::AxMemory(size_t nwram, size_t nspmt, size_t nspm2, AxHugePages huge_pages, bool guarded)
+    : m_io{IO_SIZE, false, reserved_size(guarded, IO_SIZE, window(IO_BEGIN, ROM_BEGIN))}
+    , m_rom{ROM_SIZE, false, reserved_size(guarded, ROM_SIZE, window(ROM_BEGIN, SPMT_BEGIN))}
+    , m_spmt{0x400ull * nspmt, false, reserved_size(guarded, 0x400ull * nspmt, window(SPMT_BEGIN, SPM2_BEGIN))} // 1Kio pages
+    , m_spm2{0x400ull * nspm2, huge_pages == AxHugePages::WRAM_SPM2, reserved_size(guarded, 0x400ull * nspm2, window(SPM2_BEGIN, WRAM_BEGIN))} // 1Kio pages
+    , m_wram{0x100000ull * nwram, huge_pages != AxHugePages::NONE, reserved_size(guarded, 0x100000ull * nwram, window(WRAM_BEGIN, PAGE_COUNT << PAGE_SHIFT))} // 1Mio pages
+    , m_guarded{guarded}
+{
+    ax_check(nwram <= 4096, "WRAM size can not exceed 4 Gio.");
+
+    // guarded regions are not mirrored, all offsets of their address range are mapped to the reserved range
+    const auto region_mask = [guarded](const AxMemoryRegion& region, uint64_t window)
+    {
+        return (guarded ? std::max<uint64_t>(region.size(), window) : region.size()) - 1;
+    };
+
+    const auto io_mask = region_mask(m_io, window(IO_BEGIN, ROM_BEGIN));
+    const auto rom_mask = region_mask(m_rom, window(ROM_BEGIN, SPMT_BEGIN));
+    m_spmt_mask = region_mask(m_spmt, window(SPMT_BEGIN, SPM2_BEGIN));
+    m_spm2_mask = region_mask(m_spm2, window(SPM2_BEGIN, WRAM_BEGIN));
+    m_wram_mask = region_mask(m_wram, window(WRAM_BEGIN, PAGE_COUNT << PAGE_SHIFT));
+
+    // highest address bit set selects the region
+    constexpr auto read_write = AxPage::READ | AxPage::WRITE;
+    m_pages.resize(PAGE_COUNT);
+    map_pages(SPM1_BEGIN, IO_BEGIN, nullptr, AxCore::SPM_SIZE - 1, read_write | AxPage::SPM);
+    map_pages(IO_BEGIN, ROM_BEGIN, m_io.data(), io_mask, read_write);
+    map_pages(ROM_BEGIN, SPMT_BEGIN, m_rom.data(), rom_mask, AxPage::READ);
+    map_pages(SPMT_BEGIN, SPM2_BEGIN, m_spmt.data(), m_spmt_mask, read_write);
+    map_pages(SPM2_BEGIN, WRAM_BEGIN, m_spm2.data(), m_spm2_mask, read_write);
+    map_pages(WRAM_BEGIN, PAGE_COUNT << PAGE_SHIFT, m_wram.data(), m_wram_mask, read_write);
+    m_code_owners = std::make_unique<uint64_t[]>((m_wram_mask >> CODE_SHIFT) + 1);
+
+    if(guarded)
+    {
+        const std::pair<const AxMemoryRegion*, uint64_t> regions[] = {
+            {&m_io, IO_BEGIN}, {&m_rom, ROM_BEGIN}, {&m_spmt, SPMT_BEGIN}, {&m_spm2, SPM2_BEGIN}, {&m_wram, WRAM_BEGIN}};
+
+        for(auto [region, begin] : regions)
+        {
+            if(region->data())
+            {
+                ax_add_guarded_range(region->data(), region->reserved_size(), begin);
+            }
+        }
+    }
+}
+
+AxMemory::~AxMemory()
+{
+    if(m_guarded)
+    {
+        for(const auto* region : {&m_io, &m_rom, &m_spmt, &m_spm2, &m_wram})
+        {
+            if(region->data())
+            {
+                ax_remove_guarded_range(region->data());
+            }
+        }
+    }
 }
 
 void* AxMemory::map(AxCore& core, uint64_t addr) noexcept
 {
-    uint8_t* base{};
-    uint64_t mask{};
-    if(addr & WRAM_BEGIN)
+    const auto& entry = page(addr);
+    uint8_t* const host = (entry.flags & AxPage::SPM) ? core.smp_data() : entry.host;
+
+    return host + (addr & entry.mask);
+}
+
+uint64_t AxMemory::region_size(uint64_t addr) const noexcept
+{
+    switch(region_index(addr))
+    {
+    case 0:
+        return AxCore::SPM_SIZE;
+    case 1:
+        return m_io.size();
+    case 2:
+        return m_rom.size();
+    case 3:
+        return m_spmt.size();
+    case 4:
+        return m_spm2.size();
+    default:
+        return m_wram.size();
+    }
+}
+
+uint64_t AxMemory::contiguous_size(uint64_t addr) const noexcept
+{
+    const auto index = region_index(addr);
+    const auto& entry = page(addr);
+    const auto begin = index == 0 ? 0 : 1ull << (26 + index); // see region_index
+    const auto offset = entry.guest - begin + (addr & entry.mask); // in the region, not in the page
+    const auto size = region_size(addr);
+
+    return offset < size ? size - offset : 0;
+}
+
+void AxMemory::snapshot()
+{
+    for(auto* region : {&m_io, &m_rom, &m_spmt, &m_spm2, &m_wram})
     {
-        base = reinterpret_cast<uint8_t*>(m_wram.data());
-        mask = m_wram_mask;
+        region->snapshot();
     }
-    else if(addr & SPM2_BEGIN)
+
+    m_has_snapshot = true;
+}
+
+void AxMemory::restore()
+{
+    for(auto* region : {&m_io, &m_rom, &m_spmt, &m_spm2, &m_wram})
     {
-        base = reinterpret_cast<uint8_t*>(m_spm2.data());
-        mask = m_spm2_mask; // Max 16 Mio
+        region->restore();
     }
-    else if(addr & SPMT_BEGIN)
+}
+
+void AxMemory::drop_snapshot() noexcept
+{
+    for(auto* region : {&m_io, &m_rom, &m_spmt, &m_spm2, &m_wram})
     {
-        base = reinterpret_cast<uint8_t*>(m_spmt.data());
-        mask = m_spmt_mask; // Max 16 Mio
+        region->drop_snapshot();
     }
-    else if(addr & ROM_BEGIN)
+
+    m_has_snapshot = false;
+}
+
+void AxMemory::set_dirty_tracking(bool enabled)
+{
+    if(!enabled)
     {
-        base = reinterpret_cast<uint8_t*>(m_rom.data());
-        mask = 0xFFFFFF; // Max 16 Mio
+        m_dirty.reset();
     }
-    else if(addr & IO_BEGIN)
+    else if(!m_dirty)
     {
-        base = reinterpret_cast<uint8_t*>(m_io.data());
-        mask = 0x7FFFF; // Max 512 Kio
+        m_dirty = std::make_unique<uint64_t[]>(DIRTY_PAGE_COUNT / 64);
     }
-    else // SPM
+}
+
+void AxMemory::clear_dirty() noexcept
+{
+    if(m_dirty)
     {
-        base = core.smp_data();
-        mask = 0x3FFF; // Max 16 Kio
+        std::memset(m_dirty.get(), 0, DIRTY_PAGE_COUNT / 8);
     }
+}
+
+void AxMemory::map_device(uint64_t addr, uint64_t size, AxDevice* device)
+{
+    ax_check(addr >= IO_BEGIN && addr + size <= IO_BEGIN + IO_SIZE && size != 0, "Devices must be mapped inside the IO region.");
+    ax_check((addr | size) % PAGE_SIZE == 0, "Devices must be mapped on whole pages.");
 
-    const auto offset = addr & mask;
-    return base + offset;
-}
\ No newline at end of file
+    for(auto index = IO_BEGIN >> PAGE_SHIFT; index < (ROM_BEGIN >> PAGE_SHIFT); ++index)
+    {
+        auto& entry = m_pages[index];
+        if(entry.guest >= addr && entry.guest < addr + size)
+        {
+            entry.flags = static_cast<uint8_t>(device ? (entry.flags | AxPage::IO) : (entry.flags & ~AxPage::IO));
+            entry.device_base = device ? static_cast<uint32_t>(addr) : 0;
+            entry.device = device;
+        }
+    }
+}
+
+void AxMemory::map_pages(uint64_t begin, uint64_t end, uint8_t* base, uint64_t mask, uint8_t flags) noexcept
+{
+    for(auto index = begin >> PAGE_SHIFT; index < (end >> PAGE_SHIFT); ++index)
+    {
+        // offsets are (address & mask) like the whole region mask, even for sizes that are not powers of two:
+        // bits above the page select the page, the other ones are masked in it. Small regions are mirrored in each page.
+        auto& entry = m_pages[index];
+        entry.host = base + ((index << PAGE_SHIFT) & mask);
+        entry.guest = static_cast<uint32_t>(begin + ((index << PAGE_SHIFT) & mask));
+        entry.mask = static_cast<uint32_t>(mask & (PAGE_SIZE - 1));
+        entry.flags = flags;
+    }
+}
@@ -4,11 +4,46 @@
 #ifndef AXMEMORY_HPP_INCLUDED
 #define AXMEMORY_HPP_INCLUDED
 
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cstdint>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "region.hpp"
+
 class AxCore;
+class AxDevice;
+
+// One guest page of the memory map: host = host + (guest address & mask)
+// Mirrors of a region share their host and guest addresses.
+struct AxPage
+{
+    static constexpr uint8_t READ = 0x01;
+    static constexpr uint8_t WRITE = 0x02;
+    static constexpr uint8_t SPM = 0x04; // core scratchpad, host is AxCore::smp_data() of the accessing core
+    static constexpr uint8_t IO = 0x08; // accesses of cores go to device, see AxMemory::map_device
+
+    uint8_t* host{};  // host address of the first byte of the page
+    uint32_t guest{}; // guest address of host, first mirror of the page
+    uint32_t mask{};  // PAGE_SIZE - 1, or less if the region size is not a multiple of PAGE_SIZE (it is mirrored)
+    uint8_t flags{};  // permissions are not checked yet
+    uint32_t device_base{}; // guest address the device is mapped at
+    AxDevice* device{};
+};
+
+// Regions to back with huge pages, see AxMemoryRegion
+enum class AxHugePages
+{
+    NONE = 0,
+    WRAM = 1,
+    WRAM_SPM2 = 2,
+};
 
 class AxMemory
 {
@@ -20,24 +55,72 @@ public:
     static constexpr uint64_t SPM2_BEGIN = 0x4000'0000ull;
     static constexpr uint64_t WRAM_BEGIN = 0x8000'0000ull;
 
+    // Regions of the memory map, in address order. Each one begins at twice the previous one,
+    // so the index of a region is the bit width of the 5 top bits of the address.
+    static constexpr std::size_t REGION_COUNT = 6;
+    static constexpr std::array<std::string_view, REGION_COUNT> REGION_NAMES{"SPM1", "IO", "ROM", "SPMT", "SPM2", "WRAM"};
+
+    static constexpr std::size_t region_index(uint64_t addr) noexcept
+    {
+        return static_cast<std::size_t>(std::bit_width(static_cast<uint32_t>(addr) >> 27));
+    }
+
     static constexpr size_t IO_SIZE = 512ull * 1024ull;  // 512 Kio
     static constexpr size_t ROM_SIZE = 16ull * 1024ull * 1024ull; // 16 Mio
 
+    // Guest addresses are 32-bit, split in 64 Kio pages
+    static constexpr uint64_t PAGE_SHIFT = 16;
+    static constexpr uint64_t PAGE_SIZE = 1ull << PAGE_SHIFT;
+    static constexpr uint64_t PAGE_COUNT = 1ull << (32 - PAGE_SHIFT);
+
+    // Dirty pages are tracked with a finer granularity than the memory map
+    static constexpr uint64_t DIRTY_SHIFT = 12;
+    static constexpr uint64_t DIRTY_PAGE_SIZE = 1ull << DIRTY_SHIFT;
+    static constexpr uint64_t DIRTY_PAGE_COUNT = 1ull << (32 - DIRTY_SHIFT);
+
+    // Decode caches of all cores record which WRAM pages they decoded code from (see AxDecodeCache),
+    // one bit per cache, the last bit is shared by all caches after the 63 first ones.
+    static constexpr uint64_t CODE_SHIFT = 12;
+    static constexpr uint64_t SHARED_CODE_OWNER = 1ull << 63;
+    // Code writes kept for cores that did not see them yet, older ones invalidate all WRAM
+    static constexpr std::size_t CODE_WRITE_COUNT = 64;
+
     // nwram: wram size in Mio
     // nspmt: spm thread size in kio
     // nspm2: spm L2 size in kio
-    AxMemory(size_t nwram, size_t nspmt, size_t nspm2);
-    ~AxMemory() = default;
+    // huge_pages: regions to back with huge pages if the host has them (check wram_backing and spm2_backing)
+    // guarded: regions are not mirrored, addresses past their end are guard pages (POSIX hosts only).
+    //   Accesses to guard pages during AxCore::run_for/run_until stop the core with a memory fault (see fault.hpp).
+    //   SPM1 is still mirrored as it is owned by each core.
+    AxMemory(size_t nwram, size_t nspmt, size_t nspm2, AxHugePages huge_pages = AxHugePages::NONE, bool guarded = false);
+    ~AxMemory();
     AxMemory(const AxMemory&) = delete;
     AxMemory& operator=(const AxMemory&) = delete;
     AxMemory(AxMemory&&) noexcept = delete;
     AxMemory& operator=(AxMemory&&) noexcept = delete;
 
-    void* map(AxCore& core, uint64_t offset) noexcept;
+    // Page containing guest address addr
+    const AxPage& page(uint64_t addr) const noexcept
+    {
+        return m_pages[(addr >> PAGE_SHIFT) & (PAGE_COUNT - 1)];
+    }
+
+    // Forward loads and stores of cores to [addr, addr + size) to device, or to the IO buffer again if device is nullptr.
+    // The range must be page aligned and inside the IO region, it is mapped in all mirrors.
+    // Devices are not owned and must outlive the memory or be unmapped. Cores must flush their TLB (see AxCore::flush_tlb).
+    // Only loads and stores of cores reach devices: map(), load() and store() access the IO buffer.
+    void map_device(uint64_t addr, uint64_t size, AxDevice* device);
+
+    // Host address of guest address addr, for given core.
+    // Cores cache pages in their TLB, this is a full page table lookup.
+    void* map(AxCore& core, uint64_t addr) noexcept;
 
     void store(AxCore& core, const void* src, uint64_t addr, uint32_t size) noexcept
     {
         std::memcpy(map(core, addr), src, size);
+
+        const auto& entry = page(addr);
+        mark_dirty(entry.guest + (addr & entry.mask), size);
     }
 
     void load(AxCore& core, void* dest, uint64_t offset, uint32_t size) noexcept
@@ -59,27 +142,210 @@ public:
         store(core, &val, offset, sizeof(T));
     }
 
+    // Bytes backing the region of guest address addr, see region_index
+    uint64_t region_size(uint64_t addr) const noexcept;
+
+    // Bytes from guest address addr to the end of the memory backing its region, 0 if addr is in a guard page.
+    // [map(addr), map(addr) + size) is contiguous host memory if size is not more than this.
+    uint64_t contiguous_size(uint64_t addr) const noexcept;
+
     uint64_t wram_size() const noexcept
     {
-        return m_wram.size();
+        return m_wram.size() / 8;
     }
 
     uint64_t wram_bytesize() const noexcept
     {
-        return m_wram.size() * 8;
+        return m_wram.size();
+    }
+
+    // WRAM offsets are (address & wram_mask()), the mask covers guard pages if the memory is guarded
+    uint64_t wram_mask() const noexcept
+    {
+        return m_wram_mask;
+    }
+
+    bool guarded() const noexcept
+    {
+        return m_guarded;
+    }
+
+    AxPageBacking wram_backing() const noexcept
+    {
+        return m_wram.backing();
+    }
+
+    AxPageBacking spm2_backing() const noexcept
+    {
+        return m_spm2.backing();
+    }
+
+    // Save content of all regions, see AxSnapshot
+    void snapshot();
+    void restore();
+    void drop_snapshot() noexcept;
+
+    bool has_snapshot() const noexcept
+    {
+        return m_has_snapshot;
+    }
+
+    // Dirty page tracking, disabled by default.
+    // Pages are marked by stores of cores, store() and AxCore::invalidate_code, by their first mirror address.
+    // Writes through map() pointers are not tracked. SPM1 pages are marked when any core writes its own scratchpad.
+    void set_dirty_tracking(bool enabled);
+
+    bool dirty_tracking() const noexcept
+    {
+        return m_dirty != nullptr;
+    }
+
+    // addr must be the first mirror address (see AxPage::guest)
+    void mark_dirty(uint64_t addr, uint64_t size) noexcept
+    {
+        if(m_dirty) [[unlikely]]
+        {
+            const auto last = (addr + size - 1) >> DIRTY_SHIFT;
+            for(auto index = addr >> DIRTY_SHIFT; index <= last; ++index)
+            {
+                // cores may run on different threads, only pay for the atomic the first time
+                const auto page = index & (DIRTY_PAGE_COUNT - 1);
+                const auto bit = 1ull << (page & 63);
+                std::atomic_ref<uint64_t> word{m_dirty[page >> 6]};
+                if(!(word.load(std::memory_order_relaxed) & bit))
+                {
+                    word.fetch_or(bit, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    bool is_dirty(uint64_t addr) const noexcept
+    {
+        const auto page = (addr >> DIRTY_SHIFT) & (DIRTY_PAGE_COUNT - 1);
+        return m_dirty && (std::atomic_ref<uint64_t>{m_dirty[page >> 6]}.load(std::memory_order_relaxed) & (1ull << (page & 63)));
+    }
+
+    void clear_dirty() noexcept;
+
+    // Call func(addr, size) for each range of consecutive dirty pages, in ascending address order
+    template<typename Func>
+    void for_each_dirty_range(Func&& func) const
+    {
+        if(!m_dirty)
+        {
+            return;
+        }
+
+        uint64_t begin = 0;
+        uint64_t count = 0;
+        for(uint64_t word = 0; word < DIRTY_PAGE_COUNT / 64; ++word)
+        {
+            auto bits = m_dirty[word];
+            if(bits == 0 && count == 0)
+            {
+                continue;
+            }
+
+            for(uint64_t bit = 0; bit < 64; ++bit, bits >>= 1)
+            {
+                if(bits & 1)
+                {
+                    begin = count == 0 ? word * 64 + bit : begin;
+                    ++count;
+                }
+                else if(count != 0)
+                {
+                    func(begin << DIRTY_SHIFT, count << DIRTY_SHIFT);
+                    count = 0;
+                }
+            }
+        }
+
+        if(count != 0)
+        {
+            func(begin << DIRTY_SHIFT, count << DIRTY_SHIFT);
+        }
+    }
+
+    // One word per WRAM page of (1 << CODE_SHIFT) bytes, of the bits of the caches that decoded code from it.
+    // Bits are set with atomic operations, see AxDecodeCache.
+    uint64_t* code_owners() noexcept
+    {
+        return m_code_owners.get();
+    }
+
+    // Bit of a new decode cache in code_owners()
+    uint64_t add_code_owner() noexcept
+    {
+        const auto index = m_code_owner_count.fetch_add(1, std::memory_order_relaxed);
+        return index < 63 ? 1ull << index : SHARED_CODE_OWNER;
+    }
+
+    // Make decode caches of all cores drop code decoded from WRAM bytes [offset; offset + size).
+    // Called by cores once the bytes are written, other cores see it at their next block (see AxCore::sync_code).
+    // Returns the new code generation.
+    uint64_t publish_code_write(uint64_t offset, uint64_t size) noexcept
+    {
+        std::lock_guard lock{m_code_mutex};
+        const auto generation = m_code_generation.load(std::memory_order_relaxed);
+        m_code_writes[generation % CODE_WRITE_COUNT] = {offset, size};
+        m_code_generation.store(generation + 1, std::memory_order_release);
+
+        return generation + 1;
+    }
+
+    // Incremented by each publish_code_write, native code also checks it (see AxLLVMJit)
+    const std::atomic<uint64_t>& code_generation() const noexcept
+    {
+        return m_code_generation;
+    }
+
+    // Call func(offset, size) for each code write published after generation, returns the current generation
+    template<typename Func>
+    uint64_t for_each_code_write(uint64_t generation, Func&& func)
+    {
+        std::lock_guard lock{m_code_mutex};
+        const auto current = m_code_generation.load(std::memory_order_relaxed);
+        if(current - generation > CODE_WRITE_COUNT)
+        {
+            func(0, m_wram_mask + 1);
+            return current;
+        }
+
+        for(; generation != current; ++generation)
+        {
+            const auto [offset, size] = m_code_writes[generation % CODE_WRITE_COUNT];
+            func(offset, size);
+        }
+
+        return current;
     }
 
 private:
-    // stored as uint64_t to enforce alignment!
-    std::vector<uint64_t> m_io;
-    std::vector<uint64_t> m_rom;
-    std::vector<uint64_t> m_spmt;
-    std::vector<uint64_t> m_spm2;
-    std::vector<uint64_t> m_wram;
+    void map_pages(uint64_t begin, uint64_t end, uint8_t* base, uint64_t mask, uint8_t flags) noexcept;
+
+    // committed on first touch
+    AxMemoryRegion m_io;
+    AxMemoryRegion m_rom;
+    AxMemoryRegion m_spmt;
+    AxMemoryRegion m_spm2;
+    AxMemoryRegion m_wram;
 
     uint64_t m_spmt_mask = 0;
     uint64_t m_spm2_mask = 0;
     uint64_t m_wram_mask = 0;
+
+    std::vector<AxPage> m_pages;
+    bool m_guarded{};
+    bool m_has_snapshot{};
+    std::unique_ptr<uint64_t[]> m_dirty{}; // one bit per dirty page
+
+    std::unique_ptr<uint64_t[]> m_code_owners{};
+    std::atomic<uint64_t> m_code_owner_count{};
+    std::mutex m_code_mutex{};
+    std::array<std::pair<uint64_t, uint64_t>, CODE_WRITE_COUNT> m_code_writes{};
+    std::atomic<uint64_t> m_code_generation{};
 };
 
 #endif
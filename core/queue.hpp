@@ -0,0 +1,98 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXQUEUE_HPP_INCLUDED
+#define AXQUEUE_HPP_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue, any number of threads may push, only one thread may pop.
+// Each cell has a sequence number telling if it is free for the producer of a position
+// or ready for the consumer, producers only contend on the tail index.
+template<typename T, std::size_t Capacity>
+class AxMpscQueue
+{
+    static_assert(std::has_single_bit(Capacity), "Queue capacity must be a power of two.");
+
+public:
+    AxMpscQueue() noexcept
+    {
+        for(std::size_t i = 0; i < Capacity; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~AxMpscQueue() = default;
+    AxMpscQueue(const AxMpscQueue&) = delete;
+    AxMpscQueue& operator=(const AxMpscQueue&) = delete;
+    AxMpscQueue(AxMpscQueue&&) noexcept = delete;
+    AxMpscQueue& operator=(AxMpscQueue&&) noexcept = delete;
+
+    // Returns false if the queue is full
+    bool push(const T& value) noexcept
+    {
+        auto position = m_tail.load(std::memory_order_relaxed);
+        while(true)
+        {
+            auto& cell = m_cells[position & (Capacity - 1)];
+            const auto sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if(difference == 0)
+            {
+                if(m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(difference < 0) // cell not popped yet
+            {
+                return false;
+            }
+            else // another producer took the position
+            {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer thread only, returns false if the queue is empty
+    bool pop(T& value) noexcept
+    {
+        auto& cell = m_cells[m_head & (Capacity - 1)];
+        if(cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+        {
+            return false;
+        }
+
+        value = cell.value;
+        cell.sequence.store(m_head + Capacity, std::memory_order_release);
+        ++m_head;
+        return true;
+    }
+
+    // Consumer thread only, pushes in progress are counted
+    std::size_t size() const noexcept
+    {
+        return static_cast<std::size_t>(m_tail.load(std::memory_order_acquire) - m_head);
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence{};
+        T value{};
+    };
+
+    std::array<Cell, Capacity> m_cells{};
+    alignas(64) std::atomic<std::size_t> m_tail{};
+    alignas(64) std::size_t m_head{};
+};
+
+#endif
@@ -0,0 +1,301 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "region.hpp"
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    #define AX_REGION_MEMFD 1
+#endif
+
+#include <cstring>
+
+#include "panic.hpp"
+
+namespace
+{
+
+std::size_t align_up(std::size_t value, std::size_t alignment) noexcept
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+#ifdef AX_REGION_MEMFD
+constexpr std::size_t SNAPSHOT_PAGE_SIZE = 4096;
+
+bool is_zero(const uint8_t* page) noexcept
+{
+    static constexpr uint8_t zeros[SNAPSHOT_PAGE_SIZE]{};
+    return std::memcmp(page, zeros, SNAPSHOT_PAGE_SIZE) == 0;
+}
+#endif
+
+}
+
+AxMemoryRegion::AxMemoryRegion(std::size_t size, bool huge_pages, std::size_t reserved_size)
+    : m_size{size}
+    , m_mapped_size{size}
+{
+    if(size == 0)
+    {
+        return;
+    }
+
+    if(reserved_size > size)
+    {
+        ax_check(reserve(reserved_size), "Failed to reserve ", reserved_size, " bytes of address space.");
+    }
+
+    if(huge_pages && map_huge_pages())
+    {
+        return;
+    }
+
+    map_pages(huge_pages);
+}
+
+AxMemoryRegion::~AxMemoryRegion()
+{
+    drop_snapshot();
+
+    if(!m_data)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+    if(m_reserved)
+    {
+        munmap(m_reserved, m_reserved_size + HUGE_PAGE_SIZE);
+    }
+    else
+    {
+        munmap(m_data, m_mapped_size);
+    }
+#endif
+}
+
+bool AxMemoryRegion::reserve(std::size_t reserved_size) noexcept
+{
+#ifdef _WIN32
+    static_cast<void>(reserved_size);
+    return false;
+#else
+    // one more huge page so the region can be aligned on it
+    const auto size = align_up(reserved_size, HUGE_PAGE_SIZE);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    #ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+    #endif
+
+    void* data = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_NONE, flags, -1, 0);
+    if(data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_reserved = static_cast<uint8_t*>(data);
+    m_reserved_size = size;
+    return true;
+#endif
+}
+
+bool AxMemoryRegion::map_huge_pages() noexcept
+{
+#if defined(_WIN32)
+    const auto page_size = GetLargePageMinimum();
+    if(page_size == 0)
+    {
+        return false;
+    }
+
+    // requires SeLockMemoryPrivilege, fails otherwise
+    const auto mapped_size = align_up(m_size, page_size);
+    void* data = VirtualAlloc(nullptr, mapped_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if(!data)
+    {
+        return false;
+    }
+
+    m_data = static_cast<uint8_t*>(data);
+    m_mapped_size = mapped_size;
+    m_backing = AxPageBacking::HUGE;
+    return true;
+#elif defined(MAP_HUGETLB)
+    // no MAP_NORESERVE: if the huge page pool is too small, fail now instead of SIGBUS on first touch
+    const auto mapped_size = align_up(m_size, HUGE_PAGE_SIZE);
+    void* const hint = m_reserved ? reinterpret_cast<void*>(align_up(reinterpret_cast<std::size_t>(m_reserved), HUGE_PAGE_SIZE)) : nullptr;
+    const int fixed = m_reserved ? MAP_FIXED : 0;
+    void* data = mmap(hint, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | fixed, -1, 0);
+    if(data == MAP_FAILED)
+    {
+        if(m_reserved) // a failed MAP_FIXED may unmap the range, reserve it again
+        {
+            mmap(hint, mapped_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        }
+
+        return false;
+    }
+
+    m_data = static_cast<uint8_t*>(data);
+    m_mapped_size = mapped_size;
+    m_backing = AxPageBacking::HUGE;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AxMemoryRegion::map_pages(bool transparent_huge_pages)
+{
+#ifdef _WIN32
+    static_cast<void>(transparent_huge_pages);
+
+    void* data = VirtualAlloc(nullptr, m_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    ax_check(data != nullptr, "Failed to allocate ", m_size, " bytes of guest memory.");
+    m_data = static_cast<uint8_t*>(data);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    #ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE; // don't account swap for pages the guest never touches
+    #endif
+
+    if(m_reserved)
+    {
+        // reserved range is big enough for any alignment
+        auto* const aligned = reinterpret_cast<uint8_t*>(align_up(reinterpret_cast<std::size_t>(m_reserved), HUGE_PAGE_SIZE));
+        m_mapped_size = transparent_huge_pages ? align_up(m_size, HUGE_PAGE_SIZE) : m_size;
+        void* data = mmap(aligned, m_mapped_size, PROT_READ | PROT_WRITE, flags | MAP_FIXED, -1, 0);
+        ax_check(data != MAP_FAILED, "Failed to allocate ", m_size, " bytes of guest memory.");
+        m_data = aligned;
+    #ifdef MADV_HUGEPAGE
+        if(transparent_huge_pages && madvise(m_data, m_mapped_size, MADV_HUGEPAGE) == 0)
+        {
+            m_backing = AxPageBacking::TRANSPARENT;
+        }
+    #endif
+        return;
+    }
+
+    #ifdef MADV_HUGEPAGE
+    if(transparent_huge_pages)
+    {
+        // reserve one more huge page so the region can be aligned on it, the kernel can't use huge pages otherwise
+        const auto mapped_size = align_up(m_size, HUGE_PAGE_SIZE);
+        const auto reserved_size = mapped_size + HUGE_PAGE_SIZE;
+        void* reserved = mmap(nullptr, reserved_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        ax_check(reserved != MAP_FAILED, "Failed to allocate ", m_size, " bytes of guest memory.");
+
+        auto* const begin = static_cast<uint8_t*>(reserved);
+        auto* const aligned = reinterpret_cast<uint8_t*>(align_up(reinterpret_cast<std::size_t>(begin), HUGE_PAGE_SIZE));
+        if(aligned != begin)
+        {
+            munmap(begin, static_cast<std::size_t>(aligned - begin));
+        }
+
+        munmap(aligned + mapped_size, static_cast<std::size_t>(begin + reserved_size - (aligned + mapped_size)));
+
+        m_data = aligned;
+        m_mapped_size = mapped_size;
+        if(madvise(m_data, m_mapped_size, MADV_HUGEPAGE) == 0)
+        {
+            m_backing = AxPageBacking::TRANSPARENT;
+        }
+
+        return;
+    }
+    #else
+    static_cast<void>(transparent_huge_pages);
+    #endif
+
+    void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    ax_check(data != MAP_FAILED, "Failed to allocate ", m_size, " bytes of guest memory.");
+    m_data = static_cast<uint8_t*>(data);
+#endif
+}
+
+void AxMemoryRegion::snapshot()
+{
+    if(!m_data)
+    {
+        return;
+    }
+
+#ifdef AX_REGION_MEMFD
+    if(m_backing != AxPageBacking::HUGE)
+    {
+        const int fd = memfd_create("altairx-snapshot", MFD_CLOEXEC);
+        ax_check(fd >= 0, "Failed to create snapshot file.");
+        if(ftruncate(fd, static_cast<off_t>(m_mapped_size)) != 0)
+        {
+            close(fd);
+            ax_panic("Failed to create snapshot file.");
+        }
+
+        // only write pages the guest used, so the file stays sparse
+        for(std::size_t offset = 0; offset < m_mapped_size; offset += SNAPSHOT_PAGE_SIZE)
+        {
+            if(!is_zero(m_data + offset) && pwrite(fd, m_data + offset, SNAPSHOT_PAGE_SIZE, static_cast<off_t>(offset)) != SNAPSHOT_PAGE_SIZE)
+            {
+                close(fd);
+                ax_panic("Failed to write snapshot file.");
+            }
+        }
+
+        drop_snapshot();
+        m_snapshot_fd = fd;
+        restore();
+        return;
+    }
+#endif
+
+    m_snapshot.assign(m_data, m_data + m_size);
+}
+
+void AxMemoryRegion::restore()
+{
+#ifdef AX_REGION_MEMFD
+    if(m_snapshot_fd >= 0)
+    {
+        // replace the mapping in place, private pages written since the snapshot are dropped
+        void* data = mmap(m_data, m_mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, m_snapshot_fd, 0);
+        ax_check(data == m_data, "Failed to restore snapshot.");
+    #ifdef MADV_HUGEPAGE
+        if(m_backing == AxPageBacking::TRANSPARENT)
+        {
+            madvise(m_data, m_mapped_size, MADV_HUGEPAGE);
+        }
+    #endif
+        return;
+    }
+#endif
+
+    if(!m_snapshot.empty())
+    {
+        std::memcpy(m_data, m_snapshot.data(), m_size);
+    }
+}
+
+void AxMemoryRegion::drop_snapshot() noexcept
+{
+#ifdef AX_REGION_MEMFD
+    if(m_snapshot_fd >= 0)
+    {
+        close(m_snapshot_fd); // current mapping keeps the file alive
+        m_snapshot_fd = -1;
+    }
+#endif
+
+    m_snapshot.clear();
+    m_snapshot.shrink_to_fit();
+}
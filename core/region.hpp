@@ -0,0 +1,84 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXREGION_HPP_INCLUDED
+#define AXREGION_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Host pages backing a region
+enum class AxPageBacking
+{
+    REGULAR = 0,     // host default page size
+    TRANSPARENT = 1, // transparent huge pages requested with madvise, the kernel uses them when it can
+    HUGE = 2,        // explicit huge pages (MAP_HUGETLB or MEM_LARGE_PAGES), reserved up front
+};
+
+// Zero-initialized host memory backing a guest memory region.
+// Pages are only reserved (mmap with MAP_NORESERVE, or VirtualAlloc), the host commits them on first touch,
+// so a large region costs neither startup time nor RSS until the guest uses it.
+class AxMemoryRegion
+{
+public:
+    static constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // size in bytes, a region of size 0 has no storage.
+    // If huge_pages is true, explicit huge pages are tried first, then transparent huge pages,
+    // then regular pages. See backing() for the result.
+    // If reserved_size is greater than size, the region is placed at the beginning of a reserved address range
+    // of that size, the rest is left inaccessible (PROT_NONE) so any access past the end faults. POSIX hosts only.
+    explicit AxMemoryRegion(std::size_t size, bool huge_pages = false, std::size_t reserved_size = 0);
+    ~AxMemoryRegion();
+    AxMemoryRegion(const AxMemoryRegion&) = delete;
+    AxMemoryRegion& operator=(const AxMemoryRegion&) = delete;
+    AxMemoryRegion(AxMemoryRegion&&) noexcept = delete;
+    AxMemoryRegion& operator=(AxMemoryRegion&&) noexcept = delete;
+
+    // Page aligned
+    uint8_t* data() const noexcept
+    {
+        return m_data;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    // Size of the reserved address range, starting at data(), if reserved_size was given
+    std::size_t reserved_size() const noexcept
+    {
+        return m_reserved ? m_reserved_size : m_mapped_size;
+    }
+
+    AxPageBacking backing() const noexcept
+    {
+        return m_backing;
+    }
+
+    // Save current content, restore() brings it back.
+    // On Linux the content is saved in a memfd the region is then privately mapped from,
+    // so restore() only drops the pages written since, other hosts (and explicit huge pages) keep a copy.
+    void snapshot();
+    void restore();
+    // Release saved content, the region keeps its current content
+    void drop_snapshot() noexcept;
+
+private:
+    bool reserve(std::size_t reserved_size) noexcept;
+    bool map_huge_pages() noexcept;
+    void map_pages(bool transparent_huge_pages);
+
+    uint8_t* m_data{};
+    std::size_t m_size{};
+    std::size_t m_mapped_size{}; // may be rounded to huge pages
+    uint8_t* m_reserved{};       // reserved address range, regions are mapped at its first huge page boundary
+    std::size_t m_reserved_size{};
+    AxPageBacking m_backing{};
+    int m_snapshot_fd{-1};
+    std::vector<uint8_t> m_snapshot{};
+};
+
+#endif
@@ -0,0 +1,51 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "snapshot.hpp"
+
+#include "memory.hpp"
+
+AxSnapshot::AxSnapshot(AxCore& core)
+    : m_core{&core}
+    , m_regs{core.m_regs}
+    , m_spm{core.m_spm}
+    , m_interrupt_vector{core.m_interrupt_vector}
+    , m_interrupts_enabled{core.m_interrupts_enabled}
+    , m_in_interrupt{core.m_in_interrupt}
+    , m_interrupt_latched{core.m_interrupt_latched}
+    , m_attention{core.m_attention.load(std::memory_order_relaxed) & ~AxCore::ATTENTION_STOP}
+{
+    ax_check(!core.memory().has_snapshot(), "Memory already has a snapshot.");
+    core.commit_stores();
+    core.memory().snapshot();
+}
+
+AxSnapshot::~AxSnapshot()
+{
+    m_core->memory().drop_snapshot();
+}
+
+void AxSnapshot::restore()
+{
+    m_core->memory().restore();
+    m_core->m_regs = m_regs;
+    m_core->m_spm = m_spm;
+    m_core->m_syscall = 0;
+    m_core->m_error = 0;
+    m_core->m_fault_address = 0;
+    m_core->m_jit_exception = nullptr;
+    m_core->m_store_buffer.clear();
+
+    m_core->m_interrupt_vector = m_interrupt_vector;
+    m_core->m_interrupts_enabled = m_interrupts_enabled;
+    m_core->m_in_interrupt = m_in_interrupt;
+    m_core->m_interrupt_latched = m_interrupt_latched;
+    m_core->m_attention.store(m_attention, std::memory_order_relaxed);
+    m_core->m_spin_iterations = 0;
+    m_core->m_spinning = false;
+
+    // code may have been modified since, by this core or another one
+    m_core->m_decode_cache.clear();
+    m_core->publish_code_write(0, m_core->m_wram_mask + 1);
+    m_core->flush_tlb();
+}
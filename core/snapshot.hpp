@@ -0,0 +1,42 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXSNAPSHOT_HPP_INCLUDED
+#define AXSNAPSHOT_HPP_INCLUDED
+
+#include <array>
+#include <cstdint>
+
+#include "core.hpp"
+
+// State of a core and its memory, to quickly run the same loaded program many times.
+// Memory is restored copy-on-write (see AxMemoryRegion::snapshot), in time proportional to the pages written since.
+// Only one snapshot of a given AxMemory may be alive at a time. Other cores of the memory are not saved,
+// they only drop the code they decoded when it is restored. Buffered stores are committed first (see AxCore::set_store_buffering).
+// Devices state is not saved.
+class AxSnapshot
+{
+public:
+    explicit AxSnapshot(AxCore& core);
+    ~AxSnapshot();
+    AxSnapshot(const AxSnapshot&) = delete;
+    AxSnapshot& operator=(const AxSnapshot&) = delete;
+    AxSnapshot(AxSnapshot&&) noexcept = delete;
+    AxSnapshot& operator=(AxSnapshot&&) noexcept = delete;
+
+    // Put the core and its memory back in the saved state: registers, interrupt and halt state, pending stores are dropped.
+    // Breakpoints, symbols and options are kept.
+    void restore();
+
+private:
+    AxCore* m_core{};
+    AxCore::RegisterSet m_regs{};
+    std::array<uint8_t, AxCore::SPM_SIZE> m_spm{};
+    uint32_t m_interrupt_vector{};
+    bool m_interrupts_enabled{};
+    bool m_in_interrupt{};
+    bool m_interrupt_latched{};
+    uint32_t m_attention{}; // halt and raised interrupts, stop requests are not saved
+};
+
+#endif
@@ -0,0 +1,60 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "store_buffer.hpp"
+
+void AxStoreBuffer::store(uint8_t* host, uint64_t guest, const void* value, std::size_t size)
+{
+    const auto* bytes = static_cast<const uint8_t*>(value);
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        const auto address = reinterpret_cast<uintptr_t>(host + i);
+        auto& granule = m_granules[address / GRANULE_SIZE];
+        const auto index = address % GRANULE_SIZE;
+        granule.bytes[index] = bytes[i];
+        granule.guest = guest + i - index;
+        granule.mask |= 1u << index;
+    }
+}
+
+void AxStoreBuffer::apply(const uint8_t* host, uint8_t* dest, std::size_t size) const noexcept
+{
+    const auto begin = reinterpret_cast<uintptr_t>(host);
+    const auto end = begin + size;
+    const auto overlay = [begin, end, dest](uintptr_t key, const Granule& granule)
+    {
+        for(uint32_t i = 0; i < GRANULE_SIZE; ++i)
+        {
+            const auto address = key * GRANULE_SIZE + i;
+            if((granule.mask & (1u << i)) && address >= begin && address < end)
+            {
+                dest[address - begin] = granule.bytes[i];
+            }
+        }
+    };
+
+    // large reads (syscall buffers) walk the pending stores instead of the range
+    const auto first = begin / GRANULE_SIZE;
+    const auto last = (end - 1) / GRANULE_SIZE;
+    if(last - first >= m_granules.size())
+    {
+        for(const auto& [key, granule] : m_granules)
+        {
+            if(key >= first && key <= last)
+            {
+                overlay(key, granule);
+            }
+        }
+
+        return;
+    }
+
+    for(auto key = first; key <= last; ++key)
+    {
+        const auto it = m_granules.find(key);
+        if(it != m_granules.end())
+        {
+            overlay(key, it->second);
+        }
+    }
+}
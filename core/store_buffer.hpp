@@ -0,0 +1,91 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXSTORE_BUFFER_HPP_INCLUDED
+#define AXSTORE_BUFFER_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+
+// Stores of a core kept out of shared memory until they are committed, see AxCore::set_store_buffering.
+// Bytes are indexed by host address, so all mirrors of a page see the same stores.
+class AxStoreBuffer
+{
+public:
+    AxStoreBuffer() = default;
+    ~AxStoreBuffer() = default;
+    AxStoreBuffer(const AxStoreBuffer&) = delete;
+    AxStoreBuffer& operator=(const AxStoreBuffer&) = delete;
+    AxStoreBuffer(AxStoreBuffer&&) noexcept = delete;
+    AxStoreBuffer& operator=(AxStoreBuffer&&) noexcept = delete;
+
+    bool empty() const noexcept
+    {
+        return m_granules.empty();
+    }
+
+    // Record size bytes of value for host, guest is the address of host in the first mirror
+    void store(uint8_t* host, uint64_t guest, const void* value, std::size_t size);
+
+    // Copy size bytes at host to dest, pending stores included
+    void read(const uint8_t* host, void* dest, std::size_t size) const noexcept
+    {
+        std::memcpy(dest, host, size);
+        if(!m_granules.empty()) [[unlikely]]
+        {
+            apply(host, static_cast<uint8_t*>(dest), size);
+        }
+    }
+
+    // Drop pending stores without writing them
+    void clear() noexcept
+    {
+        m_granules.clear();
+    }
+
+    // Write pending stores to memory and drop them.
+    // func(guest, size) is called for each written range, in no particular order.
+    template<typename Func>
+    void commit(Func&& func)
+    {
+        for(auto& [key, granule] : m_granules)
+        {
+            auto* const host = reinterpret_cast<uint8_t*>(key * GRANULE_SIZE);
+            uint32_t first = GRANULE_SIZE;
+            uint32_t last = 0;
+            for(uint32_t i = 0; i < GRANULE_SIZE; ++i)
+            {
+                if(granule.mask & (1u << i))
+                {
+                    host[i] = granule.bytes[i];
+                    first = std::min(first, i);
+                    last = i;
+                }
+            }
+
+            func(granule.guest + first, last - first + 1);
+        }
+
+        m_granules.clear();
+    }
+
+private:
+    static constexpr uint32_t GRANULE_SIZE = 8;
+
+    // Aligned host bytes, key of m_granules is the host address divided by GRANULE_SIZE
+    struct Granule
+    {
+        uint8_t bytes[GRANULE_SIZE]{};
+        uint64_t guest{}; // guest address of the first byte
+        uint32_t mask{};  // bytes that have been stored
+    };
+
+    void apply(const uint8_t* host, uint8_t* dest, std::size_t size) const noexcept;
+
+    std::unordered_map<uintptr_t, Granule> m_granules{};
+};
+
+#endif
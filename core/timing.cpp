@@ -0,0 +1,430 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "timing.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <fmt/format.h>
+
+#include "core.hpp"
+
+namespace
+{
+
+double percent(uint64_t value, uint64_t total) noexcept
+{
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(value) / static_cast<double>(total);
+}
+
+uint16_t clamp_latency(uint32_t latency) noexcept
+{
+    return static_cast<uint16_t>(std::min<uint32_t>(latency, 0xFFFF));
+}
+
+}
+
+AxTimingModel::AxTimingModel(const AxTimingConfig& config)
+    : m_config{config}
+{
+    for(uint32_t key = 0; key < AX_HANDLER_COUNT; ++key)
+    {
+        m_ops[key] = make_timing(config, key);
+    }
+}
+
+AxTimingModel::OpTiming AxTimingModel::make_timing(const AxTimingConfig& config, uint32_t key) noexcept
+{
+    const auto operation = key >> 4;
+    const auto size = (key >> 2) & 0x03u;
+    const bool has_imm = (key & 0x02u) != 0;
+    const auto slot = key & 0x01u;
+    const auto issue = (slot << 3) | (operation >> 4);
+
+    OpTiming output{};
+    if(ax_handler_key(operation, size, has_imm, slot) != key) // never generated by the decoder
+    {
+        return output;
+    }
+
+    const auto fixed = [](uint32_t resource)
+    {
+        return Operand{Field::FIXED, static_cast<uint8_t>(resource)};
+    };
+
+    const Operand gpi_a{Field::REG_A, GPI_BASE};
+    const Operand gpi_b{Field::SRC_B, GPI_BASE};
+    const Operand gpi_c{Field::SRC_C, GPI_BASE};
+    const Operand gpi_dst{Field::DST, GPI_BASE};
+    const Operand gpf_a{Field::REG_A, GPF_BASE};
+    const Operand gpf_b{Field::SRC_B, GPF_BASE};
+    const Operand gpf_c{Field::SRC_C, GPF_BASE};
+    const Operand gpf_dst{Field::DST, GPF_BASE};
+    const Operand none{};
+
+    switch(issue)
+    {
+    case 0:
+        [[fallthrough]];
+    case 1:
+        [[fallthrough]];
+    case 8:
+        [[fallthrough]];
+    case 9: // ALU, results also go to the slot's bypass
+    {
+        const auto right = has_imm ? none : gpi_c;
+        const auto bypass = fixed(GPI_BASE + AxCore::REG_BA1 + slot);
+        output.latency = clamp_latency(config.alu);
+        switch(operation)
+        {
+        case AX_EXE_ALU_MOVEIX:
+            break;
+        case AX_EXE_ALU_MOVEI:
+            output.writes = {gpi_dst, bypass};
+            break;
+        case AX_EXE_ALU_EXT:
+            output.reads = {gpi_b};
+            output.writes = {gpi_dst, bypass};
+            break;
+        case AX_EXE_ALU_INS: // ORed into A
+            output.reads = {gpi_b, gpi_a};
+            output.writes = {gpi_dst, bypass};
+            break;
+        case AX_EXE_ALU_CMP:
+            [[fallthrough]];
+        case AX_EXE_ALU_BIT:
+            [[fallthrough]];
+        case AX_EXE_ALU_TEST:
+            [[fallthrough]];
+        case AX_EXE_ALU_TESTFR:
+            output.reads = {gpi_b, right};
+            output.writes = {fixed(FR)};
+            break;
+        case AX_EXE_ALU_CMOVEN:
+            [[fallthrough]];
+        case AX_EXE_ALU_CMOVE: // A is kept if the condition is false
+            output.reads = {gpi_b, right, gpi_a};
+            output.writes = {gpi_dst, bypass};
+            break;
+        default:
+            output.reads = {gpi_b, right};
+            output.writes = {gpi_dst, bypass};
+            break;
+        }
+        break;
+    }
+    case 2:
+        [[fallthrough]];
+    case 10: // LSU, addresses are B + C or B + imm
+    {
+        const auto index = (operation & 0x08u) != 0 ? none : gpi_c;
+        switch(operation & ~0x08u)
+        {
+        case AX_EXE_LSU_LD:
+            [[fallthrough]];
+        case AX_EXE_LSU_LDS:
+            output.reads = {gpi_b, index};
+            output.writes = {gpi_dst, fixed(GPI_BASE + AxCore::REG_BL1 + slot)};
+            output.kind = Kind::LOAD;
+            break;
+        case AX_EXE_LSU_FLD:
+            output.reads = {gpi_b, index};
+            output.writes = {gpf_dst, fixed(GPF_BASE + AxCore::REG_BL1 + slot)};
+            output.kind = Kind::LOAD;
+            break;
+        case AX_EXE_LSU_ST:
+            output.reads = {gpi_b, index, gpi_a};
+            break;
+        case AX_EXE_LSU_FST:
+            output.reads = {gpi_b, index, gpf_a};
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+    case 3:
+        [[fallthrough]];
+    case 11: // FPU, size 3 are conversions of B
+    {
+        const auto bypass = fixed(GPF_BASE + AxCore::REG_BF1 + slot);
+        output.latency = clamp_latency(config.fpu);
+        output.reads = {gpf_b, size == 3 ? none : gpf_c};
+        output.writes = {gpf_dst, bypass};
+        switch(operation)
+        {
+        case AX_EXE_FPU_FNEG:
+            [[fallthrough]];
+        case AX_EXE_FPU_FABS:
+            if(size != 3)
+            {
+                output.reads = {gpf_b};
+                output.latency = clamp_latency(config.alu);
+            }
+            break;
+        case AX_EXE_FPU_FMOVE:
+            output.reads = {gpf_b};
+            output.latency = clamp_latency(config.alu);
+            break;
+        case AX_EXE_FPU_FCMOVE:
+            output.reads = {gpf_b, gpf_c, gpf_a};
+            output.latency = clamp_latency(config.alu);
+            break;
+        case AX_EXE_FPU_FCMP:
+            output.reads = {gpf_b, gpf_c};
+            output.writes = {fixed(FR)};
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+    case 5: // EFU, results go to Q
+        output.reads = {gpf_b};
+        output.writes = {fixed(EFU_Q)};
+        output.unit = UNIT_EFU;
+        switch(operation)
+        {
+        case AX_EXE_EFU_FDIV:
+            output.reads = {gpf_b, gpf_c};
+            output.latency = clamp_latency(config.efu_div);
+            break;
+        case AX_EXE_EFU_FATAN2:
+            output.reads = {gpf_b, gpf_c};
+            output.latency = clamp_latency(config.efu_transcendental);
+            break;
+        case AX_EXE_EFU_FSQRT:
+            [[fallthrough]];
+        case AX_EXE_EFU_INVSQRT:
+            output.latency = clamp_latency(config.efu_sqrt);
+            break;
+        case AX_EXE_EFU_SETEF:
+            output.reads = {gpf_a};
+            output.latency = clamp_latency(config.alu);
+            output.unit = UNIT_NONE;
+            break;
+        case AX_EXE_EFU_GETEF:
+            output.reads = {fixed(EFU_Q)};
+            output.writes = {gpf_dst};
+            output.latency = clamp_latency(config.alu);
+            output.unit = UNIT_NONE;
+            break;
+        default:
+            output.latency = clamp_latency(config.efu_transcendental);
+            break;
+        }
+        break;
+    case 6: // MDU, results go to Q, QR, PL or PH
+    {
+        const auto right = has_imm ? none : gpi_c;
+        switch(operation)
+        {
+        case AX_EXE_MDU_DIV:
+            [[fallthrough]];
+        case AX_EXE_MDU_DIVU:
+            output.reads = {gpi_b, right};
+            output.writes = {fixed(MDU_BASE), fixed(MDU_BASE + 1)};
+            output.latency = clamp_latency(config.div);
+            output.unit = UNIT_MDU;
+            break;
+        case AX_EXE_MDU_MUL:
+            [[fallthrough]];
+        case AX_EXE_MDU_MULU:
+            output.reads = {gpi_b, right};
+            output.writes = {fixed(MDU_BASE + 2)};
+            output.latency = clamp_latency(config.mul);
+            break;
+        case AX_EXE_MDU_GETMD:
+            output.reads = {Operand{Field::IMM, MDU_BASE}};
+            output.writes = {gpi_dst};
+            output.latency = clamp_latency(config.alu);
+            break;
+        case AX_EXE_MDU_SETMD:
+            output.reads = {gpi_a};
+            output.writes = {Operand{Field::IMM, MDU_BASE}};
+            output.latency = clamp_latency(config.alu);
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+    case 7: // BRU, calls write the link register
+        output.latency = clamp_latency(config.alu);
+        if(operation <= AX_EXE_BRU_BGEU)
+        {
+            output.reads = {fixed(FR)};
+            output.kind = Kind::BRANCH;
+        }
+        else if(operation == AX_EXE_BRU_BRA || operation == AX_EXE_BRU_JUMP)
+        {
+            output.kind = Kind::JUMP;
+        }
+        else if(operation == AX_EXE_BRU_CALLR || operation == AX_EXE_BRU_CALL)
+        {
+            output.writes = {fixed(GPI_BASE + 31)};
+            output.kind = Kind::JUMP;
+        }
+        else if(operation == AX_EXE_BRU_INDIRECTCALLR || operation == AX_EXE_BRU_INDIRECTCALL)
+        {
+            output.reads = {gpi_b};
+            output.writes = {gpi_dst};
+            output.kind = Kind::INDIRECT;
+        }
+        break;
+    case 13: // CU
+        if(operation == AX_EXE_CU_RETI)
+        {
+            output.kind = Kind::INDIRECT;
+        }
+        break;
+    default:
+        break;
+    }
+
+    // drop unused operands, such as C of immediate versions
+    const auto compact = [](std::array<Operand, 3>& operands)
+    {
+        const auto end = std::remove_if(operands.begin(), operands.end(), [](const Operand& operand)
+        {
+            return operand.field == Field::NONE;
+        });
+
+        std::fill(end, operands.end(), Operand{});
+        return static_cast<uint8_t>(std::distance(operands.begin(), end));
+    };
+
+    output.read_count = compact(output.reads);
+    output.write_count = compact(output.writes);
+    return output;
+}
+
+uint8_t AxTimingModel::resource(const AxDecodedOpcode& op, Operand operand) noexcept
+{
+    // indexed by Field, avoids a switch in the hot loop
+    const std::array<uint8_t, 7> fields{0, op.reg_a, op.src_b, op.src_c, op.dst, static_cast<uint8_t>(op.imm & 0x03u), 0};
+    return static_cast<uint8_t>(operand.base + fields[static_cast<std::size_t>(operand.field)]);
+}
+
+uint64_t AxTimingModel::retire(const AxDecodedBundle& bundle, uint32_t pc, uint32_t next_pc) noexcept
+{
+    const auto start = m_clock + m_fetch_stall;
+
+    // operands are read at issue, writes of this bundle are not visible to itself
+    uint64_t ready = start;
+    bool loaded = false;
+    for(uint32_t i = 0; i < bundle.op_count; ++i)
+    {
+        const auto& op = bundle.ops[i];
+        const auto& timing = m_ops[op.handler];
+        for(uint32_t j = 0; j < timing.read_count; ++j)
+        {
+            const auto entry = resource(op, timing.reads[j]);
+            if(m_ready[entry] > ready)
+            {
+                ready = m_ready[entry];
+                loaded = m_loaded[entry];
+            }
+        }
+    }
+
+    uint64_t issue = ready;
+    for(uint32_t i = 0; i < bundle.op_count; ++i)
+    {
+        issue = std::max(issue, m_unit_free[m_ops[bundle.ops[i].handler].unit]);
+    }
+
+    // a branch to itself is not taken, see AxCore::execute
+    const bool taken = next_pc != pc + bundle.size;
+    uint32_t load = 0;
+    uint32_t penalty = 0;
+    for(uint32_t i = 0; i < bundle.op_count; ++i)
+    {
+        const auto& op = bundle.ops[i];
+        const auto& timing = m_ops[op.handler];
+        const bool is_load = timing.kind == Kind::LOAD;
+        const uint64_t latency = is_load ? m_loads[load++ & 1] : timing.latency;
+        for(uint32_t j = 0; j < timing.write_count; ++j)
+        {
+            const auto entry = resource(op, timing.writes[j]);
+            m_ready[entry] = issue + latency;
+            m_loaded[entry] = is_load;
+        }
+
+        if(timing.unit != UNIT_NONE)
+        {
+            m_unit_free[timing.unit] = issue + latency;
+        }
+
+        switch(timing.kind)
+        {
+        case Kind::BRANCH:
+            if(taken != (static_cast<int64_t>(op.imm) < 0))
+            {
+                penalty = m_config.branch_mispredict;
+            }
+            else if(taken)
+            {
+                penalty = m_config.branch_taken;
+            }
+            break;
+        case Kind::JUMP:
+            penalty = m_config.branch_taken;
+            break;
+        case Kind::INDIRECT:
+            penalty = m_config.branch_mispredict;
+            break;
+        default:
+            break;
+        }
+    }
+
+    const auto previous = m_clock;
+    m_clock = issue + 1 + penalty;
+
+    m_stats.bundles += 1;
+    m_stats.cycles += m_clock - previous;
+    m_stats.fetch += m_fetch_stall;
+    (loaded ? m_stats.memory : m_stats.dependency) += ready - start;
+    m_stats.structural += issue - ready;
+    m_stats.branch += penalty;
+
+    m_fetch_stall = 0;
+    m_load_count = 0;
+    return m_clock - previous;
+}
+
+void AxTimingModel::reset() noexcept
+{
+    m_ready.fill(0);
+    m_loaded.fill(false);
+    m_unit_free.fill(0);
+    m_clock = 0;
+    m_fetch_stall = 0;
+    m_load_count = 0;
+    m_stats = AxTimingStats{};
+}
+
+void AxTimingModel::report(std::FILE* output) const
+{
+    const auto& stats = m_stats;
+    fmt::memory_buffer buffer;
+    fmt::format_to(std::back_inserter(buffer), "{} cycles, {} bundles ({:.3f} bundles per cycle)\n",
+        stats.cycles, stats.bundles, stats.cycles == 0 ? 0.0 : static_cast<double>(stats.bundles) / static_cast<double>(stats.cycles));
+
+    const std::pair<const char*, uint64_t> stalls[] = {
+        {"dependency", stats.dependency},
+        {"memory", stats.memory},
+        {"structural", stats.structural},
+        {"fetch", stats.fetch},
+        {"branch", stats.branch},
+    };
+
+    for(auto&& [name, value] : stalls)
+    {
+        fmt::format_to(std::back_inserter(buffer), "    {:<10} {:>14} stall cycles ({:.2f}%)\n", name, value, percent(value, stats.cycles));
+    }
+
+    std::fwrite(buffer.data(), 1, buffer.size(), output);
+}
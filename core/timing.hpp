@@ -0,0 +1,168 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXTIMING_HPP_INCLUDED
+#define AXTIMING_HPP_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+
+#include "decoder.hpp"
+#include "memory.hpp"
+
+// Latencies in cycles, a result with a latency of 1 can be used by the next bundle
+struct AxTimingConfig
+{
+    uint32_t alu = 1;
+    uint32_t mul = 3;
+    uint32_t div = 20; // MDU, not pipelined
+    uint32_t fpu = 3;
+    uint32_t efu_div = 12;            // EFU, not pipelined
+    uint32_t efu_sqrt = 12;           // FSQRT and INVSQRT
+    uint32_t efu_transcendental = 30; // FATAN2, FSIN, FATAN and FEXP
+    // loads, per region of the memory map (see AxMemory::REGION_NAMES)
+    std::array<uint32_t, AxMemory::REGION_COUNT> load{2, 8, 4, 4, 6, 3};
+    // added to fetches and WRAM loads that miss the cache model, if one is attached (see AxCore::set_cache_model)
+    uint32_t cache_miss = 40;
+    // static prediction: backward branches are taken, forward ones are not, indirect ones are always mispredicted
+    uint32_t branch_taken = 1;
+    uint32_t branch_mispredict = 3;
+};
+
+// Stalls are the cycles bundles spent waiting, cycles = bundles + all stalls
+struct AxTimingStats
+{
+    uint64_t bundles{};
+    uint64_t cycles{};
+    uint64_t dependency{}; // result of an earlier bundle (ALU, FPU, MDU, EFU, ...)
+    uint64_t memory{};     // result of an earlier load
+    uint64_t structural{}; // non pipelined unit still busy
+    uint64_t fetch{};      // instruction cache misses
+    uint64_t branch{};     // taken and mispredicted branches
+};
+
+// Cycle-approximate model of a core, see AxCore::set_timing_model.
+// Bundles issue in order, one per cycle, once all their operands are ready: a scoreboard keeps the cycle
+// each register (and FR, MDU and EFU registers) is written. Stores are buffered and never stall.
+class AxTimingModel
+{
+public:
+    explicit AxTimingModel(const AxTimingConfig& config = AxTimingConfig{});
+    ~AxTimingModel() = default;
+    AxTimingModel(const AxTimingModel&) = delete;
+    AxTimingModel& operator=(const AxTimingModel&) = delete;
+    AxTimingModel(AxTimingModel&&) noexcept = delete;
+    AxTimingModel& operator=(AxTimingModel&&) noexcept = delete;
+
+    // Fetch of the next bundle, hit is false if it missed the instruction cache
+    void fetch(bool hit) noexcept
+    {
+        if(!hit)
+        {
+            m_fetch_stall += m_config.cache_miss;
+        }
+    }
+
+    // Load of the next bundle, in execution order. hit is false if it missed the data cache
+    void load(uint64_t addr, bool hit) noexcept
+    {
+        const auto region = AxMemory::region_index(addr);
+        auto latency = m_config.load[region];
+        if(!hit && region == AxMemory::region_index(AxMemory::WRAM_BEGIN))
+        {
+            latency += m_config.cache_miss;
+        }
+
+        m_loads[m_load_count++ & 1] = latency;
+    }
+
+    // Account for a bundle that has just been executed at pc, next_pc is the PC after it (both in words).
+    // Returns the number of cycles it took, at least 1.
+    uint64_t retire(const AxDecodedBundle& bundle, uint32_t pc, uint32_t next_pc) noexcept;
+
+    const AxTimingConfig& config() const noexcept
+    {
+        return m_config;
+    }
+
+    const AxTimingStats& stats() const noexcept
+    {
+        return m_stats;
+    }
+
+    // Forget results in flight and clear statistics
+    void reset() noexcept;
+
+    // Write cycles, bundles per cycle and the stall breakdown
+    void report(std::FILE* output) const;
+
+private:
+    // Scoreboard entries: integer and fp registers (with REG_SINK), MDU registers, EFU Q and FR
+    static constexpr uint8_t GPI_BASE = 0;
+    static constexpr uint8_t GPF_BASE = 65;
+    static constexpr uint8_t MDU_BASE = 130;
+    static constexpr uint8_t EFU_Q = 134;
+    static constexpr uint8_t FR = 135;
+    static constexpr std::size_t RESOURCE_COUNT = 136;
+
+    // Where an operand's scoreboard entry comes from: base + field of the decoded opcode
+    enum class Field : uint8_t
+    {
+        NONE = 0,
+        REG_A,
+        SRC_B,
+        SRC_C,
+        DST,
+        IMM, // GETMD/SETMD
+        FIXED,
+    };
+
+    struct Operand
+    {
+        Field field{};
+        uint8_t base{};
+    };
+
+    enum class Kind : uint8_t
+    {
+        DEFAULT = 0,
+        LOAD,     // latency is given by load()
+        BRANCH,   // conditional, predicted with its direction
+        JUMP,     // always taken
+        INDIRECT, // target from a register, always mispredicted
+    };
+
+    // Non pipelined units, busy for the whole latency of their operations
+    static constexpr uint8_t UNIT_NONE = 0;
+    static constexpr uint8_t UNIT_MDU = 1;
+    static constexpr uint8_t UNIT_EFU = 2;
+
+    struct OpTiming
+    {
+        std::array<Operand, 3> reads{};
+        std::array<Operand, 3> writes{};
+        uint8_t read_count{};
+        uint8_t write_count{};
+        uint16_t latency{};
+        uint8_t unit{};
+        Kind kind{};
+    };
+
+    static OpTiming make_timing(const AxTimingConfig& config, uint32_t key) noexcept;
+    static uint8_t resource(const AxDecodedOpcode& op, Operand operand) noexcept;
+
+    AxTimingConfig m_config{};
+    // indexed by AxDecodedOpcode::handler
+    std::array<OpTiming, AX_HANDLER_COUNT> m_ops{};
+    std::array<uint64_t, RESOURCE_COUNT> m_ready{};
+    std::array<bool, RESOURCE_COUNT> m_loaded{}; // entry was written by a load
+    std::array<uint64_t, 3> m_unit_free{};
+    uint64_t m_clock{};
+    uint64_t m_fetch_stall{};
+    std::array<uint32_t, 2> m_loads{};
+    uint32_t m_load_count{};
+    AxTimingStats m_stats{};
+};
+
+#endif
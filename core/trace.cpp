@@ -0,0 +1,77 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <fmt/format.h>
+
+#include "core.hpp"
+
+AxTracer::AxTracer(const AxCore& core, std::FILE* output)
+    : m_core{&core}
+    , m_output{output}
+{
+    m_records.reserve(BUFFER_SIZE);
+}
+
+AxTracer::~AxTracer()
+{
+    flush();
+}
+
+void AxTracer::flush()
+{
+    const auto symbols = m_core->symbols();
+
+    fmt::memory_buffer buffer;
+    for(const auto& record : m_records)
+    {
+        auto closest = std::lower_bound(std::begin(symbols), std::end(symbols), record.pc, [](auto&& left, auto&& right)
+        {
+            return left.address < right;
+        });
+
+        if(closest != std::end(symbols) && closest != std::begin(symbols))
+        {
+            if(closest->address != record.pc)
+            {
+                closest = std::prev(closest);
+            }
+
+            if(closest->name.find("memset") != std::string::npos)
+            {
+                continue;
+            }
+
+            std::string_view name = closest->name;
+            if(name.find("_ZN19__llvm_libc_20_1_2_") != std::string_view::npos)
+            {
+                name = name.substr(25);
+            }
+
+            fmt::format_to(std::back_inserter(buffer), "{}+{} | ", name.substr(0, 64), record.pc - closest->address);
+        }
+        else // print raw PC
+        {
+            fmt::format_to(std::back_inserter(buffer), "{:>#12x} | ", record.pc);
+        }
+
+        if(record.first.is_bundle())
+        {
+            const auto [first, second] = AxOpcode::to_string(record.first, record.second);
+            fmt::format_to(std::back_inserter(buffer), "{} ; {}\n", first, second);
+        }
+        else
+        {
+            fmt::format_to(std::back_inserter(buffer), "{}\n", AxOpcode::to_string(record.first, {}).first);
+        }
+    }
+
+    m_records.clear();
+    if(buffer.size() != 0)
+    {
+        std::fwrite(buffer.data(), 1, buffer.size(), m_output);
+    }
+}
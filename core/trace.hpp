@@ -0,0 +1,92 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef AXTRACE_HPP_INCLUDED
+#define AXTRACE_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "opcode.hpp"
+#include "decoder.hpp"
+#include "panic.hpp"
+
+class AxCore;
+
+// Tracing policies of AxCore's run loop.
+// A policy provides "enabled", record(pc, bundle), called before each bundle is executed, and flush().
+// The loop is instantiated once per policy, so untraced execution does not pay for any of this.
+
+// Default policy, tracing is compiled out
+struct AxNoTrace
+{
+    static constexpr bool enabled = false;
+
+    void record(uint64_t, const AxDecodedBundle&) noexcept
+    {
+    }
+
+    void flush() noexcept
+    {
+    }
+};
+
+// One executed bundle, only formatted when the trace is flushed
+struct AxTraceRecord
+{
+    uint64_t pc{}; // in bytes
+    AxOpcode first{};
+    AxOpcode second{};
+};
+
+// Write executed bundles to a file as "symbol+offset | disassembly" lines.
+// Records are buffered and formatted by batches, symbols are resolved with AxCore::symbols() at this time.
+class AxTracer
+{
+public:
+    static constexpr bool enabled = true;
+    static constexpr std::size_t BUFFER_SIZE = 4096;
+    // more than this many noops in row is obviously a broken jump
+    static constexpr uint32_t MAX_NOOPS = 16;
+
+    AxTracer(const AxCore& core, std::FILE* output);
+    ~AxTracer();
+    AxTracer(const AxTracer&) = delete;
+    AxTracer& operator=(const AxTracer&) = delete;
+    AxTracer(AxTracer&&) noexcept = delete;
+    AxTracer& operator=(AxTracer&&) noexcept = delete;
+
+    void record(uint64_t pc, const AxDecodedBundle& bundle)
+    {
+        if(bundle.ops[0].operation == 0)
+        {
+            if(++m_noops > MAX_NOOPS)
+            {
+                flush();
+                ax_panic("Suspitious code.");
+            }
+        }
+        else
+        {
+            m_noops = 0;
+        }
+
+        m_records.push_back(AxTraceRecord{pc, bundle.ops[0].opcode, bundle.ops[1].opcode});
+        if(m_records.size() == BUFFER_SIZE)
+        {
+            flush();
+        }
+    }
+
+    // Format and write all pending records
+    void flush();
+
+private:
+    const AxCore* m_core{};
+    std::FILE* m_output{};
+    std::vector<AxTraceRecord> m_records{};
+    uint32_t m_noops{};
+};
+
+#endif
@@ -60,6 +60,7 @@ std::vector<AxSectionBounds> load_sections(const AxELFFile& elf, const AxELFSymb
             {
                 auto* wram = reinterpret_cast<char*>(memory.map(core, AxMemory::WRAM_BEGIN + section.addr));
                 std::memcpy(wram, section.content.data(), section.content.size());
+                core.invalidate_code(AxMemory::WRAM_BEGIN + section.addr, section.content.size());
             }
 
             if(section.addr <= entry_point.value && section.addr + section.size >= entry_point.value + entry_point.size)
@@ -169,6 +170,7 @@ void write_entry_code(AxMemory& memory, AxCore& core, uint64_t main_addr, uint64
     }
 
     std::memcpy(memory.map(core, AxMemory::WRAM_BEGIN + entry_addr), entry_code.data(), entry_code.size() * 4);
+    core.invalidate_code(AxMemory::WRAM_BEGIN + entry_addr, entry_code.size() * 4);
     core.registers().pc = entry_addr / 4ull;
 }
 
@@ -195,13 +197,13 @@ void fill_symbol_table(AxCore& core, const AxELFFile& elf, uint64_t entry_addr)
     core.set_symbols(std::move(symbol_table));
 }
 
-void do_load_elf_program(AxCore& core, AxELFFile& elf, std::string_view entry_point_name)
+void do_load_elf_program(AxCore& core, const AxELFFile& elf, std::string_view entry_point_name)
 {
      auto& entry_point = get_entry_point(elf, entry_point_name);
      load_sections(elf, entry_point, core.memory(), core);
 }
 
-void do_load_elf_hosted_program(AxCore& core, AxELFFile& elf, std::string_view program_name, std::span<const std::string_view> argv)
+void do_load_elf_hosted_program(AxCore& core, const AxELFFile& elf, std::string_view program_name, std::span<const std::string_view> argv)
 {
     // look for main
     const auto& entry_point = get_entry_point(elf, "main");
@@ -230,6 +232,11 @@ void ax_load_elf_program(AxCore& core, const void* buffer, size_t buffer_size, s
     do_load_elf_program(core, elf, entry_point_name);
 }
 
+void ax_load_elf_program(AxCore& core, const AxELFFile& elf, std::string_view entry_point_name)
+{
+    do_load_elf_program(core, elf, entry_point_name);
+}
+
 void ax_load_elf_hosted_program(AxCore& core, const std::filesystem::path& path, std::span<const std::string_view> argv)
 {
     AxELFFile elf{path};
@@ -241,3 +248,8 @@ void ax_load_elf_hosted_program(AxCore& core, const void* buffer, size_t buffer_
     AxELFFile elf{buffer, buffer_size};
     do_load_elf_hosted_program(core, elf, program_name, argv);
 }
+
+void ax_load_elf_hosted_program(AxCore& core, const AxELFFile& elf, std::string_view program_name, std::span<const std::string_view> argv)
+{
+    do_load_elf_hosted_program(core, elf, program_name, argv);
+}
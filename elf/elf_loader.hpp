@@ -14,6 +14,8 @@ class AxCore;
 // This function panics on error!
 void ax_load_elf_program(AxCore& core, const std::filesystem::path& path, std::string_view entry_point_name);
 void ax_load_elf_program(AxCore& core, const void* buffer, size_t buffer_size, std::string_view entry_point_name);
+// Parsed files are only read, they can be loaded by several cores at the same time
+void ax_load_elf_program(AxCore& core, const AxELFFile& elf, std::string_view entry_point_name);
 
 // load an ELF file
 // This function panics on error!
@@ -38,5 +40,6 @@ void ax_load_elf_program(AxCore& core, const void* buffer, size_t buffer_size, s
 // ```
 void ax_load_elf_hosted_program(AxCore& core, const std::filesystem::path& path, std::span<const std::string_view> argv);
 void ax_load_elf_hosted_program(AxCore& core, const void* buffer, size_t buffer_size, std::string_view program_name, std::span<const std::string_view> argv);
+void ax_load_elf_hosted_program(AxCore& core, const AxELFFile& elf, std::string_view program_name, std::span<const std::string_view> argv);
 
 #endif
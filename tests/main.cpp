@@ -3,9 +3,27 @@
 #include <catch2/generators/catch_generators_adapters.hpp>
 #include <catch2/generators/catch_generators_random.hpp>
 
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <core.hpp>
 #include <memory.hpp>
+#include <device.hpp>
+#include <dma.hpp>
+#include <interrupt.hpp>
+#include <queue.hpp>
+#include <snapshot.hpp>
 #include <make_opcode.hpp>
+#include <batch.hpp>
+#include <stdio.hpp>
+#include <altairx.hpp>
 
 // Correctly promote a value to a register (always zext)
 template<typename T>
@@ -27,6 +45,18 @@ uint64_t make_reg(T value)
     }
 }
 
+// Raw executable in the temporary directory, code starts at the entry point of raw programs (word 4)
+std::filesystem::path write_raw_program(const std::string& name, const std::vector<uint32_t>& code)
+{
+    const auto path = std::filesystem::temp_directory_path() / name;
+    std::vector<uint32_t> words(4);
+    words.insert(words.end(), code.begin(), code.end());
+
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char*>(words.data()), static_cast<std::streamsize>(words.size() * sizeof(uint32_t)));
+    return path;
+}
+
 TEST_CASE("Basic operations", "[basic]")
 {
     AxMemory memory{8, 8, 8};
@@ -43,6 +73,26 @@ TEST_CASE("Basic operations", "[basic]")
         REQUIRE(core.registers().gpi[1] == 1);
         REQUIRE(core.registers().gpi[2] == 0xDEADBEEFu);
     }
+
+    SECTION("Bypass and zero registers")
+    {
+        const auto nop = make_noop_opcode();
+        core.registers().gpi[1] = 5;
+
+        // ACC destination only writes the slot's bypass, ACC source reads it
+        core.execute(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, AxCore::REG_ACC, 1, 2), nop);
+        REQUIRE(core.registers().gpi[AxCore::REG_BA1] == 7);
+        REQUIRE(core.registers().gpi[AxCore::REG_ACC] == 0);
+        core.execute(make_alu_reg_reg_opcode(AX_EXE_ALU_ADD, 3, 2, AxCore::REG_ACC, 1, 0), nop);
+        REQUIRE(core.registers().gpi[2] == 12);
+
+        // writes to ZERO are dropped
+        core.execute(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, AxCore::REG_ZERO, 1, 2), nop);
+        REQUIRE(core.registers().gpi[AxCore::REG_BA1] == 7);
+        REQUIRE(core.registers().gpi[AxCore::REG_ZERO] == 0);
+        core.execute(make_alu_reg_reg_opcode(AX_EXE_ALU_ADD, 3, 3, AxCore::REG_ZERO, 1, 0), nop);
+        REQUIRE(core.registers().gpi[3] == 5);
+    }
 }
 
 TEMPLATE_TEST_CASE("Conditional jumps (ints)", "[brc]", int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t, uint64_t)
@@ -205,3 +255,1542 @@ TEMPLATE_TEST_CASE("Conditional jumps (floats)", "[brc]", float, double)
 
     check_for(left, right);
 }
+
+TEST_CASE("Decode cache", "[decoder]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore core{memory};
+
+    auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+
+    SECTION("Stores invalidate decoded code")
+    {
+        code[0] = make_movei_opcode(1, 5);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 2, 2, 3, 0);
+        code[2] = make_bru_jump_opcode(AX_EXE_BRU_JUMP, 0);
+
+        core.registers().gpi[2] = make_movei_opcode(1, 9);
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN;
+        core.registers().pc = 0;
+
+        core.cycle();
+        REQUIRE(core.registers().gpi[1] == 5);
+        core.cycle(); // overwrite first opcode
+        core.cycle(); // jump back to it
+        REQUIRE(core.registers().pc == 0);
+        core.cycle();
+        REQUIRE(core.registers().gpi[1] == 9);
+    }
+
+    SECTION("External writes require explicit invalidation")
+    {
+        code[0] = make_movei_opcode(1, 5);
+        core.registers().pc = 0;
+        core.cycle();
+        REQUIRE(core.registers().gpi[1] == 5);
+
+        code[0] = make_movei_opcode(1, 7);
+        core.invalidate_code(AxMemory::WRAM_BEGIN, 4);
+        core.registers().pc = 0;
+        core.cycle();
+        REQUIRE(core.registers().gpi[1] == 7);
+    }
+
+    SECTION("Writes of other cores invalidate decoded code")
+    {
+        AxCore other{memory};
+
+        code[0] = make_movei_opcode(1, 5);
+        code[1] = make_bru_jump_opcode(AX_EXE_BRU_JUMP, 0);
+        core.registers().pc = 0;
+        core.execute_blocks(4);
+        REQUIRE(core.registers().gpi[1] == 5);
+
+        code[0x800] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 2, 2, 3, 0);
+        other.registers().gpi[2] = make_movei_opcode(1, 9);
+        other.registers().gpi[3] = AxMemory::WRAM_BEGIN;
+        other.registers().pc = 0x800;
+        other.cycle();
+        core.execute_blocks(4);
+        REQUIRE(core.registers().gpi[1] == 9);
+
+        // syscalls and DMA of another core
+        code[0] = make_movei_opcode(1, 7);
+        other.invalidate_code(AxMemory::WRAM_BEGIN, 4);
+        core.execute_blocks(4);
+        REQUIRE(core.registers().gpi[1] == 7);
+    }
+
+    SECTION("WRAM sizes that are not powers of two")
+    {
+        AxMemory odd{3, 8, 8};
+        AxCore odd_core{odd};
+
+        auto* odd_code = static_cast<uint32_t*>(odd.map(odd_core, AxMemory::WRAM_BEGIN));
+        odd_code[0] = make_movei_opcode(1, 5);
+        odd_code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 2, 2, 3, 0);
+        odd_code[2] = make_bru_jump_opcode(AX_EXE_BRU_JUMP, 0);
+
+        odd_core.registers().gpi[2] = make_movei_opcode(1, 9);
+        odd_core.registers().gpi[3] = AxMemory::WRAM_BEGIN;
+        odd_core.registers().pc = 0;
+
+        odd_core.cycle();
+        REQUIRE(odd_core.registers().gpi[1] == 5);
+        odd_core.cycle();
+        odd_core.cycle();
+        odd_core.cycle();
+        REQUIRE(odd_core.registers().gpi[1] == 9);
+
+        // last words of the region, stores may run past its end
+        const auto last = odd.wram_bytesize() - 4;
+        odd_core.invalidate_code(AxMemory::WRAM_BEGIN + last, 8);
+        odd_code[last / 4] = make_movei_opcode(1, 3);
+        odd_core.registers().pc = last / 4;
+        odd_core.cycle();
+        REQUIRE(odd_core.registers().gpi[1] == 3);
+    }
+}
+
+TEST_CASE("Memory map", "[memory]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore core{memory};
+    AxCore other{memory};
+
+    auto* wram = static_cast<uint8_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+    REQUIRE(memory.map(core, AxMemory::WRAM_BEGIN + 0x12345) == wram + 0x12345);
+    REQUIRE(memory.map(core, AxMemory::WRAM_BEGIN + 8 * 1024 * 1024) == wram);
+
+    // regions smaller than a page are mirrored
+    REQUIRE(memory.map(core, AxMemory::SPMT_BEGIN + 0x2000) == memory.map(core, AxMemory::SPMT_BEGIN));
+    REQUIRE(memory.map(core, AxMemory::SPM2_BEGIN + 0x10004) == memory.map(core, AxMemory::SPM2_BEGIN + 4));
+    REQUIRE(memory.contiguous_size(AxMemory::SPMT_BEGIN + 0x2008) == 0x2000 - 8);
+    REQUIRE(memory.contiguous_size(AxMemory::WRAM_BEGIN + 0x10) == 8 * 1024 * 1024 - 0x10);
+
+    // scratchpad is private to each core
+    REQUIRE(memory.map(core, 0x10) == core.smp_data() + 0x10);
+    REQUIRE(memory.map(other, 0x4010) == other.smp_data() + 0x10);
+
+    SECTION("Loads and stores")
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 2, 3, 0);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 4, 5, 0);
+        code[2] = make_bru_jump_opcode(AX_EXE_BRU_JUMP, 0);
+
+        const uint64_t value = 0x1122'3344'5566'7788ull;
+        core.registers().gpi[2] = value;
+        core.registers().gpi[3] = AxMemory::SPMT_BEGIN + 0x2008;
+        core.registers().gpi[5] = AxMemory::SPMT_BEGIN + 8;
+        core.cycle();
+        core.cycle();
+        REQUIRE(core.registers().gpi[4] == value);
+        REQUIRE(memory.load<uint64_t>(core, AxMemory::SPMT_BEGIN + 8) == value);
+
+        core.registers().gpi[3] = AxCore::SPM_SIZE + 0x20;
+        core.registers().gpi[5] = 0x20;
+        core.registers().gpi[4] = 0;
+        core.cycle();
+        core.cycle();
+        core.cycle();
+        REQUIRE(core.registers().gpi[4] == value);
+        REQUIRE(memory.load<uint64_t>(other, 0x20) == 0);
+    }
+
+    SECTION("Large regions are zero-initialized")
+    {
+        AxMemory large{1024, 8, 8};
+        REQUIRE(large.wram_bytesize() == 1024ull * 1024 * 1024);
+        REQUIRE(large.load<uint64_t>(core, AxMemory::WRAM_BEGIN + 768ull * 1024 * 1024) == 0);
+        large.store<uint64_t>(core, 42, AxMemory::WRAM_BEGIN + 768ull * 1024 * 1024);
+        REQUIRE(large.load<uint64_t>(core, AxMemory::WRAM_BEGIN + 768ull * 1024 * 1024) == 42);
+    }
+
+    SECTION("Regions that are not a multiple of a page")
+    {
+        AxMemory odd{8, 96, 8};
+        const auto* spmt = static_cast<const uint8_t*>(odd.map(core, AxMemory::SPMT_BEGIN));
+        for(uint64_t offset = 0; offset < 0x20000; offset += 0x100)
+        {
+            const auto* host = static_cast<const uint8_t*>(odd.map(core, AxMemory::SPMT_BEGIN + offset + 0xF8));
+            REQUIRE(host >= spmt);
+            REQUIRE(host + 8 <= spmt + 96 * 1024);
+        }
+
+        // offsets are masked with size - 1
+        REQUIRE(odd.map(core, AxMemory::SPMT_BEGIN + 0x10000) == spmt + 0x10000);
+        REQUIRE(odd.map(core, AxMemory::SPMT_BEGIN + 0x1F000) == spmt + 0x17000);
+        REQUIRE(odd.map(core, AxMemory::SPMT_BEGIN + 0x8000) == spmt);
+        odd.store<uint64_t>(core, 42, AxMemory::SPMT_BEGIN + 0x1FFF8);
+        REQUIRE(odd.load<uint64_t>(core, AxMemory::SPMT_BEGIN + 0x17FF8) == 42);
+    }
+
+    SECTION("Huge pages fall back to available backing")
+    {
+        AxMemory huge{64, 8, 1024, AxHugePages::WRAM_SPM2};
+        const auto last = AxMemory::WRAM_BEGIN + huge.wram_bytesize() - 8;
+        REQUIRE(huge.load<uint64_t>(core, last) == 0);
+        huge.store<uint64_t>(core, 42, last);
+        huge.store<uint64_t>(core, 43, AxMemory::SPM2_BEGIN + 1024 * 1024 - 8);
+        REQUIRE(huge.load<uint64_t>(core, last) == 42);
+        REQUIRE(huge.load<uint64_t>(core, AxMemory::SPM2_BEGIN + 2 * 1024 * 1024 - 8) == 43); // mirrored
+    }
+
+    SECTION("Guard pages")
+    {
+        AxMemory guarded{8, 8, 8, AxHugePages::NONE, true};
+        AxCore guarded_core{guarded};
+        constexpr uint64_t wram_end = AxMemory::WRAM_BEGIN + 8 * 1024 * 1024;
+
+        // no more mirrors
+        REQUIRE(guarded.map(guarded_core, AxMemory::SPMT_BEGIN + 0x2000) != guarded.map(guarded_core, AxMemory::SPMT_BEGIN));
+        REQUIRE(guarded.map(guarded_core, wram_end) != guarded.map(guarded_core, AxMemory::WRAM_BEGIN));
+
+        auto* code = static_cast<uint32_t*>(guarded.map(guarded_core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 4, 3, 0);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 4, 5, 0);
+        guarded_core.registers().gpi[3] = wram_end - 8;
+        guarded_core.registers().gpi[5] = wram_end + 0x100;
+
+        auto result = guarded_core.run_for(10);
+        REQUIRE(result.reason == AxStopReason::ERROR);
+        REQUIRE(result.cycles == 1);
+        REQUIRE(guarded_core.error() == AxCore::ERROR_MEMORY_FAULT);
+        REQUIRE(guarded_core.fault_address() == wram_end + 0x100);
+        REQUIRE(guarded_core.registers().pc == 1);
+        REQUIRE(guarded_core.run_for(10).reason == AxStopReason::ERROR);
+
+        // runaway PC
+        AxCore runaway{guarded};
+        runaway.registers().pc = (wram_end - AxMemory::WRAM_BEGIN) / 4 + 16;
+        result = runaway.run_for(10);
+        REQUIRE(result.reason == AxStopReason::ERROR);
+        REQUIRE((runaway.fault_address() & ~7ull) == wram_end + 64); // either word of the bundle
+
+        // syscall buffers are checked against the end of their region
+        REQUIRE(guarded.contiguous_size(wram_end - 8) == 8);
+        REQUIRE(guarded.contiguous_size(wram_end + 0x100) == 0);
+        REQUIRE(guarded.contiguous_size(AxMemory::SPMT_BEGIN + 0x2000) == 0);
+
+        // the number of guarded memories is not limited
+        std::vector<std::unique_ptr<AxMemory>> memories;
+        for(int i = 0; i < 32; ++i)
+        {
+            memories.emplace_back(std::make_unique<AxMemory>(1, 1, 1, AxHugePages::NONE, true));
+        }
+
+        AxCore last_core{*memories.back()};
+        code = static_cast<uint32_t*>(memories.back()->map(last_core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 4, 3, 0);
+        last_core.registers().gpi[3] = AxMemory::WRAM_BEGIN + 2 * 1024 * 1024;
+        REQUIRE(last_core.run_for(10).reason == AxStopReason::ERROR);
+        REQUIRE(last_core.fault_address() == AxMemory::WRAM_BEGIN + 2 * 1024 * 1024);
+    }
+
+    SECTION("Unaligned and sign-extended accesses")
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 2, 2, 3, 1);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDIS, 1, 4, 3, 3);
+        code[2] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 1, 5, 3, 3);
+
+        core.registers().gpi[2] = 0xFFFE'0000ull;
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN + 0x100;
+        core.cycle();
+        core.cycle();
+        core.cycle();
+        REQUIRE(memory.load<uint32_t>(core, AxMemory::WRAM_BEGIN + 0x101) == 0xFFFE'0000u);
+        REQUIRE(core.registers().gpi[4] == 0xFFFF'FFFF'FFFF'FFFEull);
+        REQUIRE(core.registers().gpi[5] == 0xFFFEull);
+    }
+
+    SECTION("Dirty pages")
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 2, 2, 3, 0);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 2, 4, 0);
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN + 0xFFE;
+        core.registers().gpi[4] = AxMemory::WRAM_BEGIN + 0x3008;
+        memory.store<uint64_t>(core, 1, AxMemory::WRAM_BEGIN + 0x10'0000);
+        REQUIRE_FALSE(memory.is_dirty(AxMemory::WRAM_BEGIN + 0x10'0000));
+
+        memory.set_dirty_tracking(true);
+        core.cycle(); // unaligned, spans 2 pages
+        core.cycle();
+        memory.store<uint32_t>(core, 1, AxMemory::SPM2_BEGIN + 0x10004); // mirror
+        core.invalidate_code(AxMemory::WRAM_BEGIN + 0x8000, 0x1001);
+
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        memory.for_each_dirty_range([&](uint64_t addr, uint64_t size)
+        {
+            ranges.emplace_back(addr, size);
+        });
+
+        const std::vector<std::pair<uint64_t, uint64_t>> expected{
+            {AxMemory::SPM2_BEGIN, 0x1000},
+            {AxMemory::WRAM_BEGIN, 0x2000},
+            {AxMemory::WRAM_BEGIN + 0x3000, 0x1000},
+            {AxMemory::WRAM_BEGIN + 0x8000, 0x2000},
+        };
+        REQUIRE(ranges == expected);
+
+        memory.clear_dirty();
+        REQUIRE_FALSE(memory.is_dirty(AxMemory::WRAM_BEGIN));
+        memory.set_dirty_tracking(false);
+        memory.store<uint64_t>(core, 1, AxMemory::WRAM_BEGIN);
+        REQUIRE_FALSE(memory.is_dirty(AxMemory::WRAM_BEGIN));
+    }
+
+    SECTION("Snapshots")
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 2, 3, 0);
+        core.registers().gpi[2] = 42;
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN + 0x100;
+        memory.store<uint64_t>(core, 1, AxMemory::WRAM_BEGIN + 0x7F'FFF8);
+        core.smp_data()[0] = 7;
+
+        AxSnapshot snapshot{core};
+        REQUIRE_THROWS(AxSnapshot{core}); // only one snapshot per memory
+
+        for(int i = 0; i < 2; ++i)
+        {
+            core.cycle();
+            memory.store<uint64_t>(core, 2, AxMemory::WRAM_BEGIN + 0x7F'FFF8);
+            code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 2, 3, 1);
+            core.smp_data()[0] = 8;
+            REQUIRE(memory.load<uint64_t>(core, AxMemory::WRAM_BEGIN + 0x100) == 42);
+            REQUIRE(core.registers().pc == 1);
+
+            snapshot.restore();
+            REQUIRE(memory.load<uint64_t>(core, AxMemory::WRAM_BEGIN + 0x100) == 0);
+            REQUIRE(memory.load<uint64_t>(core, AxMemory::WRAM_BEGIN + 0x7F'FFF8) == 1);
+            REQUIRE(code[1] == 0);
+            REQUIRE(core.smp_data()[0] == 7);
+            REQUIRE(core.registers().pc == 0);
+            REQUIRE(core.registers().gpi[2] == 42);
+        }
+
+        // other cores of the memory drop the code they decoded since
+        AxCore other{memory, 1};
+        code[0x20] = make_movei_opcode(1, 9);
+        other.invalidate_code(AxMemory::WRAM_BEGIN + 0x80, 4);
+        other.registers().pc = 0x20;
+        other.cycle();
+        REQUIRE(other.registers().gpi[1] == 9);
+
+        snapshot.restore();
+        other.registers().gpi[1] = 0;
+        other.registers().pc = 0x20;
+        other.cycle();
+        REQUIRE(other.registers().gpi[1] == 0);
+    }
+}
+
+TEST_CASE("Dispatch engines", "[dispatch]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore reference{memory};
+    AxCore threaded{memory};
+    reference.set_dispatch(AxDispatch::SWITCH);
+    threaded.set_dispatch(AxDispatch::THREADED);
+
+    const auto operation = GENERATE(AX_EXE_ALU_ADDS, AX_EXE_ALU_SUBS, AX_EXE_ALU_CMP, AX_EXE_ALU_ADD, AX_EXE_ALU_SUB, AX_EXE_ALU_XOR,
+        AX_EXE_ALU_OR, AX_EXE_ALU_AND, AX_EXE_ALU_LSL, AX_EXE_ALU_ASR, AX_EXE_ALU_LSR, AX_EXE_ALU_SE, AX_EXE_ALU_SEN, AX_EXE_ALU_SLTS,
+        AX_EXE_ALU_SLTU, AX_EXE_ALU_SAND, AX_EXE_ALU_SBIT, AX_EXE_ALU_CMOVEN, AX_EXE_ALU_CMOVE);
+    const auto size = GENERATE(0u, 1u, 2u, 3u);
+    const auto left = GENERATE(take(2, random(std::numeric_limits<uint64_t>::min(), std::numeric_limits<uint64_t>::max())));
+    const auto right = GENERATE(uint64_t{0}, uint64_t{1}, uint64_t{63}, take(2, random(std::numeric_limits<uint64_t>::min(), std::numeric_limits<uint64_t>::max())));
+
+    const auto run = [&](AxCore& core, AxOpcode first, AxOpcode second)
+    {
+        core.registers() = AxCore::RegisterSet{};
+        core.registers().gpi[1] = left;
+        core.registers().gpi[2] = right;
+        core.registers().gpi[AxCore::REG_BA2] = right;
+        core.execute(first, second);
+        return core.registers();
+    };
+
+    const auto check = [&](AxOpcode first, AxOpcode second)
+    {
+        INFO("opcode: " << AxOpcode::to_string(first, second).first);
+        const auto expected = run(reference, first, second);
+        const auto result = run(threaded, first, second);
+        REQUIRE(result.gpi == expected.gpi);
+        REQUIRE(result.fr == expected.fr);
+    };
+
+    // reg-reg in first slot, reg-reg reading ACC in second slot
+    const auto bundle = make_bundle(
+        make_alu_reg_reg_opcode(operation, size, 3, 1, 2, 0),
+        make_alu_reg_reg_opcode(operation, size, 4, 1, AxCore::REG_ACC, 0));
+    check(bundle[0], bundle[1]);
+
+    // reg-imm with an extended immediate
+    const auto imm = make_bundle(
+        make_alu_reg_imm_opcode(operation, size, 3, 1, static_cast<int32_t>(right)),
+        make_alu_reg_imm_moveix(static_cast<int32_t>(right)));
+    check(imm[0], imm[1]);
+}
+
+TEST_CASE("Block cache", "[block]")
+{
+    const auto write_loop = [](AxMemory& memory, AxCore& core)
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+
+        uint32_t i = 0;
+        code[i++] = make_movei_opcode(2, 1000);
+        const auto loop = i;
+        auto bundle = make_bundle(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 1, 1, 1), make_alu_reg_reg_opcode(AX_EXE_ALU_XOR, 3, 3, 3, 1, 0));
+        code[i++] = bundle[0];
+        code[i++] = bundle[1];
+        bundle = make_bundle(make_lsu_reg_reg_opcode(AX_EXE_LSU_ST, 3, 3, 4, 1, 3), make_lsu_reg_reg_opcode(AX_EXE_LSU_LD, 3, 5, 4, 1, 3));
+        code[i++] = bundle[0];
+        code[i++] = bundle[1];
+        code[i++] = make_alu_reg_reg_opcode(AX_EXE_ALU_CMP, 3, ax_no_reg, 1, 2, 0);
+        code[i] = make_bru_brc_opcode(AX_EXE_BRU_BLT, static_cast<int32_t>(loop) - static_cast<int32_t>(i));
+        ++i;
+        code[i++] = make_noop_opcode() | 1u; // nop ; syscall
+        code[i++] = make_simple_opcode(AX_EXE_CU_SYSCALL);
+
+        core.registers().gpi[4] = AxMemory::WRAM_BEGIN + 0x10000;
+        core.registers().pc = 0;
+    };
+
+    SECTION("Blocks match cycle by cycle execution")
+    {
+        AxMemory memory1{8, 8, 8};
+        AxCore reference{memory1};
+        AxMemory memory2{8, 8, 8};
+        AxCore core{memory2};
+
+        write_loop(memory1, reference);
+        write_loop(memory2, core);
+
+        const auto cycles = core.execute_blocks(1'000'000);
+        REQUIRE(core.syscall([] {}));
+        REQUIRE(cycles == core.registers().cc);
+
+        while(reference.registers().cc < cycles)
+        {
+            reference.cycle();
+        }
+
+        REQUIRE(reference.registers().gpi == core.registers().gpi);
+        REQUIRE(reference.registers().pc == core.registers().pc);
+        REQUIRE(reference.registers().ic == core.registers().ic);
+    }
+
+    SECTION("Self-modifying code is translated again")
+    {
+        AxMemory memory{8, 8, 8};
+        AxCore core{memory};
+
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_movei_opcode(1, 5);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 2, 2, 3, 0);
+        code[2] = make_bru_jump_opcode(AX_EXE_BRU_JUMP, 0);
+
+        core.registers().gpi[2] = make_movei_opcode(1, 9);
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN;
+        core.registers().pc = 0;
+
+        REQUIRE(core.execute_blocks(5) == 5);
+        REQUIRE(core.registers().gpi[1] == 9);
+    }
+}
+
+TEST_CASE("JIT", "[jit]")
+{
+    if(!AxJit::supported())
+    {
+        return;
+    }
+
+    const auto write_loop = [](AxMemory& memory, AxCore& core)
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+
+        uint32_t i = 0;
+        code[i++] = make_movei_opcode(2, 5000);
+        code[i++] = make_movei_opcode(6, 0x1234567);
+        const auto loop = i;
+        // sizes are truncated
+        auto bundle = make_bundle(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 0, 6, 6, 77), make_alu_reg_reg_opcode(AX_EXE_ALU_SUB, 1, 7, 7, 6, 0));
+        code[i++] = bundle[0];
+        code[i++] = bundle[1];
+        // ACC reads the bypass of its own slot
+        bundle = make_bundle(make_alu_reg_reg_opcode(AX_EXE_ALU_XOR, 2, AxCore::REG_ACC, 6, 7, 0), make_alu_reg_reg_opcode(AX_EXE_ALU_OR, 3, 8, AxCore::REG_ACC, 1, 0));
+        code[i++] = bundle[0];
+        code[i++] = bundle[1];
+        // ZERO is a write sink
+        bundle = make_bundle(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 9, AxCore::REG_ACC, 3), make_alu_reg_reg_opcode(AX_EXE_ALU_AND, 3, AxCore::REG_ZERO, 9, 6, 0));
+        code[i++] = bundle[0];
+        code[i++] = bundle[1];
+        code[i++] = make_alu_reg_reg_opcode(AX_EXE_ALU_ADD, 3, 10, AxCore::REG_ZERO, 9, 0);
+        // interpreted operations in between
+        bundle = make_bundle(make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 10, 4, 0), make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 2, 11, 4, 0));
+        code[i++] = bundle[0];
+        code[i++] = bundle[1];
+        bundle = make_bundle(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 12, 12, 1), make_alu_reg_imm_moveix(0x10000));
+        code[i++] = bundle[0];
+        code[i++] = bundle[1];
+        code[i++] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 1, 1, 1);
+        code[i++] = make_alu_reg_reg_opcode(AX_EXE_ALU_CMP, 3, ax_no_reg, 1, 2, 0);
+        code[i] = make_bru_brc_opcode(AX_EXE_BRU_BLT, static_cast<int32_t>(loop) - static_cast<int32_t>(i));
+        ++i;
+        code[i++] = make_noop_opcode() | 1u; // nop ; syscall
+        code[i++] = make_simple_opcode(AX_EXE_CU_SYSCALL);
+
+        core.registers().gpi[4] = AxMemory::WRAM_BEGIN + 0x10000;
+        core.registers().pc = 0;
+    };
+
+    AxMemory memory1{8, 8, 8};
+    AxCore reference{memory1};
+    reference.set_jit_enabled(false);
+    AxMemory memory2{8, 8, 8};
+    AxCore core{memory2};
+    core.set_jit_enabled(true);
+    REQUIRE(core.jit_enabled());
+
+    write_loop(memory1, reference);
+    write_loop(memory2, core);
+
+    const auto cycles = core.execute_blocks(1'000'000);
+    REQUIRE(core.syscall([] {}));
+    REQUIRE(cycles == core.registers().cc);
+
+    while(reference.registers().cc < cycles)
+    {
+        reference.cycle();
+    }
+
+    REQUIRE(reference.registers().gpi == core.registers().gpi);
+    REQUIRE(reference.registers().gpf == core.registers().gpf);
+    REQUIRE(reference.registers().fr == core.registers().fr);
+    REQUIRE(reference.registers().pc == core.registers().pc);
+    REQUIRE(reference.registers().ic == core.registers().ic);
+
+    // hot loops, compiled to native code, still stop as soon as requested
+    auto* code = static_cast<uint32_t*>(memory2.map(core, AxMemory::WRAM_BEGIN));
+    code[0] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 1, 1, 1);
+    code[1] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+    core.invalidate_code(AxMemory::WRAM_BEGIN, 8);
+    core.registers().pc = 0;
+    core.execute_blocks(100'000);
+
+    core.request_stop();
+    REQUIRE(core.execute_blocks(1'000'000'000) < 1000);
+}
+
+TEST_CASE("Run API", "[run]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore core{memory};
+
+    // infinite loop: r1 += 1 ; syscall every 100 iterations
+    auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+    code[0] = make_movei_opcode(2, 100);
+    code[1] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 1, 1, 1);
+    code[2] = make_alu_reg_reg_opcode(AX_EXE_ALU_CMP, 3, ax_no_reg, 1, 2, 0);
+    code[3] = make_bru_brc_opcode(AX_EXE_BRU_BLT, -2);
+    code[4] = make_noop_opcode() | 1u; // nop ; syscall
+    code[5] = make_simple_opcode(AX_EXE_CU_SYSCALL);
+    code[6] = make_alu_reg_reg_opcode(AX_EXE_ALU_ADD, 3, 2, 2, 2, 0);
+    code[7] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -6);
+
+    SECTION("Cycles and syscalls")
+    {
+        auto result = core.run_for(10);
+        REQUIRE(result.reason == AxStopReason::CYCLES);
+        REQUIRE(result.cycles >= 10);
+        REQUIRE(core.registers().cc == result.cycles);
+
+        result = core.run_for(1'000'000);
+        REQUIRE(result.reason == AxStopReason::SYSCALL);
+        REQUIRE(core.registers().gpi[1] == 100);
+        REQUIRE(core.syscall([] {}));
+
+        result = core.run_for(1'000'000);
+        REQUIRE(result.reason == AxStopReason::SYSCALL);
+        REQUIRE(core.registers().gpi[1] == 200);
+    }
+
+    SECTION("Breakpoints and addresses")
+    {
+        core.add_breakpoint(5 * 4, false);
+        core.add_breakpoint(2 * 4);
+
+        auto result = core.run_for(1'000'000);
+        REQUIRE(result.reason == AxStopReason::BREAKPOINT);
+        REQUIRE(core.registers().pc == 2);
+        REQUIRE(core.registers().gpi[1] == 1);
+
+        // resume from the breakpoint
+        result = core.run_for(1'000'000);
+        REQUIRE(result.reason == AxStopReason::BREAKPOINT);
+        REQUIRE(core.registers().gpi[1] == 2);
+
+        core.remove_breakpoint(2 * 4);
+        result = core.run_until(6 * 4);
+        REQUIRE(result.reason == AxStopReason::SYSCALL);
+        REQUIRE(core.syscall([] {}));
+        result = core.run_until(7 * 4);
+        REQUIRE(result.reason == AxStopReason::ADDRESS);
+        REQUIRE(result.cycles == 1);
+        REQUIRE(core.registers().pc == 7);
+    }
+
+    SECTION("Cores on several threads")
+    {
+        REQUIRE_THROWS(AxCore{memory, AxCore::MAX_CORES});
+
+        std::vector<std::unique_ptr<AxCore>> cores;
+        std::vector<std::thread> threads;
+        std::array<AxStopReason, 4> reasons{};
+        for(uint32_t id = 1; id < 5; ++id)
+        {
+            auto& other = *cores.emplace_back(std::make_unique<AxCore>(memory, id));
+            threads.emplace_back([&other, &reasons]()
+            {
+                other.smp_data()[0] = static_cast<uint8_t>(other.id());
+                reasons[other.id() - 1] = other.run_for(1'000'000).reason; // assertions are not thread-safe
+            });
+        }
+
+        for(auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        for(auto& other : cores)
+        {
+            REQUIRE(reasons[other->id() - 1] == AxStopReason::SYSCALL);
+            REQUIRE(other->registers().gpi[1] == 100);
+            REQUIRE(other->smp_data()[0] == other->id());
+        }
+    }
+
+    SECTION("Stop requests")
+    {
+        core.request_stop();
+        auto result = core.run_for(1'000'000);
+        REQUIRE(result.reason == AxStopReason::STOPPED);
+        REQUIRE(result.cycles == 0);
+
+        // request is consumed
+        result = core.run_for(10);
+        REQUIRE(result.reason == AxStopReason::CYCLES);
+    }
+
+    SECTION("Tracing")
+    {
+        std::FILE* file = std::tmpfile();
+        REQUIRE(file != nullptr);
+
+        {
+            AxTracer tracer{core, file};
+            core.set_tracer(&tracer);
+
+            // traced runs go cycle by cycle
+            const auto result = core.run_for(10);
+            REQUIRE(result.reason == AxStopReason::CYCLES);
+            REQUIRE(result.cycles == 10);
+
+            core.set_tracer(nullptr);
+            core.run_for(10);
+        }
+
+        std::rewind(file);
+        int lines = 0;
+        for(int c = std::fgetc(file); c != EOF; c = std::fgetc(file))
+        {
+            lines += c == '\n';
+        }
+
+        std::fclose(file);
+        REQUIRE(lines == 10);
+    }
+}
+
+TEST_CASE("Cache model", "[cache]")
+{
+    SECTION("Replacement policies")
+    {
+        // 8 sets of 2 ways, 16 bytes lines: 0, 128 and 256 share set 0
+        const auto replacement = GENERATE(AxCacheReplacement::LRU, AxCacheReplacement::FIFO);
+        AxCache cache{AxCacheConfig{256, 16, 2, replacement}};
+
+        REQUIRE_FALSE(cache.access(0, 8));
+        REQUIRE_FALSE(cache.access(128, 8));
+        REQUIRE(cache.access(8, 8));
+        REQUIRE_FALSE(cache.access(256, 8)); // evicts 128 (LRU) or 0 (FIFO)
+        REQUIRE(cache.access(0, 4) == (replacement == AxCacheReplacement::LRU));
+        REQUIRE_FALSE(cache.access(60, 8)); // spans 2 lines
+
+        REQUIRE(cache.stats().hits == (replacement == AxCacheReplacement::LRU ? 2u : 1u));
+        REQUIRE(cache.stats().misses == (replacement == AxCacheReplacement::LRU ? 5u : 6u));
+        REQUIRE_THROWS(AxCache{AxCacheConfig{256, 16, 3}});
+    }
+
+    SECTION("Wide sets")
+    {
+        AxCache cache{AxCacheConfig{64 * 16, 64, 16, AxCacheReplacement::RANDOM}};
+        for(uint64_t i = 0; i < 16; ++i)
+        {
+            REQUIRE_FALSE(cache.access(i * 64, 4));
+        }
+
+        for(uint64_t i = 0; i < 16; ++i)
+        {
+            REQUIRE(cache.access(i * 64 + 8, 4));
+        }
+
+        REQUIRE_FALSE(cache.access(16 * 64, 4));
+    }
+
+    SECTION("Core accesses")
+    {
+        AxMemory memory{8, 8, 8};
+        AxCore core{memory};
+        AxCacheModel model{AxCacheModel::default_icache(), AxCacheModel::default_dcache()};
+        core.set_cache_model(&model);
+        core.set_symbols({{0, "loop"}, {0x1000, "table"}});
+
+        // loop: load from the same table entry
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 4, 3, 0);
+        code[1] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN + 0x1000;
+
+        const auto result = core.run_for(100);
+        REQUIRE(result.cycles == 100);
+        REQUIRE(model.icache().stats().misses == 1);
+        REQUIRE(model.icache().stats().hits == 99);
+        REQUIRE(model.dcache().stats().misses == 1);
+        REQUIRE(model.dcache().stats().hits == 49);
+
+        std::FILE* file = std::tmpfile();
+        REQUIRE(file != nullptr);
+        model.report(core, file);
+        std::rewind(file);
+        std::string report;
+        for(int c = std::fgetc(file); c != EOF; c = std::fgetc(file))
+        {
+            report += static_cast<char>(c);
+        }
+
+        std::fclose(file);
+        REQUIRE(report.find("WRAM") != std::string::npos);
+        REQUIRE(report.find("table") != std::string::npos);
+    }
+}
+
+TEST_CASE("Timing model", "[timing]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore core{memory};
+    AxTimingModel model{};
+    core.set_timing_model(&model);
+    auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+    const auto& config = model.config();
+
+    SECTION("Register dependencies")
+    {
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 4, 3, 0);
+        code[1] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 5, 4, 1); // waits for the load
+        code[2] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 6, 5, 1);
+        code[3] = make_mdu_reg_imm_opcode(AX_EXE_MDU_DIV, 3, 6, 3);
+        code[4] = make_mdu_reg_imm_opcode(AX_EXE_MDU_DIV, 3, 6, 5); // waits for the divider
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN + 0x1000;
+
+        const auto result = core.run_until(5 * 4);
+        const auto wram_load = config.load[AxMemory::region_index(AxMemory::WRAM_BEGIN)];
+        REQUIRE(model.stats().bundles == 5);
+        REQUIRE(model.stats().memory == wram_load - 1);
+        REQUIRE(model.stats().structural == config.div - 1);
+        REQUIRE(model.stats().dependency == 0);
+        REQUIRE(core.registers().cc == 5 + (wram_load - 1) + (config.div - 1));
+        REQUIRE(result.cycles == core.registers().cc);
+    }
+
+    SECTION("Branch penalties")
+    {
+        // 10 iterations of a backward branch, predicted taken
+        code[0] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 1, 1, 1);
+        code[1] = make_alu_reg_reg_opcode(AX_EXE_ALU_CMP, 3, ax_no_reg, 1, 2, 0);
+        code[2] = make_bru_brc_opcode(AX_EXE_BRU_BLT, -2);
+        core.registers().gpi[2] = 10;
+
+        while(core.registers().pc != 3)
+        {
+            core.cycle();
+        }
+
+        REQUIRE(model.stats().bundles == 30);
+        REQUIRE(model.stats().branch == 9 * config.branch_taken + config.branch_mispredict);
+        REQUIRE(core.registers().cc == model.stats().cycles);
+    }
+
+    SECTION("Cache misses")
+    {
+        AxCacheModel caches{AxCacheModel::default_icache(), AxCacheModel::default_dcache()};
+        core.set_cache_model(&caches);
+
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 4, 3, 0);
+        code[1] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 5, 4, 1);
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN + 0x1000;
+        core.run_until(2 * 4);
+
+        const auto wram_load = config.load[AxMemory::region_index(AxMemory::WRAM_BEGIN)];
+        REQUIRE(model.stats().fetch == config.cache_miss);
+        REQUIRE(model.stats().memory == wram_load + config.cache_miss - 1);
+        core.set_cache_model(nullptr);
+    }
+}
+
+TEST_CASE("DMA", "[dma]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore core{memory};
+    const auto async = GENERATE(false, true);
+    AxDmaConfig config{};
+    config.async = async;
+    AxDma dma{1, config};
+    memory.map_device(AxMemory::IO_BEGIN + AxDma::IO_OFFSET, AxMemory::PAGE_SIZE, &dma);
+
+    // program channel 1 then poll its status
+    auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+    code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 4, 3, AxDma::REG_SRC);
+    code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 5, 3, AxDma::REG_DST);
+    code[2] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 6, 3, AxDma::REG_SIZE);
+    code[3] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 7, 3, AxDma::REG_CONTROL);
+    code[4] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 8, 3, AxDma::REG_STATUS);
+    code[5] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+
+    auto& regs = core.registers();
+    regs.gpi[3] = AxMemory::IO_BEGIN + AxDma::IO_OFFSET + AxDma::CHANNEL_STRIDE;
+    regs.gpi[4] = AxMemory::WRAM_BEGIN + 0x1000;
+    regs.gpi[5] = AxMemory::SPM1_BEGIN + 0x100;
+    regs.gpi[6] = 0x1000;
+    regs.gpi[7] = AxDma::CONTROL_START;
+
+    auto* source = static_cast<uint8_t*>(memory.map(core, AxMemory::WRAM_BEGIN + 0x1000));
+    for(uint32_t i = 0; i < 0x1000; ++i)
+    {
+        source[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    SECTION("Copies to scratchpads")
+    {
+        core.run_until(5 * 4);
+        dma.wait();
+        core.run_until(5 * 4);
+
+        REQUIRE(regs.gpi[8] == AxDma::STATUS_DONE);
+        REQUIRE(std::memcmp(core.smp_data() + 0x100, source, 0x1000) == 0);
+        REQUIRE(dma.stats().transfers == 1);
+        REQUIRE(dma.stats().bytes == 0x1000);
+    }
+
+    SECTION("Transfer time in timing mode")
+    {
+        AxTimingModel model{};
+        core.set_timing_model(&model);
+
+        core.run_until(5 * 4);
+        REQUIRE(regs.gpi[8] == AxDma::STATUS_BUSY);
+        dma.wait();
+
+        const auto start = regs.cc;
+        while(regs.gpi[8] != AxDma::STATUS_DONE)
+        {
+            core.cycle();
+        }
+
+        REQUIRE(regs.cc - start >= config.setup_cycles);
+        REQUIRE(std::memcmp(core.smp_data() + 0x100, source, 0x1000) == 0);
+        core.set_timing_model(nullptr);
+    }
+
+    SECTION("Invalid ranges")
+    {
+        const std::array<uint64_t, 4> destinations{AxMemory::ROM_BEGIN, AxMemory::IO_BEGIN + 0x40000, AxMemory::SPM1_BEGIN + AxCore::SPM_SIZE - 8,
+            AxMemory::WRAM_BEGIN + memory.wram_bytesize() - 8};
+        for(std::size_t i = 0; i < destinations.size(); ++i)
+        {
+            regs.pc = 0;
+            regs.gpi[5] = destinations[i];
+            core.run_until(5 * 4);
+
+            REQUIRE(regs.gpi[8] == AxDma::STATUS_ERROR);
+            REQUIRE(dma.stats().errors == i + 1);
+        }
+    }
+}
+
+TEST_CASE("Devices", "[device]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore core{memory};
+    auto& regs = core.registers();
+
+    auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+    code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 4, 3, 0);
+    code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 5, 3, 8);
+    code[2] = make_bru_bra_opcode(AX_EXE_BRU_BRA, 0);
+
+    SECTION("IO pages without device are memory")
+    {
+        regs.gpi[3] = AxMemory::IO_BEGIN + 0x40000;
+        regs.gpi[4] = 42;
+        core.run_until(2 * 4);
+        REQUIRE(memory.load<uint64_t>(core, regs.gpi[3]) == 42);
+    }
+
+    SECTION("UART")
+    {
+        std::FILE* output = std::tmpfile();
+        REQUIRE(output != nullptr);
+        AxUart uart{output};
+        memory.map_device(AxMemory::IO_BEGIN + AxUart::IO_OFFSET, AxMemory::PAGE_SIZE, &uart);
+        core.flush_tlb();
+
+        regs.gpi[3] = AxMemory::IO_BEGIN + AxUart::IO_OFFSET;
+        regs.gpi[4] = 'x';
+        core.run_until(2 * 4);
+
+        REQUIRE(regs.gpi[5] == (AxUart::STATUS_TX_READY | AxUart::STATUS_RX_EOF));
+        std::rewind(output);
+        REQUIRE(std::fgetc(output) == 'x');
+        std::fclose(output);
+
+        // the IO buffer is untouched, and unmapping restores it
+        memory.map_device(AxMemory::IO_BEGIN + AxUart::IO_OFFSET, AxMemory::PAGE_SIZE, nullptr);
+        core.flush_tlb();
+        REQUIRE(memory.load<uint64_t>(core, AxMemory::IO_BEGIN + AxUart::IO_OFFSET) == 0);
+    }
+
+    SECTION("Timer and performance counters")
+    {
+        AxTimer timer{};
+        AxPerfCounters counters{};
+        memory.map_device(AxMemory::IO_BEGIN + AxTimer::IO_OFFSET, AxMemory::PAGE_SIZE, &timer);
+        memory.map_device(AxMemory::IO_BEGIN + AxPerfCounters::IO_OFFSET, AxMemory::PAGE_SIZE, &counters);
+        core.flush_tlb();
+
+        regs.gpi[3] = AxMemory::IO_BEGIN + AxPerfCounters::IO_OFFSET + AxPerfCounters::REG_CYCLES;
+        core.run_until(2 * 4);
+        REQUIRE(regs.gpi[5] == 1); // instructions retired before the load
+
+        // mirrors reach the device too
+        regs.pc = 0;
+        regs.gpi[3] = AxMemory::IO_BEGIN + AxMemory::IO_SIZE + AxTimer::IO_OFFSET + AxTimer::REG_CYCLES;
+        core.run_until(2 * 4);
+        REQUIRE(regs.gpi[5] != 0); // nanoseconds
+    }
+}
+
+TEST_CASE("Interrupts", "[interrupt]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore core{memory};
+    auto& regs = core.registers();
+
+    std::array<AxCore*, 1> cores{&core};
+    AxInterruptController controller{cores};
+    memory.map_device(AxMemory::IO_BEGIN + AxInterruptController::IO_OFFSET, AxMemory::PAGE_SIZE, &controller);
+
+    SECTION("Mailbox queue")
+    {
+        AxMpscQueue<uint64_t, 1024> queue{};
+        std::vector<std::thread> producers;
+        for(uint64_t i = 0; i < 4; ++i)
+        {
+            producers.emplace_back([&queue, i]()
+            {
+                for(uint64_t j = 0; j < 256; ++j)
+                {
+                    while(!queue.push(i * 1000 + j))
+                    {
+                    }
+                }
+            });
+        }
+
+        for(auto& producer : producers)
+        {
+            producer.join();
+        }
+
+        REQUIRE(queue.size() == 1024);
+        REQUIRE(!queue.push(0));
+
+        // each producer's values come in order
+        std::array<uint64_t, 4> next{};
+        uint64_t value{};
+        while(queue.pop(value))
+        {
+            REQUIRE(value % 1000 == next[value / 1000]++);
+        }
+
+        REQUIRE(next == std::array<uint64_t, 4>{256, 256, 256, 256});
+    }
+
+    SECTION("Cores send messages")
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 4, 3, AxInterruptController::REG_VECTOR);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 5, 3, AxInterruptController::REG_CONTROL);
+        code[2] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 6, 3, AxInterruptController::REG_TARGET);
+        code[3] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 7, 3, AxInterruptController::REG_SEND);
+        code[4] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 10, 10, 1);
+        code[5] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+        // handler
+        code[8] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 11, 3, AxInterruptController::REG_SOURCE);
+        code[9] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 12, 3, AxInterruptController::REG_VALUE);
+        code[10] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 13, 3, AxInterruptController::REG_SOURCE);
+        code[11] = make_noop_opcode() | 1u; // CU is only in the second slot
+        code[12] = make_simple_opcode(AX_EXE_CU_RETI);
+
+        regs.gpi[3] = AxMemory::IO_BEGIN + AxInterruptController::IO_OFFSET;
+        regs.gpi[4] = 8 * 4;
+        regs.gpi[5] = AxInterruptController::CONTROL_ENABLE;
+        regs.gpi[6] = core.id();
+        regs.gpi[7] = 1234;
+        core.run_for(64);
+
+        REQUIRE(regs.gpi[11] == core.id());
+        REQUIRE(regs.gpi[12] == 1234);
+        REQUIRE(regs.gpi[13] == AxInterruptController::SOURCE_NONE);
+        REQUIRE(regs.gpi[10] > 0);
+        REQUIRE((regs.pc == 4 || regs.pc == 5));
+    }
+
+    SECTION("Timer")
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_bru_bra_opcode(AX_EXE_BRU_BRA, 1);
+        code[1] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+
+        AxTimer timer{1};
+        timer.set_interrupt_controller(&controller);
+        memory.map_device(AxMemory::IO_BEGIN + AxTimer::IO_OFFSET, AxMemory::PAGE_SIZE, &timer);
+        core.flush_tlb();
+
+        // latched until interrupts are enabled
+        timer.write(core, AxTimer::REG_COMPARE, 8, regs.cc + 10);
+        REQUIRE(timer.cycles_until_interrupt(core) == 10);
+        core.run_for(timer.cycles_until_interrupt(core));
+        timer.update(core);
+        REQUIRE(timer.cycles_until_interrupt(core) == ~0ull);
+        REQUIRE(controller.read(core, AxInterruptController::REG_PENDING, 8) == 1);
+
+        core.set_interrupt_vector(0x100);
+        core.set_interrupts_enabled(true);
+        const auto pc = regs.pc;
+        core.run_for(1);
+        REQUIRE(regs.ir == pc);
+        REQUIRE(controller.read(core, AxInterruptController::REG_SOURCE, 8) == AxInterruptController::SOURCE_TIMER);
+    }
+
+    SECTION("Snapshots")
+    {
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 10, 10, 1);
+        code[1] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+        code[2] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, AxCore::REG_ZERO, 3, AxInterruptController::REG_WAIT);
+        code[3] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+        // handler, never returns
+        code[8] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 11, 11, 1);
+        code[9] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+
+        regs.gpi[3] = AxMemory::IO_BEGIN + AxInterruptController::IO_OFFSET;
+        core.set_interrupt_vector(8 * 4);
+        core.set_interrupts_enabled(true);
+        AxSnapshot snapshot{core};
+
+        // the run stops in the handler, interrupts are taken again after the restore
+        for(int i = 0; i < 2; ++i)
+        {
+            core.raise_interrupt();
+            core.run_for(64);
+            REQUIRE((regs.pc == 8 || regs.pc == 9));
+            REQUIRE(regs.ir <= 1);
+
+            snapshot.restore();
+            REQUIRE(regs.pc == 0);
+        }
+
+        // the run stops halted, the restored core runs
+        regs.pc = 2;
+        REQUIRE(core.run_for(64).reason == AxStopReason::IDLE);
+        REQUIRE(core.halted());
+
+        snapshot.restore();
+        REQUIRE_FALSE(core.halted());
+        const auto result = core.run_for(64);
+        REQUIRE(result.reason == AxStopReason::CYCLES);
+        REQUIRE(regs.gpi[10] > 0);
+    }
+}
+
+TEST_CASE("Idle cores", "[interrupt]")
+{
+    AxMemory memory{8, 8, 8};
+    AxCore core{memory};
+    auto& regs = core.registers();
+
+    std::array<AxCore*, 1> cores{&core};
+    AxInterruptController controller{cores};
+    memory.map_device(AxMemory::IO_BEGIN + AxInterruptController::IO_OFFSET, AxMemory::PAGE_SIZE, &controller);
+
+    auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+
+    SECTION("Halt")
+    {
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, AxCore::REG_ZERO, 3, AxInterruptController::REG_WAIT);
+        code[1] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 10, 10, 1);
+        code[2] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+
+        regs.gpi[3] = AxMemory::IO_BEGIN + AxInterruptController::IO_OFFSET;
+        auto result = core.run_for(1000);
+        REQUIRE(result.reason == AxStopReason::IDLE);
+        REQUIRE(core.halted());
+
+        result = core.run_for(1000);
+        REQUIRE(result.reason == AxStopReason::IDLE);
+        REQUIRE(result.cycles == 0);
+
+        // any raised interrupt wakes the core, even if it can not be taken
+        std::thread sender{[&controller]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+            controller.post(0, AxInterrupt{1, 2});
+        }};
+
+        core.wait_for_interrupt();
+        sender.join();
+
+        const auto counter = regs.gpi[10];
+        result = core.run_for(1000);
+        REQUIRE(result.reason == AxStopReason::CYCLES);
+        REQUIRE(!core.halted());
+        REQUIRE(regs.gpi[10] > counter);
+        REQUIRE(controller.read(core, AxInterruptController::REG_PENDING, 8) == 1);
+    }
+
+    SECTION("Stop requests wake halted cores")
+    {
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, AxCore::REG_ZERO, 3, AxInterruptController::REG_WAIT);
+        code[1] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+
+        regs.gpi[3] = AxMemory::IO_BEGIN + AxInterruptController::IO_OFFSET;
+        REQUIRE(core.run_for(1000).reason == AxStopReason::IDLE);
+
+        std::thread stopper{[&core]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+            core.request_stop();
+        }};
+
+        core.wait_for_interrupt();
+        stopper.join();
+
+        REQUIRE(core.run_for(1000).reason == AxStopReason::STOPPED);
+        REQUIRE(core.halted());
+    }
+
+    SECTION("Halt ends blocks")
+    {
+        // the flag must be read after waking up, or the interrupt that set it is lost
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, AxCore::REG_ZERO, 3, AxInterruptController::REG_WAIT);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 1, 4, 0);
+        code[2] = make_alu_reg_reg_opcode(AX_EXE_ALU_CMP, 3, ax_no_reg, 1, AxCore::REG_ZERO, 0);
+        code[3] = make_bru_brc_opcode(AX_EXE_BRU_BEQ, -3);
+        code[4] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 10, 10, 1);
+        code[5] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+
+        code[64] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 11, 3, AxInterruptController::REG_SOURCE);
+        code[65] = make_noop_opcode() | 1u;
+        code[66] = make_simple_opcode(AX_EXE_CU_RETI);
+
+        auto* flag = static_cast<uint64_t*>(memory.map(core, AxMemory::WRAM_BEGIN + 0x1000));
+        *flag = 0;
+        regs.gpi[3] = AxMemory::IO_BEGIN + AxInterruptController::IO_OFFSET;
+        regs.gpi[4] = AxMemory::WRAM_BEGIN + 0x1000;
+        core.set_interrupt_vector(0x100);
+        core.set_interrupts_enabled(true);
+
+        // stepping and block execution must stop at the same bundle
+        const bool stepping = GENERATE(false, true);
+        const auto run = [&core, stepping]()
+        {
+            return stepping ? core.run_until(0xFFFF'FFF0, 1000) : core.run_for(1000);
+        };
+
+        REQUIRE(run().reason == AxStopReason::IDLE);
+        REQUIRE(regs.pc == 1);
+
+        *flag = 1;
+        controller.post(0, AxInterrupt{1, 2});
+        REQUIRE(run().reason == AxStopReason::CYCLES);
+        REQUIRE(!core.halted());
+        REQUIRE(regs.gpi[10] > 0);
+    }
+
+    SECTION("Spinning on memory")
+    {
+        auto* flag = static_cast<uint64_t*>(memory.map(core, AxMemory::WRAM_BEGIN + 0x1000));
+        *flag = 0;
+
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 1, 3, 0);
+        code[1] = make_alu_reg_reg_opcode(AX_EXE_ALU_CMP, 3, ax_no_reg, 1, AxCore::REG_ZERO, 0);
+        code[2] = make_bru_brc_opcode(AX_EXE_BRU_BEQ, -2);
+        // counted loops are not idle
+        code[3] = make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 10, 10, 1);
+        code[4] = make_bru_bra_opcode(AX_EXE_BRU_BRA, -1);
+
+        regs.gpi[3] = AxMemory::WRAM_BEGIN + 0x1000;
+        auto result = core.run_for(1'000'000);
+        REQUIRE(result.reason == AxStopReason::IDLE);
+        REQUIRE(result.cycles < 1000);
+        REQUIRE(!core.halted());
+        REQUIRE(regs.pc == 0);
+
+        *flag = 1;
+        result = core.run_for(10'000);
+        REQUIRE(result.reason == AxStopReason::CYCLES);
+        REQUIRE(regs.gpi[10] > 1000);
+    }
+}
+
+namespace
+{
+
+std::string read_file(std::FILE* file)
+{
+    std::string output;
+    std::rewind(file);
+    for(int c = std::fgetc(file); c != EOF; c = std::fgetc(file))
+    {
+        output.push_back(static_cast<char>(c));
+    }
+
+    return output;
+}
+
+}
+
+TEST_CASE("Guest stdio", "[vm]")
+{
+    std::FILE* first = std::tmpfile();
+    std::FILE* second = std::tmpfile();
+    REQUIRE(first != nullptr);
+    REQUIRE(second != nullptr);
+
+    SECTION("Ring wraparound")
+    {
+        const auto flush = GENERATE(AxStdioFlush::SYNC, AxStdioFlush::ASYNC, AxStdioFlush::INTERVAL);
+
+        std::string expected;
+        {
+            // writes larger than the ring wait for the I/O thread
+            AxStdio stdio{AxStdioConfig{flush, 16, std::chrono::milliseconds{1}, 0}};
+            for(int i = 0; i < 50; ++i)
+            {
+                const auto line = "line " + std::to_string(i) + "\n";
+                REQUIRE(stdio.write(first, line.data(), line.size()) == line.size());
+                expected += line;
+            }
+
+            stdio.flush();
+            REQUIRE(read_file(first) == expected);
+            std::fseek(first, 0, SEEK_END);
+
+            const std::string tail = "pending output is written on destruction";
+            stdio.write(first, tail.data(), tail.size());
+            expected += tail;
+        }
+
+        REQUIRE(read_file(first) == expected);
+    }
+
+    SECTION("Write order across files")
+    {
+        AxStdio stdio{AxStdioConfig{AxStdioFlush::INTERVAL, 64, std::chrono::milliseconds{1000}, 0}};
+        stdio.write(first, "a", 1);
+        stdio.write(second, "b", 1);
+        stdio.write(first, "c", 1);
+        stdio.write(first, "d", 1);
+        stdio.write(second, "e", 1);
+
+        // nothing is written before the buffer is half full or the interval elapsed
+        REQUIRE(read_file(first).empty());
+
+        stdio.flush();
+        REQUIRE(read_file(first) == "acd");
+        REQUIRE(read_file(second) == "be");
+    }
+
+    SECTION("Input read ahead")
+    {
+        const std::string input = "some guest input, read in small parts";
+        std::fwrite(input.data(), 1, input.size(), first);
+        std::fflush(first);
+        std::rewind(first);
+
+        AxStdio stdio{AxStdioConfig{AxStdioFlush::SYNC, 0, std::chrono::milliseconds{1}, 8}, first};
+        std::string output(input.size() + 8, '\0');
+        REQUIRE(stdio.read(first, output.data(), 4) == 4);
+        REQUIRE(stdio.read(first, output.data() + 4, output.size() - 4) == input.size() - 4);
+        output.resize(input.size());
+        REQUIRE(output == input);
+    }
+
+    SECTION("Input shared with the UART")
+    {
+        const std::string input = "abcdef";
+        std::fwrite(input.data(), 1, input.size(), first);
+        std::fflush(first);
+        std::rewind(first);
+        REQUIRE(std::fgetc(first) == 'a'); // the rest is in the FILE buffer
+
+        AxStdio stdio{AxStdioConfig{AxStdioFlush::SYNC, 0, std::chrono::milliseconds{1}, 8}, first};
+        AxUart uart{second};
+        uart.set_input([&stdio]()
+        {
+            return stdio.get();
+        });
+
+        AxMemory memory{8, 8, 8};
+        AxCore core{memory};
+        REQUIRE(uart.read(core, AxUart::REG_DATA, 8) == 'b');
+        std::string output(3, '\0');
+        REQUIRE(stdio.read(first, output.data(), output.size()) == 3);
+        REQUIRE(output == "cde");
+        REQUIRE(uart.read(core, AxUart::REG_DATA, 8) == 'f');
+        REQUIRE(uart.read(core, AxUart::REG_STATUS, 8) == AxUart::STATUS_TX_READY);
+        REQUIRE(uart.read(core, AxUart::REG_DATA, 8) == ~0ull);
+        REQUIRE(uart.read(core, AxUart::REG_STATUS, 8) == (AxUart::STATUS_TX_READY | AxUart::STATUS_RX_EOF));
+    }
+
+    SECTION("VM output")
+    {
+        // 'U' on the UART, then the first word of code on the guest stdout
+        constexpr auto uart = AxMemory::IO_BEGIN + AxUart::IO_OFFSET;
+        const auto code_address = make_bundle(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 2, 3, AxCore::REG_ZERO, 0x80000010),
+            make_alu_reg_imm_moveix(0x80000010));
+        const uint32_t first_word = make_movei_opcode(4, static_cast<int64_t>(uart >> 16));
+        const auto path = write_raw_program("altairx_test_output.bin", {
+            first_word,
+            make_alu_reg_imm_opcode(AX_EXE_ALU_LSL, 3, 4, 4, 16),
+            make_movei_opcode(5, 'U'),
+            make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 5, 4, 0),
+            code_address[0],
+            code_address[1],
+            make_movei_opcode(1, 3), // stdio_write
+            make_movei_opcode(2, 1),
+            make_movei_opcode(4, 4),
+            make_noop_opcode() | 1u, // nop ; syscall
+            make_simple_opcode(AX_EXE_CU_SYSCALL),
+            make_movei_opcode(1, 1), // exit
+            make_movei_opcode(2, 0),
+            make_noop_opcode() | 1u,
+            make_simple_opcode(AX_EXE_CU_SYSCALL),
+        });
+
+        const auto mode = GENERATE(AxExecutionMode::DEFAULT, AxExecutionMode::DEBUG);
+        {
+            AltairX vm{1, 8, 8, 8};
+            vm.set_stdio_config(AxStdioConfig{AxStdioFlush::SYNC, 64, std::chrono::milliseconds{1}, 0}, first, second);
+            vm.load_program(path, "main");
+            REQUIRE(vm.run(mode) == 0);
+        }
+
+        std::filesystem::remove(path);
+
+        const auto output = read_file(second);
+        std::string expected{"U"};
+        expected.append(reinterpret_cast<const char*>(&first_word), sizeof(uint32_t));
+        if(mode == AxExecutionMode::DEFAULT)
+        {
+            REQUIRE(output == expected);
+        }
+        else // with the trace
+        {
+            REQUIRE(output.size() > expected.size());
+        }
+    }
+
+    std::fclose(first);
+    std::fclose(second);
+}
+
+TEST_CASE("Batch manifest", "[vm]")
+{
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto path = directory / "altairx_test_manifest.txt";
+    const auto write_manifest = [&path](const std::string& content)
+    {
+        std::ofstream file{path, std::ios::trunc};
+        file << content;
+    };
+
+    SECTION("Jobs")
+    {
+        write_manifest("# comment\n\n0 prog.bin\n* sub/other.elf a b\n-3 prog.bin x < in.txt > out.txt\n");
+        const auto jobs = ax_read_batch_manifest(path);
+        REQUIRE(jobs.size() == 3);
+        REQUIRE(jobs[0].executable == directory / "prog.bin");
+        REQUIRE(jobs[0].expected_exit == 0);
+        REQUIRE(jobs[0].args.empty());
+        REQUIRE(jobs[1].executable == directory / "sub/other.elf");
+        REQUIRE(!jobs[1].expected_exit.has_value());
+        REQUIRE(jobs[1].args == std::vector<std::string>{"a", "b"});
+        REQUIRE(jobs[2].expected_exit == -3);
+        REQUIRE(jobs[2].args == std::vector<std::string>{"x"});
+        REQUIRE(jobs[2].input == directory / "in.txt");
+        REQUIRE(jobs[2].output == directory / "out.txt");
+        REQUIRE(jobs[0].input.empty());
+        REQUIRE(jobs[0].output.empty());
+    }
+
+    SECTION("Errors")
+    {
+        write_manifest("0\n");
+        REQUIRE_THROWS(ax_read_batch_manifest(path));
+
+        write_manifest("0 prog.bin\nzero prog.bin\n");
+        REQUIRE_THROWS(ax_read_batch_manifest(path));
+
+        write_manifest("1x prog.bin\n");
+        REQUIRE_THROWS(ax_read_batch_manifest(path));
+
+        write_manifest("0 prog.bin <\n");
+        REQUIRE_THROWS(ax_read_batch_manifest(path));
+
+        write_manifest("0 prog.bin < in.txt x\n");
+        REQUIRE_THROWS(ax_read_batch_manifest(path));
+
+        write_manifest("0 prog.bin > out.txt > other.txt\n");
+        REQUIRE_THROWS(ax_read_batch_manifest(path));
+
+        REQUIRE_THROWS(ax_read_batch_manifest(directory / "altairx_missing_manifest.txt"));
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Lockstep", "[vm]")
+{
+    SECTION("Store buffering")
+    {
+        AxMemory memory{8, 8, 8};
+        AxCore core{memory};
+        AxCore other{memory, 1};
+        core.set_store_buffering(true);
+
+        // store a movei, load it back, then run it
+        auto* code = static_cast<uint32_t*>(memory.map(core, AxMemory::WRAM_BEGIN));
+        code[0] = make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 2, 2, 3, 0);
+        code[1] = make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 2, 4, 3, 0);
+        code[2] = make_movei_opcode(1, 5);
+        core.registers().gpi[2] = make_movei_opcode(1, 9);
+        core.registers().gpi[3] = AxMemory::WRAM_BEGIN + 8;
+        for(int i = 0; i < 3; ++i)
+        {
+            core.cycle();
+        }
+
+        REQUIRE(core.registers().gpi[4] == core.registers().gpi[2]);
+        REQUIRE(core.registers().gpi[1] == 9);
+        REQUIRE(code[2] == make_movei_opcode(1, 5));
+
+        uint32_t word{};
+        core.read_memory(AxMemory::WRAM_BEGIN + 8, &word, sizeof(word));
+        REQUIRE(word == make_movei_opcode(1, 9));
+
+        // other cores see the store, and fetch it, once it is committed
+        other.registers().pc = 2;
+        other.cycle();
+        REQUIRE(other.registers().gpi[1] == 5);
+
+        core.commit_stores();
+        REQUIRE(code[2] == make_movei_opcode(1, 9));
+        other.registers().pc = 2;
+        other.cycle();
+        REQUIRE(other.registers().gpi[1] == 9);
+    }
+
+    SECTION("Racing cores")
+    {
+        // both cores increment the same word without synchronization, then exit with its last value
+        constexpr int32_t count = 100'000;
+        std::vector<uint32_t> code;
+        const auto bundle = make_bundle(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 2, 3, AxCore::REG_ZERO, 0x80010000),
+            make_alu_reg_imm_moveix(0x80010000));
+        code.insert(code.end(), bundle.begin(), bundle.end());
+        code.emplace_back(make_movei_opcode(2, count));
+        code.emplace_back(make_lsu_reg_imm_opcode(AX_EXE_LSU_LDI, 3, 5, 3, 0));
+        code.emplace_back(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 5, 5, 1));
+        code.emplace_back(make_lsu_reg_imm_opcode(AX_EXE_LSU_STI, 3, 5, 3, 0));
+        code.emplace_back(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 1, 1, 1));
+        code.emplace_back(make_alu_reg_reg_opcode(AX_EXE_ALU_CMP, 3, ax_no_reg, 1, 2, 0));
+        code.emplace_back(make_bru_brc_opcode(AX_EXE_BRU_BLT, -5));
+        code.emplace_back(make_alu_reg_imm_opcode(AX_EXE_ALU_ADD, 3, 2, 5, 0));
+        code.emplace_back(make_movei_opcode(1, 1)); // exit
+        code.emplace_back(make_noop_opcode() | 1u); // nop ; syscall
+        code.emplace_back(make_simple_opcode(AX_EXE_CU_SYSCALL));
+
+        const auto path = write_raw_program("altairx_test_lockstep.bin", code);
+        const AxProgramImage image{path};
+        std::vector<int> results;
+        for(int run = 0; run < 4; ++run)
+        {
+            AltairX vm{2, 8, 8, 8};
+            vm.set_messages(false);
+            vm.set_lockstep(true);
+            vm.set_quantum(1000);
+            vm.load_program(image, "main");
+            results.emplace_back(vm.run(AxExecutionMode::DEFAULT));
+        }
+
+        std::filesystem::remove(path);
+
+        // cores run the same cycles, each quantum the second core overwrites the increments of the first one
+        REQUIRE(results == std::vector<int>(4, count));
+    }
+}
+
+TEST_CASE("Repeated runs", "[vm]")
+{
+    // exit with the code in r2
+    const auto exit_with = [](int32_t code)
+    {
+        return write_raw_program("altairx_test_exit.bin", {
+            make_movei_opcode(2, code),
+            make_movei_opcode(1, 1),
+            make_noop_opcode() | 1u, // nop ; syscall
+            make_simple_opcode(AX_EXE_CU_SYSCALL),
+        });
+    };
+
+    const auto cores = GENERATE(1u, 2u);
+    AltairX vm{cores, 8, 8, 8};
+    vm.set_messages(false);
+
+    const auto path = exit_with(3);
+    vm.load_program(path, "main");
+    REQUIRE(vm.run(AxExecutionMode::DEFAULT) == 3);
+
+    exit_with(5);
+    vm.load_program(path, "main");
+    REQUIRE(vm.run(AxExecutionMode::DEFAULT) == 5);
+
+    std::filesystem::remove(path);
+}
@@ -5,9 +5,14 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <core.hpp>
@@ -27,16 +32,18 @@ enum class SyscallId : uint64_t
     exit = 1,        // code
     stdio_read = 2,  // fb, buf, size
     stdio_write = 3, // fb, buf, size
+    core_id = 4,     // returns the id of the calling core
+    core_count = 5,  // returns the number of cores
 };
 
-std::FILE* id_to_file(uint64_t id)
+std::FILE* id_to_file(uint64_t id, std::FILE* input, std::FILE* output)
 {
     switch(id)
     {
     case 0:
-        return stdin;
+        return input;
     case 1:
-        return stdout;
+        return output;
     case 2:
         return stderr;
     default:
@@ -44,39 +51,90 @@ std::FILE* id_to_file(uint64_t id)
     }
 }
 
-void execute_syscall(AxCore& core)
+const char* backing_name(AxPageBacking backing)
 {
-    uint64_t* const args = &core.registers().gpi[1];
-    const auto intrinsic_id = static_cast<SyscallId>(args[0]);
-    switch(intrinsic_id)
-    {
-    case SyscallId::exit:
+    switch(backing)
     {
-        std::exit(static_cast<int>(args[1]));
+    case AxPageBacking::TRANSPARENT:
+        return "transparent huge pages";
+    case AxPageBacking::HUGE:
+        return "huge pages";
+    default:
+        return "regular pages";
     }
-    case SyscallId::stdio_read:
+}
+
+}
+
+AxProgramImage::AxProgramImage(const std::filesystem::path& path)
+    : m_path{path}
+{
+    std::ifstream file{path, std::ios::binary};
+    if(!file.is_open())
     {
-        void* addr = core.memory().map(core, args[2]);
-        args[0] = std::fread(addr, 1, args[3], id_to_file(args[1]));
-        break;
+        ax_panic("Error : Impossible open file \"", path.string(), "\"");
     }
-    case SyscallId::stdio_write:
+
+    file.seekg(0, std::ios::end);
+    m_content.resize(static_cast<std::size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char*>(m_content.data()), static_cast<std::streamsize>(m_content.size()));
+
+#ifdef AX_HAS_ELF
+    try
     {
-        const void* addr = core.memory().map(core, args[2]);
-        args[0] = std::fwrite(addr, 1, args[3], id_to_file(args[1]));
-        break;
+        m_elf = std::make_shared<const AxELFFile>(m_content.data(), m_content.size());
     }
-    default:
-        ax_panic("Unknown intrinsic #", static_cast<uint64_t>(intrinsic_id));
+    catch(...)
+    {
     }
+#endif
 }
 
+AltairX::AltairX(size_t core_count, size_t nwram, size_t nspmt, size_t nspm2, AxHugePages huge_pages, bool guarded)
+    : m_memory{nwram, nspmt, nspm2, huge_pages, guarded}
+    , m_timer{core_count}
+    , m_uart{stdout}
+    , m_stdio{std::make_unique<AxStdio>()}
+{
+    ax_check(core_count >= 1 && core_count <= AxCore::MAX_CORES, "Core count must be between 1 and ", AxCore::MAX_CORES, ".");
+
+    m_cores.reserve(core_count);
+    for(std::size_t i = 0; i < core_count; ++i)
+    {
+        m_cores.emplace_back(std::make_unique<AxCore>(m_memory, static_cast<uint32_t>(i)));
+    }
+
+    std::vector<AxCore*> cores;
+    for(auto& core : m_cores)
+    {
+        cores.emplace_back(core.get());
+    }
+
+    m_interrupts = std::make_unique<AxInterruptController>(cores);
+    m_timer.set_interrupt_controller(m_interrupts.get());
+    map_device(AxInterruptController::IO_OFFSET, m_interrupts.get());
+    map_device(AxTimer::IO_OFFSET, &m_timer);
+    map_device(AxUart::IO_OFFSET, &m_uart);
+    m_uart.set_input([this]() // one reader of the input, see AxStdio
+    {
+        return m_stdio->get();
+    });
+    map_device(AxPerfCounters::IO_OFFSET, &m_perf_counters);
+    set_dma_config(AxDmaConfig{});
+    m_huge_pages = huge_pages;
 }
 
-AltairX::AltairX(size_t nwram, size_t nspmt, size_t nspm2)
-    : m_memory{nwram, nspmt, nspm2}
-    , m_core{m_memory}
+void AltairX::set_stdio_config(const AxStdioConfig& config, std::FILE* input, std::FILE* output)
 {
+    m_stdio = std::make_unique<AxStdio>(config, input);
+    m_output = output;
+    m_uart.set_output(output);
+    if(m_tracer) // next traces go to the new output
+    {
+        m_tracer = std::make_unique<AxTracer>(main_core(), output);
+        main_core().set_tracer(m_tracer.get());
+    }
 }
 
 void AltairX::load_kernel(const std::filesystem::path& path)
@@ -92,81 +150,522 @@ void AltairX::load_kernel(const std::filesystem::path& path)
     std::streampos filesize = file.tellg();
     file.seekg(0, std::ios::beg);
 
-    void* rom = m_memory.map(m_core, AxMemory::ROM_BEGIN);
+    void* rom = m_memory.map(main_core(), AxMemory::ROM_BEGIN);
     file.read(reinterpret_cast<char*>(rom), filesize);
 }
 
 void AltairX::load_program(const std::filesystem::path& path, std::string_view entry_point_name)
+{
+    load_program(AxProgramImage{path}, entry_point_name);
+}
+
+void AltairX::load_program(const AxProgramImage& image, [[maybe_unused]] std::string_view entry_point_name)
 {
 #ifdef AX_HAS_ELF
     try
     {
-        ax_load_elf_program(m_core, path, entry_point_name);
+        if(!image.elf())
+        {
+            ax_panic("\"", image.path().string(), "\" is not an ELF file.");
+        }
+
+        ax_load_elf_program(main_core(), *image.elf(), entry_point_name);
     }
     catch(...)
     {
-        std::cout << "Program will be run as a raw executable." << std::endl;
+        if(m_messages)
+        {
+            std::fprintf(m_output, "Program will be run as a raw executable.\n");
+            std::fflush(m_output);
+        }
     }
 #endif
 
     // load raw executable file
-    std::ifstream file{path, std::ios::binary};
-    if(!file.is_open())
-    {
-        ax_panic("Error : Impossible open file \"", path.string(), "\"");
-    }
+    const auto content = image.content();
+    ax_check(content.size() <= m_memory.wram_bytesize(), "Not enough memory to load program.");
 
-    file.seekg(0, std::ios::end);
-    std::streampos filesize = file.tellg();
-    file.seekg(0, std::ios::beg);
+    void* wram = m_memory.map(main_core(), AxMemory::WRAM_BEGIN);
+    std::memcpy(wram, content.data(), content.size());
+    main_core().invalidate_code(AxMemory::WRAM_BEGIN, content.size()); // a previous program may have been run
+    main_core().registers().pc = 4;
 
-    void* wram = m_memory.map(m_core, AxMemory::WRAM_BEGIN);
-    file.read(reinterpret_cast<char*>(wram), filesize);
-    m_core.registers().pc = 4;
+    start_secondary_cores();
 }
 
 void AltairX::load_hosted_program(const std::filesystem::path& path, std::span<const std::string_view> argv)
+{
+    load_hosted_program(AxProgramImage{path}, argv);
+}
+
+void AltairX::load_hosted_program([[maybe_unused]] const AxProgramImage& image, [[maybe_unused]] std::span<const std::string_view> argv)
 {
 #ifdef AX_HAS_ELF
-    ax_load_elf_hosted_program(m_core, path, argv);
+    ax_check(image.elf(), "\"", image.path().string(), "\" is not an ELF file.");
+    ax_load_elf_hosted_program(main_core(), *image.elf(), image.path().filename().string(), argv);
+    start_secondary_cores();
 #else
     ax_panic("Host emulation requires a build with ELF enabled!");
 #endif
 }
 
 int AltairX::run(AxExecutionMode mode)
+{
+    if(mode == AxExecutionMode::DEBUG && !m_tracer)
+    {
+        m_tracer = std::make_unique<AxTracer>(main_core(), m_output);
+        main_core().set_tracer(m_tracer.get());
+    }
+
+    if(mode == AxExecutionMode::TIMING && m_timing_models.empty())
+    {
+        for(auto& core : m_cores)
+        {
+            auto& model = m_timing_models.emplace_back(std::make_unique<AxTimingModel>());
+            core->set_timing_model(model.get());
+        }
+    }
+
+    // state of the previous run
+    m_stopping = false;
+    m_cycles = 0;
+    m_exit_code.reset();
+    m_error = 0;
+    m_exception = nullptr;
+    if(m_messages)
+    {
+        report_backing();
+    }
+
+    if(m_cores.size() == 1)
+    {
+        run_core(main_core());
+    }
+    else if(m_lockstep)
+    {
+        m_lockstep_states = std::vector<LockstepState>(m_cores.size());
+        m_lockstep_running = true;
+        for(auto& core : m_cores) // stores are committed at the end of each quantum
+        {
+            core->set_store_buffering(true);
+        }
+
+        std::barrier barrier{static_cast<std::ptrdiff_t>(m_cores.size()), Synchronizer{this}};
+        std::vector<std::thread> threads;
+        threads.reserve(m_cores.size());
+        for(auto& core : m_cores)
+        {
+            threads.emplace_back(&AltairX::run_core_lockstep, this, std::ref(*core), std::ref(barrier));
+        }
+
+        for(auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        for(auto& core : m_cores)
+        {
+            core->set_store_buffering(false);
+        }
+    }
+    else
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(m_cores.size());
+        for(auto& core : m_cores)
+        {
+            threads.emplace_back(&AltairX::run_core, this, std::ref(*core));
+        }
+
+        for(auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    m_stdio->flush();
+    if(m_exception)
+    {
+        std::rethrow_exception(std::exchange(m_exception, nullptr));
+    }
+
+    for(std::size_t i = 0; i < m_cache_models.size(); ++i)
+    {
+        std::fprintf(m_output, "Core %zu caches:\n", i);
+        m_cache_models[i]->report(*m_cores[i], m_output);
+    }
+
+    for(std::size_t i = 0; i < m_timing_models.size(); ++i)
+    {
+        std::fprintf(m_output, "Core %zu timing:\n", i);
+        m_timing_models[i]->report(m_output);
+    }
+
+    std::fflush(m_output);
+
+    return m_exit_code ? *m_exit_code : m_error;
+}
+
+void AltairX::enable_cache_model(const AxCacheConfig& icache, const AxCacheConfig& dcache)
+{
+    m_cache_models.clear();
+    for(auto& core : m_cores)
+    {
+        auto& model = m_cache_models.emplace_back(std::make_unique<AxCacheModel>(icache, dcache));
+        core->set_cache_model(model.get());
+    }
+}
+
+void AltairX::set_dma_config(const AxDmaConfig& config)
+{
+    // map the new engine before the old one is destroyed
+    auto dma = std::make_unique<AxDma>(m_cores.size(), config);
+    dma->set_interrupt_controller(m_interrupts.get());
+    map_device(AxDma::IO_OFFSET, dma.get());
+    m_dma = std::move(dma);
+}
+
+void AltairX::map_device(uint64_t io_offset, AxDevice* device)
+{
+    m_memory.map_device(AxMemory::IO_BEGIN + io_offset, AxMemory::PAGE_SIZE, device);
+    for(auto& core : m_cores)
+    {
+        core->flush_tlb();
+    }
+}
+
+void AltairX::start_secondary_cores()
+{
+    const auto& registers = main_core().registers();
+    const auto stacks_begin = AxMemory::WRAM_BEGIN + m_memory.wram_bytesize() - (m_cores.size() - 1) * SECONDARY_STACK_SIZE;
+    ax_check(m_cores.size() == 1 || registers.gpi[0] < stacks_begin,
+        "WRAM is too short to allocate the stacks of ", m_cores.size(), " cores.");
+
+    for(std::size_t i = 1; i < m_cores.size(); ++i)
+    {
+        m_cores[i]->registers() = registers;
+        m_cores[i]->registers().gpi[0] = stacks_begin + i * SECONDARY_STACK_SIZE - 8;
+    }
+}
+
+void AltairX::run_core(AxCore& core)
 {
     using clock = std::chrono::steady_clock;
     using seconds = std::chrono::duration<double>;
 
-    static constexpr std::size_t threshold = 1024 * 1024;
+    try
+    {
+        auto tp1 = clock::now();
+        uint64_t counter = 0;
+        std::chrono::microseconds backoff{};
+        while(!m_stopping.load(std::memory_order_relaxed))
+        {
+            // this only returns for syscalls, errors, stop requests, idleness or after a quantum, or for the next timer interrupt
+            const auto result = core.run_for(std::min(m_quantum, m_timer.cycles_until_interrupt(core)));
+            m_timer.update(core);
+            if(result.reason == AxStopReason::SYSCALL)
+            {
+                std::lock_guard lock{m_syscall_mutex};
+                core.syscall(&AltairX::execute_syscall, this, core);
+            }
+            else if(result.reason == AxStopReason::ERROR)
+            {
+                std::lock_guard lock{m_syscall_mutex};
+                report_error(core);
+            }
+
+            if(result.reason == AxStopReason::IDLE)
+            {
+                wait_idle(core, backoff);
+            }
+            else
+            {
+                backoff = {};
+            }
+
+            m_cycles.fetch_add(result.cycles, std::memory_order_relaxed);
 
-    auto tp1 = clock::now();
-    std::size_t counter = 0;
-    std::size_t cycles = 0;
-    while(m_core.error() == 0)
+            // first core displays frequency of all cores, only check each few cycles...
+            counter += result.cycles;
+            if(m_messages && core.id() == 0 && counter >= DEFAULT_QUANTUM)
+            {
+                const auto tp2 = clock::now();
+                const auto delta = std::chrono::duration_cast<seconds>(tp2 - tp1).count();
+                if(delta > 1.0) // ...and display if more than one second elapsed
+                {
+                    const auto frequency = static_cast<double>(m_cycles.exchange(0, std::memory_order_relaxed)) / delta;
+                    std::fprintf(m_output, "Frequence : %gMHz\n", frequency / 1'000'000.0); // no flush
+
+                    tp1 = clock::now();
+                }
+
+                counter = 0;
+            }
+        }
+    }
+    catch(...)
     {
-        m_core.cycle();
-        m_core.syscall(execute_syscall, m_core);
+        std::lock_guard lock{m_syscall_mutex};
+        if(!m_exception)
+        {
+            m_exception = std::current_exception();
+        }
 
-        counter += 1;
-        cycles += 1;
-        if(counter > threshold) // only check each few cycles...
+        stop();
+    }
+}
+
+void AltairX::run_core_lockstep(AxCore& core, std::barrier<Synchronizer>& barrier)
+{
+    while(m_lockstep_running)
+    {
+        try
+        {
+            run_quantum(core);
+        }
+        catch(...)
         {
-            const auto tp2 = clock::now();
-            const auto delta = std::chrono::duration_cast<seconds>(tp2 - tp1).count();
-            if(delta > 1.0) // ...and display if more than one second elapsed...
             {
-                double frequency = static_cast<double>(cycles) / delta;
-                std::cout << "Frequence : " << frequency / 1'000'000.0 << "MHz\n"; // no flush
+                std::lock_guard lock{m_syscall_mutex};
+                if(!m_exception)
+                {
+                    m_exception = std::current_exception();
+                }
+            }
+
+            stop();
+            barrier.arrive_and_drop();
+            return;
+        }
+
+        barrier.arrive_and_wait();
+    }
+}
+
+void AltairX::run_quantum(AxCore& core)
+{
+    uint64_t cycles = 0;
+    while(cycles < m_quantum)
+    {
+        const auto result = core.run_for(std::min(m_quantum - cycles, m_timer.cycles_until_interrupt(core)));
+        cycles += result.cycles;
+        m_timer.update(core);
+        if(result.reason == AxStopReason::SYSCALL)
+        {
+            // syscalls with effects outside of the core wait for the end of the quantum, output is buffered
+            const auto id = static_cast<SyscallId>(core.registers().gpi[1]);
+            if(id != SyscallId::stdio_write && id != SyscallId::core_id && id != SyscallId::core_count)
+            {
+                return;
+            }
+
+            core.syscall(&AltairX::execute_syscall, this, core);
+        }
+        else if(result.reason == AxStopReason::ERROR)
+        {
+            m_lockstep_states[core.id()].error = true;
+            return;
+        }
+        else if(result.reason == AxStopReason::IDLE)
+        {
+            // parking would block other cores at the barrier, skip cycles and let the thread wait there instead
+            const auto skipped = std::min(m_quantum - cycles, m_timer.cycles_until_interrupt(core));
+            core.registers().cc += static_cast<uint32_t>(skipped);
+            cycles += skipped;
+            m_timer.update(core);
+        }
+        else if(result.reason != AxStopReason::CYCLES)
+        {
+            return;
+        }
+    }
+}
+
+void AltairX::wait_idle(AxCore& core, std::chrono::microseconds& backoff)
+{
+    const auto cycles = m_timer.cycles_until_interrupt(core);
+    if(cycles != ~0ull)
+    {
+        core.registers().cc += static_cast<uint32_t>(cycles);
+        m_timer.update(core);
+    }
+    else if(core.halted())
+    {
+        core.wait_for_interrupt();
+    }
+    else
+    {
+        // stores of other cores do not wake the thread
+        backoff = std::clamp(backoff * 2, MIN_IDLE_BACKOFF, MAX_IDLE_BACKOFF);
+        std::this_thread::sleep_for(backoff);
+    }
+}
+
+void AltairX::synchronize() noexcept
+{
+    try
+    {
+        for(auto& core : m_cores)
+        {
+            core->commit_stores();
+        }
+
+        for(auto& core : m_cores)
+        {
+            auto& state = m_lockstep_states[core->id()];
+            for(auto& [file, bytes] : state.output)
+            {
+                m_stdio->write(file, bytes.data(), bytes.size());
+            }
+
+            state.output.clear();
+            if(state.error)
+            {
+                state.error = false;
+                report_error(*core);
+            }
+            else
+            {
+                core->syscall(&AltairX::execute_syscall, this, *core);
+            }
+        }
+    }
+    catch(...)
+    {
+        std::lock_guard lock{m_syscall_mutex};
+        if(!m_exception)
+        {
+            m_exception = std::current_exception();
+        }
+
+        stop();
+    }
+
+    m_lockstep_running = !m_stopping.load(std::memory_order_relaxed);
+}
+
+void AltairX::report_backing()
+{
+    if(m_huge_pages != AxHugePages::NONE)
+    {
+        std::fprintf(m_output, "WRAM backing: %s\n", backing_name(m_memory.wram_backing()));
+    }
+
+    if(m_huge_pages == AxHugePages::WRAM_SPM2)
+    {
+        std::fprintf(m_output, "SPM2 backing: %s\n", backing_name(m_memory.spm2_backing()));
+    }
+
+    std::fflush(m_output);
+}
+
+void AltairX::report_error(AxCore& core)
+{
+    if(core.error() == AxCore::ERROR_MEMORY_FAULT)
+    {
+        m_stdio->flush(); // guest output first
+        std::cerr << "Memory fault on core " << core.id() << " at address 0x" << std::hex << core.fault_address()
+                  << ", PC 0x" << (core.registers().pc & 0x7FFFFFFF) * 4 << std::dec << std::endl;
+    }
+
+    m_error = core.error();
+    stop();
+}
+
+void AltairX::execute_syscall(AxCore& core)
+{
+    uint64_t* const args = &core.registers().gpi[1];
+    const auto intrinsic_id = static_cast<SyscallId>(args[0]);
+    switch(intrinsic_id)
+    {
+    case SyscallId::exit:
+    {
+        if(!m_exit_code) // first core to exit gives the code
+        {
+            m_exit_code = static_cast<int>(args[1]);
+        }
+
+        stop();
+        break;
+    }
+    case SyscallId::stdio_read:
+    {
+        if(!check_buffer(core, args[2], args[3]))
+        {
+            break;
+        }
 
-                tp1 = clock::now();
-                cycles = 0;
+        void* addr = core.memory().map(core, args[2]);
+        args[0] = m_stdio->read(id_to_file(args[1], m_stdio->input(), m_output), addr, args[3]);
+        core.invalidate_code(args[2], args[0]);
+        break;
+    }
+    case SyscallId::stdio_write:
+    {
+        if(!check_buffer(core, args[2], args[3]))
+        {
+            break;
+        }
+
+        if(m_lockstep && m_cores.size() > 1) // written at the end of the quantum
+        {
+            auto& output = m_lockstep_states[core.id()].output;
+            auto* const file = id_to_file(args[1], m_stdio->input(), m_output);
+            if(output.empty() || output.back().first != file)
+            {
+                output.emplace_back(file, std::string{});
             }
 
-            counter = 0;
+            // the buffer may hold stores of the core that are not committed yet
+            auto& bytes = output.back().second;
+            const auto size = bytes.size();
+            bytes.resize(size + args[3]);
+            core.read_memory(args[2], bytes.data() + size, args[3]);
+            args[0] = args[3];
+            break;
+        }
+
+        const auto* addr = static_cast<const char*>(core.memory().map(core, args[2]));
+        args[0] = m_stdio->write(id_to_file(args[1], m_stdio->input(), m_output), addr, args[3]);
+        if(m_tracer) // keep output in order with the trace
+        {
+            m_stdio->flush();
         }
+
+        break;
+    }
+    case SyscallId::core_id:
+    {
+        args[0] = core.id();
+        break;
     }
+    case SyscallId::core_count:
+    {
+        args[0] = m_cores.size();
+        break;
+    }
+    default:
+        ax_panic("Unknown intrinsic #", static_cast<uint64_t>(intrinsic_id));
+    }
+}
 
-    return m_core.error();
+bool AltairX::check_buffer(AxCore& core, uint64_t addr, uint64_t size) noexcept
+{
+    const auto available = core.memory().contiguous_size(addr);
+    if(size > available)
+    {
+        core.raise_memory_fault(addr + available);
+        return false;
+    }
+
+    return true;
+}
+
+void AltairX::stop() noexcept
+{
+    m_stopping.store(true, std::memory_order_relaxed);
+    for(auto& core : m_cores)
+    {
+        core->request_stop();
+    }
 }
@@ -6,37 +6,235 @@
 
 #include <cstdint>
 #include <array>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cstdio>
+#include <exception>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <memory.hpp>
 #include <core.hpp>
+#include <trace.hpp>
+#include <cache.hpp>
+#include <timing.hpp>
+#include <device.hpp>
+#include <dma.hpp>
+#include <interrupt.hpp>
+
+#include "stdio.hpp"
+
+class AxELFFile;
+
+// Executable file read once, then loaded by any number of VMs (see AltairX::load_program).
+// It is only read once created, so VMs on different threads can share it.
+class AxProgramImage
+{
+public:
+    // ELF files are parsed if the VM has been built with ELF support
+    explicit AxProgramImage(const std::filesystem::path& path);
+    ~AxProgramImage() = default;
+    AxProgramImage(const AxProgramImage&) = delete;
+    AxProgramImage& operator=(const AxProgramImage&) = delete;
+    AxProgramImage(AxProgramImage&&) noexcept = delete;
+    AxProgramImage& operator=(AxProgramImage&&) noexcept = delete;
+
+    const std::filesystem::path& path() const noexcept
+    {
+        return m_path;
+    }
+
+    // content of the file, for raw executables
+    std::span<const uint8_t> content() const noexcept
+    {
+        return m_content;
+    }
+
+    // nullptr if the file is not a valid ELF file
+    const AxELFFile* elf() const noexcept
+    {
+        return m_elf.get();
+    }
+
+private:
+    std::filesystem::path m_path;
+    std::vector<uint8_t> m_content;
+    std::shared_ptr<const AxELFFile> m_elf; // AxELFFile is incomplete without ELF support
+};
 
 enum class AxExecutionMode
 {
     DEFAULT = 0,
-    DEBUG = 1
+    DEBUG = 1,
+    TIMING = 2,
 };
 
 class AltairX
 {
 public:
-    AltairX(size_t nwram, size_t nspmt, size_t nspm2);
+    static constexpr uint64_t DEFAULT_QUANTUM = 1024 * 1024;
+    // stack of each core but the first one, at the end of WRAM
+    static constexpr uint64_t SECONDARY_STACK_SIZE = 0x100000;
+    // sleeps of a core spinning on memory, doubled while it stays idle
+    static constexpr std::chrono::microseconds MIN_IDLE_BACKOFF{1};
+    static constexpr std::chrono::microseconds MAX_IDLE_BACKOFF{1000};
+
+    // core_count cores share the memory, each one is run by its own host thread.
+    // Backing of huge pages regions is reported on the output at the start of run(), see set_messages
+    // guarded: out of bounds guest accesses stop the VM with a memory fault, see AxMemory
+    AltairX(size_t core_count, size_t nwram, size_t nspmt, size_t nspm2, AxHugePages huge_pages = AxHugePages::NONE, bool guarded = false);
+
+    // Programs are loaded by the first core, others start with the same registers but their own stack.
+    // Guest code can get the core id with a syscall.
 
     // load an ELF file and put PC at specified entry point location
     void load_program(const std::filesystem::path& path, std::string_view entry_point_name);
+    void load_program(const AxProgramImage& image, std::string_view entry_point_name);
 
     // load an ELF file
     // See ax_load_elf_hosted_program
     void load_hosted_program(const std::filesystem::path& path, std::span<const std::string_view> argv);
+    void load_hosted_program(const AxProgramImage& image, std::span<const std::string_view> argv);
 
     // tbd
     void load_kernel(const std::filesystem::path& path);
 
+    void set_dispatch(AxDispatch dispatch) noexcept
+    {
+        for(auto& core : m_cores)
+        {
+            core->set_dispatch(dispatch);
+        }
+    }
+
+    void set_jit_enabled(bool enabled)
+    {
+        for(auto& core : m_cores)
+        {
+            core->set_jit_enabled(enabled);
+        }
+    }
+
+    // Simulate L1 caches of each core, statistics are reported on the output at the end of run().
+    // Cores then run cycle by cycle, without JIT.
+    void enable_cache_model(const AxCacheConfig& icache, const AxCacheConfig& dcache);
+
+    // Devices mapped in the IO region: timer, UART (on the output and input, see set_stdio_config), DMA engine, performance counters
+    // and interrupt controller, see device.hpp. DMA and timer interrupts go through the controller.
+    // The DMA engine is created again with the given configuration.
+    void set_dma_config(const AxDmaConfig& config);
+
+    // Guest stdio (stdio_read and stdio_write syscalls) is buffered and written by an I/O thread, see AxStdio.
+    // Output of the UART device does not go through it and is not ordered with guest stdio output.
+    // input replaces the host stdin for the guest and the UART, it is not owned. Both read it through AxStdio.
+    // output replaces the host stdout for the guest, the UART, traces, reports and messages of the VM, it is not owned.
+    // Must not be called while the VM runs, pending output is written first.
+    void set_stdio_config(const AxStdioConfig& config, std::FILE* input = stdin, std::FILE* output = stdout);
+
+    // Informational messages on the output: emulated frequency every second while running,
+    // huge pages backing and raw executables. Enabled by default.
+    void set_messages(bool enabled) noexcept
+    {
+        m_messages = enabled;
+    }
+
+    // Cycles a core runs between two checks of the VM state (stop, statistics).
+    // Syscalls are serialized between cores, the exit syscall stops all cores.
+    void set_quantum(uint64_t quantum) noexcept
+    {
+        m_quantum = quantum;
+    }
+
+    // Deterministic multi-core runs: each core runs a quantum (see set_quantum), then all cores wait for each other.
+    // Stores of a core to memory are buffered (see AxCore::set_store_buffering), other cores see them after the quantum.
+    // At the end of a quantum, stores are committed in core order (the last core wins when cores write the same bytes),
+    // then guest output is written and other syscalls are executed, in core order.
+    // Device accesses are not buffered, DMA copies do not see stores of the quantum they are started in.
+    // Host time of AxTimer, async DMA copies (see AxDmaConfig) and interrupts sent by other cores still depend on the host.
+    // Idle cores skip the rest of their quantum, or to their next timer interrupt, instead of parking their thread.
+    void set_lockstep(bool enabled) noexcept
+    {
+        m_lockstep = enabled;
+    }
+
+    // DEBUG mode traces executed bundles of the first core to the output.
+    // TIMING mode runs each core with a timing model, cycles and stalls are reported on the output.
+    // Returns the exit code given by the guest, or the error of the core that stopped the VM
     int run(AxExecutionMode mode);
 
 private:
+    AxCore& main_core() noexcept
+    {
+        return *m_cores.front();
+    }
+
+    void map_device(uint64_t io_offset, AxDevice* device);
+    void start_secondary_cores();
+    // Completion of the lockstep barrier, run by one of the cores threads while others wait
+    struct Synchronizer
+    {
+        AltairX* vm{};
+
+        void operator()() noexcept
+        {
+            vm->synchronize();
+        }
+    };
+
+    // Written by a core thread during a quantum, read at the end of it
+    struct alignas(64) LockstepState
+    {
+        std::vector<std::pair<std::FILE*, std::string>> output{};
+        bool error{};
+    };
+
+    void run_core(AxCore& core);
+    void run_core_lockstep(AxCore& core, std::barrier<Synchronizer>& barrier);
+    void run_quantum(AxCore& core);
+    // Idle core (see AxStopReason::IDLE): fast-forward CC to the next timer interrupt if there is one,
+    // else park the thread until an interrupt wakes the halted core, or sleep while it spins on memory.
+    void wait_idle(AxCore& core, std::chrono::microseconds& backoff);
+    void synchronize() noexcept;
+    void report_backing();
+    void report_error(AxCore& core);
+    void execute_syscall(AxCore& core);
+    // Syscall buffers must be backed by one region, or the core stops with a memory fault like a load or a store
+    static bool check_buffer(AxCore& core, uint64_t addr, uint64_t size) noexcept;
+    void stop() noexcept;
+
     AxMemory m_memory;
-    AxCore m_core;
+    std::vector<std::unique_ptr<AxCore>> m_cores;
+    std::unique_ptr<AxInterruptController> m_interrupts; // outlives devices posting to it
+    AxTimer m_timer;
+    AxUart m_uart;
+    AxPerfCounters m_perf_counters;
+    std::unique_ptr<AxDma> m_dma;
+    std::unique_ptr<AxStdio> m_stdio;
+    std::FILE* m_output{stdout};
+    std::unique_ptr<AxTracer> m_tracer;
+    std::vector<std::unique_ptr<AxCacheModel>> m_cache_models;
+    std::vector<std::unique_ptr<AxTimingModel>> m_timing_models;
+    uint64_t m_quantum{DEFAULT_QUANTUM};
+    AxHugePages m_huge_pages{};
+    bool m_messages{true};
+    bool m_lockstep{};
+    std::vector<LockstepState> m_lockstep_states;
+    bool m_lockstep_running{}; // only changed by synchronize
+
+    // shared by cores threads
+    std::atomic<bool> m_stopping{};
+    std::atomic<uint64_t> m_cycles{}; // since last frequency report
+    std::mutex m_syscall_mutex;
+    std::optional<int> m_exit_code{};
+    int m_error{};
+    std::exception_ptr m_exception{};
 };
 
 #endif
@@ -0,0 +1,202 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <thread>
+
+#include <panic.hpp>
+
+std::vector<AxBatchJob> ax_read_batch_manifest(const std::filesystem::path& path)
+{
+    std::ifstream file{path};
+    if(!file.is_open())
+    {
+        ax_panic("Error : Impossible open batch manifest \"", path.string(), "\"");
+    }
+
+    std::vector<AxBatchJob> output;
+    std::string line;
+    for(std::size_t line_number = 1; std::getline(file, line); ++line_number)
+    {
+        std::istringstream stream{line};
+        std::string expected;
+        std::string executable;
+        if(!(stream >> expected) || expected.front() == '#')
+        {
+            continue;
+        }
+
+        if(!(stream >> executable))
+        {
+            ax_panic("Missing executable in batch manifest, line ", line_number);
+        }
+
+        auto& job = output.emplace_back();
+        job.executable = path.parent_path() / executable;
+        if(expected != "*")
+        {
+            int code{};
+            auto [ptr, error] = std::from_chars(expected.data(), expected.data() + expected.size(), code);
+            if(error != std::errc{} || ptr != expected.data() + expected.size())
+            {
+                ax_panic("Invalid expected exit code \"", expected, "\" in batch manifest, line ", line_number);
+            }
+
+            job.expected_exit = code;
+        }
+
+        bool redirected = false;
+        for(std::string arg; stream >> arg;)
+        {
+            if(arg == "<" || arg == ">")
+            {
+                std::string file;
+                auto& target = arg == "<" ? job.input : job.output;
+                if(!(stream >> file) || !target.empty())
+                {
+                    ax_panic("Invalid redirection in batch manifest, line ", line_number);
+                }
+
+                target = path.parent_path() / file;
+                redirected = true;
+            }
+            else if(redirected)
+            {
+                ax_panic("Redirections must be the last arguments in batch manifest, line ", line_number);
+            }
+            else
+            {
+                job.args.emplace_back(std::move(arg));
+            }
+        }
+    }
+
+    return output;
+}
+
+std::vector<AxBatchResult> ax_run_batch(std::span<const AxBatchJob> jobs, std::size_t thread_count, const AxBatchRunner& runner)
+{
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+
+    std::vector<AxBatchResult> output(jobs.size());
+
+    // executables are read once, before any job runs, then only read
+    std::map<std::filesystem::path, std::unique_ptr<AxProgramImage>> images;
+    std::map<std::filesystem::path, std::string> image_errors;
+    for(const auto& job : jobs)
+    {
+        if(images.contains(job.executable) || image_errors.contains(job.executable))
+        {
+            continue;
+        }
+
+        try
+        {
+            images.emplace(job.executable, std::make_unique<AxProgramImage>(job.executable));
+        }
+        catch(const std::exception& e)
+        {
+            image_errors.emplace(job.executable, e.what());
+        }
+    }
+
+    // jobs are independent: idle threads take the next one
+    std::atomic<std::size_t> next{};
+    const auto work = [&]()
+    {
+        for(auto index = next.fetch_add(1, std::memory_order_relaxed); index < jobs.size(); index = next.fetch_add(1, std::memory_order_relaxed))
+        {
+            const auto& job = jobs[index];
+            auto& result = output[index];
+            const auto begin = clock::now();
+            const auto it = images.find(job.executable);
+            if(it == images.end())
+            {
+                result.error = image_errors.at(job.executable);
+                continue;
+            }
+
+            try
+            {
+                result.exit_code = runner(job, *it->second);
+                result.passed = !job.expected_exit || *job.expected_exit == result.exit_code;
+            }
+            catch(const std::exception& e)
+            {
+                result.error = e.what();
+            }
+
+            result.seconds = std::chrono::duration_cast<seconds>(clock::now() - begin).count();
+        }
+    };
+
+    if(thread_count == 0)
+    {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    std::vector<std::jthread> threads;
+    for(std::size_t i = 1; i < std::min(thread_count, jobs.size()); ++i)
+    {
+        threads.emplace_back(work);
+    }
+
+    work();
+    threads.clear(); // join
+
+    return output;
+}
+
+std::size_t ax_report_batch(std::span<const AxBatchJob> jobs, std::span<const AxBatchResult> results, double seconds, std::ostream& output)
+{
+    std::size_t failed{};
+    for(std::size_t i = 0; i < jobs.size(); ++i)
+    {
+        const auto& job = jobs[i];
+        const auto& result = results[i];
+        failed += result.passed ? 0 : 1;
+
+        output << (result.passed ? "[PASS] " : "[FAIL] ") << job.executable.string();
+        for(const auto& arg : job.args)
+        {
+            output << ' ' << arg;
+        }
+
+        if(!result.error.empty())
+        {
+            output << ": error: " << result.error;
+        }
+        else
+        {
+            output << ": exit " << result.exit_code;
+            if(job.expected_exit)
+            {
+                output << " (expected " << *job.expected_exit << ")";
+            }
+        }
+
+        output << ", " << std::fixed << std::setprecision(3) << result.seconds * 1000.0 << " ms\n";
+    }
+
+    output << jobs.size() - failed << "/" << jobs.size() << " jobs passed in " << std::fixed << std::setprecision(3) << seconds << " s";
+    if(seconds > 0.0)
+    {
+        output << " (" << static_cast<double>(jobs.size()) / seconds << " jobs/s)";
+    }
+
+    output << std::endl;
+    return failed;
+}
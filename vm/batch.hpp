@@ -0,0 +1,50 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef ALTAIRX_BATCH_HPP_INCLUDED
+#define ALTAIRX_BATCH_HPP_INCLUDED
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "altairx.hpp"
+
+struct AxBatchJob
+{
+    std::filesystem::path executable;
+    std::vector<std::string> args;    // forwarded to hosted programs
+    std::optional<int> expected_exit; // any exit code passes if empty
+    std::filesystem::path input;      // guest stdin, jobs do not share the host one, empty input if empty
+    std::filesystem::path output;     // guest stdout, traces and reports of the VM, discarded if empty
+};
+
+struct AxBatchResult
+{
+    int exit_code{};
+    bool passed{};
+    std::string error{}; // VM error, the job failed
+    double seconds{};
+};
+
+// One job per line: "expected_exit executable [args...] [< input] [> output]", expected_exit is an integer or * for any code.
+// Empty lines and lines beginning with # are ignored. Relative paths are relative to the manifest.
+std::vector<AxBatchJob> ax_read_batch_manifest(const std::filesystem::path& path);
+
+// Runs a job with the image of its executable and returns the guest exit code, called concurrently
+using AxBatchRunner = std::function<int(const AxBatchJob& job, const AxProgramImage& image)>;
+
+// Run jobs on thread_count host threads (0 for all hardware threads), in no particular order.
+// Each executable is read and parsed once, its image is shared by all its jobs.
+// Results are in the order of jobs.
+std::vector<AxBatchResult> ax_run_batch(std::span<const AxBatchJob> jobs, std::size_t thread_count, const AxBatchRunner& runner);
+
+// Write one line per job and a summary, returns the number of jobs that did not pass
+std::size_t ax_report_batch(std::span<const AxBatchJob> jobs, std::span<const AxBatchResult> results, double seconds, std::ostream& output);
+
+#endif
@@ -7,10 +7,14 @@
 #include <iostream>
 #include <vector>
 #include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <memory>
 #include <string_view>
 #include <optional>
 
 #include "altairx.hpp"
+#include "batch.hpp"
 
 #include <panic.hpp>
 
@@ -21,6 +25,12 @@
 namespace
 {
 
+#ifdef _WIN32
+constexpr const char* NULL_DEVICE = "NUL";
+#else
+constexpr const char* NULL_DEVICE = "/dev/null";
+#endif
+
 struct AxParameters
 {
     bool gui{};
@@ -28,11 +38,25 @@ struct AxParameters
     std::size_t wram_size{16};
     std::size_t spmt_size{256};
     std::size_t spm2_size{512};
+    AxHugePages huge_pages{};
+    bool guarded{};
+    uint64_t quantum{AltairX::DEFAULT_QUANTUM};
+    bool lockstep{};
+    bool cache_model{};
+    uint32_t cache_line_size{64};
+    uint32_t cache_ways{4};
+    AxCacheReplacement cache_replacement{};
+    bool async_dma{};
+    AxStdioConfig stdio{};
     AxExecutionMode mode{};
+    std::optional<AxDispatch> dispatch{};
+    std::optional<bool> jit{};
     std::filesystem::path executable{};
     std::string entry_point{"main"};
     bool hosted{false};
     std::vector<std::string_view> forwarded_args{};
+    std::filesystem::path batch{};
+    std::size_t batch_threads{};
 };
 
 std::vector<std::string_view> get_args(int argc, char* argv[])
@@ -98,11 +122,77 @@ AxParameters parse_args(int argc, char* argv[])
             output.spm2_size = static_cast<std::size_t>(get_value_for_arg(args, i, args.size()));
             ++i;
         }
+        else if(args[i] == "-hugepages")
+        {
+            output.huge_pages = static_cast<AxHugePages>(get_value_for_arg(args, i, args.size()));
+            ++i;
+        }
+        else if(args[i] == "-quantum")
+        {
+            output.quantum = static_cast<uint64_t>(get_value_for_arg(args, i, args.size()));
+            ++i;
+        }
+        else if(args[i] == "-lockstep")
+        {
+            output.lockstep = true;
+        }
+        else if(args[i] == "-cache")
+        {
+            output.cache_model = true;
+        }
+        else if(args[i] == "-cache-line")
+        {
+            output.cache_line_size = static_cast<uint32_t>(get_value_for_arg(args, i, args.size()));
+            ++i;
+        }
+        else if(args[i] == "-cache-ways")
+        {
+            output.cache_ways = static_cast<uint32_t>(get_value_for_arg(args, i, args.size()));
+            ++i;
+        }
+        else if(args[i] == "-cache-replacement")
+        {
+            output.cache_replacement = static_cast<AxCacheReplacement>(get_value_for_arg(args, i, args.size()));
+            ++i;
+        }
+        else if(args[i] == "-dma-async")
+        {
+            output.async_dma = true;
+        }
+        else if(args[i] == "-stdio-flush")
+        {
+            output.stdio.flush = static_cast<AxStdioFlush>(get_value_for_arg(args, i, args.size()));
+            ++i;
+        }
+        else if(args[i] == "-stdio-interval")
+        {
+            output.stdio.interval = std::chrono::milliseconds{get_value_for_arg(args, i, args.size())};
+            ++i;
+        }
+        else if(args[i] == "-stdio-prefetch")
+        {
+            output.stdio.prefetch_size = static_cast<std::size_t>(get_value_for_arg(args, i, args.size())) * 1024;
+            ++i;
+        }
+        else if(args[i] == "-guard")
+        {
+            output.guarded = true;
+        }
         else if(args[i] == "-mode")
         {
             output.mode = static_cast<AxExecutionMode>(get_value_for_arg(args, i, args.size()));
             ++i;
         }
+        else if(args[i] == "-dispatch")
+        {
+            output.dispatch = static_cast<AxDispatch>(get_value_for_arg(args, i, args.size()));
+            ++i;
+        }
+        else if(args[i] == "-jit")
+        {
+            output.jit = get_value_for_arg(args, i, args.size()) != 0;
+            ++i;
+        }
         else if(args[i] == "-entry-point")
         {
             if(i == args.size() - 1) // last arg
@@ -113,6 +203,21 @@ AxParameters parse_args(int argc, char* argv[])
             output.entry_point = std::string{argv[i + 1]};
             ++i;
         }
+        else if(args[i] == "-batch")
+        {
+            if(i == args.size() - 1) // last arg
+            {
+                ax_panic("Expected value for ", args[i]);
+            }
+
+            output.batch = args[i + 1];
+            ++i;
+        }
+        else if(args[i] == "-batch-threads")
+        {
+            output.batch_threads = static_cast<std::size_t>(get_value_for_arg(args, i, args.size()));
+            ++i;
+        }
         else if(args[i] == "-hosted")
         {
             output.hosted = true;
@@ -133,7 +238,7 @@ AxParameters parse_args(int argc, char* argv[])
         }
     }
 
-    if(output.executable.empty() && !output.gui)
+    if(output.executable.empty() && output.batch.empty() && !output.gui)
     {
         ax_panic("Missing executable file");
     }
@@ -149,21 +254,135 @@ AxParameters parse_args(int argc, char* argv[])
 void print_usage()
 {
     std::cout << "Usage: vm_altairx [options] executable_file [-- args...]\n";
+    std::cout << "       vm_altairx [options] -batch manifest\n";
     std::cout << "Options:\n";
     std::cout << "    Core count: -ncore N\n";
+    std::cout << "    Cycles run by a core between VM state checks: -quantum N\n";
+    std::cout << "    Deterministic multi-core runs, cores synchronize after each quantum: -lockstep\n";
     std::cout << "    WRAM size (MiB): -wram N\n";
     std::cout << "    SPMT size (KiB): -spmt N\n";
     std::cout << "    SPM2 size (KiB): -spm2 N\n";
+    std::cout << "    Huge pages: -hugepages N\n";
+    std::cout << "        0: none\n";
+    std::cout << "        1: WRAM\n";
+    std::cout << "        2: WRAM and SPM2\n";
+    std::cout << "    Guard pages, out of bounds accesses fault: -guard\n";
+    std::cout << "    Simulate L1 caches and report statistics: -cache\n";
+    std::cout << "        Line size (bytes): -cache-line N\n";
+    std::cout << "        Associativity: -cache-ways N\n";
+    std::cout << "        Replacement: -cache-replacement N\n";
+    std::cout << "            0: LRU\n";
+    std::cout << "            1: FIFO\n";
+    std::cout << "            2: random\n";
+    std::cout << "    DMA copies on helper threads: -dma-async\n";
+    std::cout << "    Guest stdio output: -stdio-flush N\n";
+    std::cout << "        0: written by the core during the syscall\n";
+    std::cout << "        1: written by an I/O thread as soon as possible\n";
+    std::cout << "        2: written by an I/O thread when its buffer is half full or after an interval (default)\n";
+    std::cout << "        Interval (ms, default 20): -stdio-interval N\n";
+    std::cout << "    Guest stdin read ahead (KiB, 0 to disable): -stdio-prefetch N\n";
     std::cout << "    Execution mode: -mode N\n";
-    std::cout << "        Mode 0: console, syscall emulate, 1 core only\n";
-    std::cout << "        Mode 1: mode 0 + debug\n";
-    // std::cout << "        Mode 2: same mode 0 and cycle accurate\n";
+    std::cout << "        Mode 0: console, syscall emulate\n";
+    std::cout << "        Mode 1: mode 0 + execution trace of core 0\n";
+    std::cout << "        Mode 2: mode 0 + cycle-approximate timing, stalls are reported (cache misses with -cache)\n";
     // std::cout << "        Mode 3: complete hardware\n";
     // std::cout << "        Mode 4: XSTAR OS\n";
+    std::cout << "    Dispatch engine: -dispatch N\n";
+    std::cout << "        0: switch\n";
+    std::cout << "        1: threaded\n";
+    std::cout << "    JIT compiler (x86-64 only): -jit 0|1\n";
+    std::cout << "    Run the jobs of a manifest, one VM per job: -batch manifest\n";
+    std::cout << "        Each line is \"expected_exit executable [args...] [< input] [> output]\", expected_exit is * for any\n";
+    std::cout << "        Jobs read input from the given file, or an empty input\n";
+    std::cout << "        Jobs write output, traces and reports to the given file, or discard them\n";
+    std::cout << "        Host threads: -batch-threads N (default: all)\n";
 
     std::cout << std::endl; // flush and newline!
 }
 
+void configure_vm(AltairX& altairx, const AxParameters& parameters)
+{
+    altairx.set_quantum(parameters.quantum);
+    altairx.set_lockstep(parameters.lockstep);
+    altairx.set_stdio_config(parameters.stdio);
+    if(parameters.cache_model)
+    {
+        auto icache = AxCacheModel::default_icache();
+        auto dcache = AxCacheModel::default_dcache();
+        for(auto* config : {&icache, &dcache})
+        {
+            config->line_size = parameters.cache_line_size;
+            config->ways = parameters.cache_ways;
+            config->replacement = parameters.cache_replacement;
+        }
+
+        altairx.enable_cache_model(icache, dcache);
+    }
+
+    if(parameters.async_dma)
+    {
+        AxDmaConfig config{};
+        config.async = true;
+        altairx.set_dma_config(config);
+    }
+
+    if(parameters.dispatch)
+    {
+        altairx.set_dispatch(*parameters.dispatch);
+    }
+
+    if(parameters.jit)
+    {
+        altairx.set_jit_enabled(*parameters.jit);
+    }
+}
+
+int run_batch(const AxParameters& parameters)
+{
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+
+    const auto jobs = ax_read_batch_manifest(parameters.batch);
+    const auto begin = clock::now();
+    const auto results = ax_run_batch(jobs, parameters.batch_threads, [&parameters](const AxBatchJob& job, const AxProgramImage& image)
+    {
+        // jobs run concurrently: they do not use the host stdin, and only the batch report goes to stdout
+        using file_ptr = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+        file_ptr input{std::fopen(job.input.empty() ? NULL_DEVICE : job.input.string().c_str(), "rb"), &std::fclose};
+        if(!input)
+        {
+            ax_panic("Error : Impossible open input \"", job.input.string(), "\"");
+        }
+
+        file_ptr output{std::fopen(job.output.empty() ? NULL_DEVICE : job.output.string().c_str(), "wb"), &std::fclose};
+        if(!output)
+        {
+            ax_panic("Error : Impossible open output \"", job.output.string(), "\"");
+        }
+
+        AltairX altairx{parameters.core_count, parameters.wram_size, parameters.spmt_size, parameters.spm2_size, parameters.huge_pages, parameters.guarded};
+        configure_vm(altairx, parameters);
+        auto stdio = parameters.stdio;
+        stdio.prefetch_size = 0; // no helper thread may outlive the job with its input
+        altairx.set_stdio_config(stdio, input.get(), output.get());
+        altairx.set_messages(false);
+        if(parameters.hosted)
+        {
+            const std::vector<std::string_view> argv{job.args.begin(), job.args.end()};
+            altairx.load_hosted_program(image, argv);
+        }
+        else
+        {
+            altairx.load_program(image, parameters.entry_point);
+        }
+
+        return altairx.run(parameters.mode);
+    });
+
+    const auto elapsed = std::chrono::duration_cast<seconds>(clock::now() - begin).count();
+    return ax_report_batch(jobs, results, elapsed, std::cout) == 0 ? 0 : 1;
+}
+
 int run_vm(const AxParameters& parameters)
 {
     if(parameters.gui)
@@ -177,7 +396,14 @@ int run_vm(const AxParameters& parameters)
 #endif
     }
 
-    AltairX altairx{parameters.wram_size, parameters.spmt_size, parameters.spm2_size};
+    if(!parameters.batch.empty())
+    {
+        return run_batch(parameters);
+    }
+
+    AltairX altairx{parameters.core_count, parameters.wram_size, parameters.spmt_size, parameters.spm2_size, parameters.huge_pages, parameters.guarded};
+    configure_vm(altairx, parameters);
+
     if(parameters.hosted)
     {
         altairx.load_hosted_program(parameters.executable, parameters.forwarded_args);
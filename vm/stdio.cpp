@@ -0,0 +1,270 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#include "stdio.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include <panic.hpp>
+
+AxStdio::AxStdio(const AxStdioConfig& config, std::FILE* input)
+    : m_config{config}
+    , m_ring(config.flush != AxStdioFlush::SYNC ? config.buffer_size : 0)
+    , m_input{std::make_shared<Input>()}
+{
+    ax_check(config.flush == AxStdioFlush::SYNC || config.buffer_size != 0, "Guest output buffer can not be empty.");
+
+    m_input->file = input;
+    m_input->capacity = config.prefetch_size;
+}
+
+AxStdio::~AxStdio()
+{
+    if(m_thread.joinable())
+    {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stopping = true;
+        }
+
+        m_condition.notify_all();
+        m_thread.join();
+    }
+
+    std::lock_guard lock{m_input->mutex};
+    if(m_prefetch_thread.joinable())
+    {
+        // the thread may be blocked reading input for a long time, it owns a reference to the state
+        m_input->stopping = true;
+        m_input->condition.notify_all();
+        m_prefetch_thread.detach();
+    }
+}
+
+std::size_t AxStdio::write(std::FILE* file, const void* data, std::size_t size)
+{
+    if(m_config.flush == AxStdioFlush::SYNC)
+    {
+        return std::fwrite(data, 1, size, file);
+    }
+
+    const auto* bytes = static_cast<const char*>(data);
+    std::unique_lock lock{m_mutex};
+    if(!m_thread.joinable())
+    {
+        m_thread = std::thread{&AxStdio::work, this};
+    }
+
+    auto remaining = size;
+    while(remaining != 0)
+    {
+        m_condition.wait(lock, [this]()
+        {
+            return m_used < m_ring.size();
+        });
+
+        // copy to the free part of the ring, it may wrap around
+        const auto count = std::min(remaining, m_ring.size() - m_used);
+        const auto tail = (m_head + m_used) % m_ring.size();
+        const auto first = std::min(count, m_ring.size() - tail);
+        std::memcpy(m_ring.data() + tail, bytes, first);
+        std::memcpy(m_ring.data(), bytes + first, count - first);
+        m_used += count;
+
+        if(!m_chunks.empty() && m_chunks.back().first == file)
+        {
+            m_chunks.back().second += count;
+        }
+        else
+        {
+            m_chunks.emplace_back(file, count);
+        }
+
+        bytes += count;
+        remaining -= count;
+        if(m_config.flush == AxStdioFlush::ASYNC || remaining != 0 || m_used >= m_ring.size() / 2)
+        {
+            m_condition.notify_all();
+        }
+    }
+
+    return size;
+}
+
+std::size_t AxStdio::read(std::FILE* file, void* data, std::size_t size)
+{
+    if(file != m_input->file || m_config.prefetch_size == 0)
+    {
+        return std::fread(data, 1, size, file);
+    }
+
+    auto* bytes = static_cast<char*>(data);
+    std::unique_lock lock{m_input->mutex};
+    if(!m_prefetch_thread.joinable())
+    {
+        m_prefetch_thread = std::thread{&AxStdio::prefetch, m_input};
+    }
+
+    std::size_t count = 0;
+    while(count < size)
+    {
+        m_input->condition.wait(lock, [this]()
+        {
+            return !m_input->bytes.empty() || m_input->eof;
+        });
+
+        const auto available = std::min(size - count, m_input->bytes.size());
+        if(available == 0) // end of file
+        {
+            break;
+        }
+
+        std::copy_n(m_input->bytes.begin(), available, bytes + count);
+        m_input->bytes.erase(m_input->bytes.begin(), m_input->bytes.begin() + static_cast<std::ptrdiff_t>(available));
+        count += available;
+        m_input->condition.notify_all();
+    }
+
+    return count;
+}
+
+int AxStdio::get()
+{
+    char byte{};
+    return read(m_input->file, &byte, 1) == 1 ? static_cast<unsigned char>(byte) : EOF;
+}
+
+void AxStdio::flush()
+{
+    std::unique_lock lock{m_mutex};
+    if(!m_thread.joinable())
+    {
+        return;
+    }
+
+    ++m_flushing;
+    m_condition.notify_all();
+    m_condition.wait(lock, [this]()
+    {
+        return m_chunks.empty() && !m_writing;
+    });
+
+    --m_flushing;
+}
+
+void AxStdio::work()
+{
+    std::unique_lock lock{m_mutex};
+    while(true)
+    {
+        const auto ready = [this]()
+        {
+            if(m_stopping)
+            {
+                return true;
+            }
+
+            const bool now = m_flushing != 0 || m_config.flush == AxStdioFlush::ASYNC;
+            return now ? !m_chunks.empty() : m_used >= m_ring.size() / 2;
+        };
+
+        if(m_config.flush == AxStdioFlush::INTERVAL)
+        {
+            m_condition.wait_for(lock, m_config.interval, ready);
+        }
+        else
+        {
+            m_condition.wait(lock, ready);
+        }
+
+        if(m_chunks.empty())
+        {
+            if(m_stopping)
+            {
+                return;
+            }
+
+            continue;
+        }
+
+        // chunks are written without the lock, writers only fill the free part of the ring meanwhile
+        const auto chunks = std::exchange(m_chunks, {});
+        auto position = m_head;
+        m_writing = true;
+        lock.unlock();
+
+        std::size_t written = 0;
+        std::array<std::FILE*, 4> files{};
+        for(const auto& [file, size] : chunks)
+        {
+            const auto first = std::min(size, m_ring.size() - position);
+            std::fwrite(m_ring.data() + position, 1, first, file);
+            std::fwrite(m_ring.data(), 1, size - first, file);
+            position = (position + size) % m_ring.size();
+            written += size;
+
+            // files are flushed once all chunks are written
+            if(std::find(files.begin(), files.end(), file) == files.end())
+            {
+                const auto it = std::find(files.begin(), files.end(), nullptr);
+                if(it != files.end())
+                {
+                    *it = file;
+                }
+                else
+                {
+                    std::fflush(file);
+                }
+            }
+        }
+
+        for(auto* file : files)
+        {
+            if(file)
+            {
+                std::fflush(file);
+            }
+        }
+
+        lock.lock();
+        m_head = position;
+        m_used -= written;
+        m_writing = false;
+        m_condition.notify_all();
+    }
+}
+
+void AxStdio::prefetch(std::shared_ptr<Input> input)
+{
+    while(true)
+    {
+        {
+            std::unique_lock lock{input->mutex};
+            input->condition.wait(lock, [&input]()
+            {
+                return input->stopping || input->bytes.size() < input->capacity;
+            });
+
+            if(input->stopping)
+            {
+                return;
+            }
+        }
+
+        // bytes go through the FILE buffer, and are published one by one since the next one may not come soon
+        const auto byte = std::fgetc(input->file);
+
+        std::lock_guard lock{input->mutex};
+        if(byte == EOF)
+        {
+            input->eof = true;
+            input->condition.notify_all();
+            return;
+        }
+
+        input->bytes.push_back(static_cast<char>(byte));
+        input->condition.notify_all();
+    }
+}
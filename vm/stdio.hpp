@@ -0,0 +1,110 @@
+// Copyright (c) Kannagi, Alexy Pellegrini
+// MIT License, see LICENSE for details
+
+#ifndef ALTAIRX_STDIO_HPP_INCLUDED
+#define ALTAIRX_STDIO_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum class AxStdioFlush
+{
+    SYNC = 0,     // written by the emulation thread during the syscall
+    ASYNC = 1,    // written by the I/O thread as soon as it wakes up
+    INTERVAL = 2, // written by the I/O thread once half of the buffer is used, or after an interval
+};
+
+struct AxStdioConfig
+{
+    AxStdioFlush flush = AxStdioFlush::INTERVAL;
+    // pending output, writers block while it is full
+    std::size_t buffer_size = 1024 * 1024;
+    std::chrono::milliseconds interval{20};
+    // input read ahead by a helper thread, 0 reads on the emulation thread
+    std::size_t prefetch_size = 64 * 1024;
+};
+
+// Guest stdio of a VM, see the stdio_read and stdio_write syscalls.
+// Output of all files goes through one ring buffer so it is written in order, by an I/O thread
+// started on the first write. Reads of input are served from bytes a helper thread read ahead,
+// it is started on the first read so input is not consumed if the guest never reads it.
+// Input must only be read through this class (the UART device uses get), else bytes are split between readers.
+// Input read ahead and not consumed by the guest is lost when this is destroyed: up to prefetch_size bytes,
+// plus one byte if the helper thread is blocked reading.
+// Other users of the host files (UART device, VM messages) should call flush first to keep output in order.
+class AxStdio
+{
+public:
+    // input is not owned, reads of other files are done on the calling thread
+    explicit AxStdio(const AxStdioConfig& config = AxStdioConfig{}, std::FILE* input = stdin);
+    ~AxStdio(); // pending output is written
+    AxStdio(const AxStdio&) = delete;
+    AxStdio& operator=(const AxStdio&) = delete;
+    AxStdio(AxStdio&&) noexcept = delete;
+    AxStdio& operator=(AxStdio&&) noexcept = delete;
+
+    // Same as std::fwrite, may be called from any thread. Bytes are copied and written later unless flush is SYNC.
+    std::size_t write(std::FILE* file, const void* data, std::size_t size);
+
+    // Same as std::fread: blocks until size bytes have been read or the end of the file is reached
+    std::size_t read(std::FILE* file, void* data, std::size_t size);
+
+    // Same as std::fgetc on the input
+    int get();
+
+    // Block until all output has been written and host files have been flushed
+    void flush();
+
+    const AxStdioConfig& config() const noexcept
+    {
+        return m_config;
+    }
+
+    std::FILE* input() const noexcept
+    {
+        return m_input->file;
+    }
+
+private:
+    // Shared with the prefetch thread, which is detached on destruction if it is blocked reading input
+    struct Input
+    {
+        std::FILE* file{};
+        std::size_t capacity{};
+        std::mutex mutex{};
+        std::condition_variable condition{};
+        std::deque<char> bytes{};
+        bool eof{};
+        bool stopping{};
+    };
+
+    void work();
+    static void prefetch(std::shared_ptr<Input> input);
+
+    AxStdioConfig m_config;
+
+    // output, (file, size) of consecutive chunks of the ring
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    std::vector<char> m_ring;
+    std::size_t m_head{}; // next byte to write to the host file
+    std::size_t m_used{};
+    std::deque<std::pair<std::FILE*, std::size_t>> m_chunks{};
+    bool m_writing{}; // the I/O thread is writing chunks it removed from m_chunks
+    std::size_t m_flushing{}; // threads waiting in flush
+    bool m_stopping{};
+    std::thread m_thread{};
+
+    std::shared_ptr<Input> m_input;
+    std::thread m_prefetch_thread{};
+};
+
+#endif